@@ -0,0 +1,572 @@
+//
+//  BGPAnalytics.cpp
+//  BGPGeopol
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/device/file_descriptor.hpp>
+#include "tbb/parallel_for.h"
+#include "tbb/blocked_range.h"
+#include "BGPAnalytics.h"
+#include "BGPPeerStats.h"
+#include "BGPTables.h"
+
+extern BGPCache *cache;
+extern RIBTable *bgpTable;
+
+void BGPAnalytics::routeDelta(unsigned int pathHash, int sign){
+    if (pathHash != 0)
+        routeDeltas.push(RouteDelta(pathHash, sign));
+}
+
+void BGPAnalytics::linkChanged(unsigned long linkID, bool active){
+    linkDeltas.push(LinkDelta(linkID, active));
+}
+
+void BGPAnalytics::update(unsigned int time, unsigned int dumpDuration){
+    std::chrono::high_resolution_clock::time_point start=std::chrono::high_resolution_clock::now();
+    countryOf.clear();
+    applyLinkDeltas();
+    applyRouteDeltas();
+    computeHegemony();
+    std::chrono::duration<double, std::milli> processDuration=std::chrono::high_resolution_clock::now()-start;
+    incrementalTime = processDuration.count();
+    intervals++;
+    if ((benchmarkEvery>0) && (intervals % benchmarkEvery == 0)){
+        recompute();
+    }
+    save(time, dumpDuration);
+}
+
+void BGPAnalytics::applyLinkDeltas(){
+    LinkDelta delta;
+    std::unordered_map<unsigned long, bool> last;
+    while (linkDeltas.try_pop(delta)){
+        last[delta.linkID] = delta.active;
+    }
+    for (auto &p:last){
+        unsigned int src = p.first>>32;
+        unsigned int dst = p.first & 0xFFFFFFFF;
+        if (p.second){
+            insertEdge(src, dst);
+        } else {
+            removeEdge(src, dst);
+        }
+    }
+}
+
+void BGPAnalytics::applyRouteDeltas(){
+    RouteDelta delta;
+    std::unordered_map<unsigned int, long> net;
+    vector<pair<PathRoutes *, long>> work;
+
+    while (routeDeltas.try_pop(delta)){
+        net[delta.pathHash] += delta.sign;
+    }
+    work.reserve(net.size());
+    for (auto &p:net){
+        if (p.second == 0)
+            continue;
+        auto it = pathRoutes.find(p.first);
+        if (it == pathRoutes.end()){
+            if (p.second < 0)
+                continue; // route counted before this process started
+            auto ret = cache->pathsMap.find(p.first);
+            if (!ret.first)
+                continue;
+            PathRoutes &pathRoute = pathRoutes[p.first];
+            pathRoute.shortPath.assign(ret.second->shortPath, ret.second->shortPath+ret.second->shortPathLength);
+            it = pathRoutes.find(p.first);
+        }
+        // never let a path go below zero routes: withdrawals of routes learned
+        // before a restart are not attributable
+        long effective = max(p.second, -it->second.routes);
+        if (effective == 0)
+            continue;
+        it->second.routes += effective;
+        peerRoutes[it->second.shortPath.front()] += effective;
+        metrics[it->second.shortPath.back()].originRoutes += effective;
+        work.push_back(make_pair(&it->second, effective));
+    }
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, work.size()), [&](const tbb::blocked_range<size_t> &range){
+        for (size_t i=range.begin(); i<range.end(); ++i){
+            applyPath(work[i].first->shortPath, work[i].second);
+        }
+    });
+    for (auto it=pathRoutes.begin(); it!=pathRoutes.end();){
+        if (it->second.routes == 0){
+            it = pathRoutes.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void BGPAnalytics::applyPath(const vector<unsigned int> &shortPath, long delta){
+    unsigned long peer = shortPath.front();
+    string originCountry = getCountry(shortPath.back());
+    vector<string> transitCountries;
+    {
+        concurrent_hash_map<string, long>::accessor accessor;
+        countryRoutes.insert(accessor, originCountry);
+        accessor->second += delta;
+    }
+    for (size_t i=1; i+1<shortPath.size(); i++){
+        concurrent_hash_map<unsigned long, long>::accessor accessor;
+        peerTransit.insert(accessor, (peer<<32)+shortPath[i]);
+        accessor->second += delta;
+        accessor.release();
+        string country = getCountry(shortPath[i]);
+        if ((country != originCountry) &&
+            (std::find(transitCountries.begin(), transitCountries.end(), country) == transitCountries.end())){
+            transitCountries.push_back(country);
+        }
+    }
+    for (auto &country:transitCountries){
+        concurrent_hash_map<string, long>::accessor accessor;
+        countryTransit.insert(accessor, originCountry+":"+country);
+        accessor->second += delta;
+    }
+}
+
+string BGPAnalytics::getCountry(unsigned int asn){
+    {
+        concurrent_hash_map<unsigned int, string>::const_accessor accessor;
+        if (countryOf.find(accessor, asn))
+            return accessor->second;
+    }
+    string country = "??";
+    auto p = cache->asCache.find(asn);
+    if (p.first){
+        country = p.second->getCountry();
+    }
+    countryOf.insert(make_pair(asn, country));
+    return country;
+}
+
+void BGPAnalytics::insertEdge(unsigned int u, unsigned int v){
+    if (u == v)
+        return;
+    if (!adj[u].insert(v).second)
+        return;
+    adj[v].insert(u);
+    unsigned int cu = core[u], cv = core[v];
+    unsigned int K = min(cu, cv);
+    // Only the vertices of core K connected to the new edge through core K
+    // vertices can be promoted, and by one level at most.
+    std::unordered_map<unsigned int, unsigned int> cd;
+    vector<unsigned int> stack, candidates, queue;
+    if (cu == K){
+        cd[u] = 0;
+        stack.push_back(u);
+    }
+    if ((cv == K) && (cd.find(v) == cd.end())){
+        cd[v] = 0;
+        stack.push_back(v);
+    }
+    while (!stack.empty()){
+        unsigned int x = stack.back();
+        stack.pop_back();
+        candidates.push_back(x);
+        unsigned int count = 0;
+        for (auto y:adj[x]){
+            unsigned int cy = core[y];
+            if (cy >= K)
+                count++;
+            if ((cy == K) && (cd.find(y) == cd.end())){
+                cd[y] = 0;
+                stack.push_back(y);
+            }
+        }
+        cd[x] = count;
+    }
+    std::unordered_set<unsigned int> evicted;
+    for (auto x:candidates){
+        if (cd[x] <= K){
+            evicted.insert(x);
+            queue.push_back(x);
+        }
+    }
+    while (!queue.empty()){
+        unsigned int x = queue.back();
+        queue.pop_back();
+        for (auto y:adj[x]){
+            auto it = cd.find(y);
+            if ((it != cd.end()) && (evicted.find(y) == evicted.end())){
+                it->second--;
+                if (it->second <= K){
+                    evicted.insert(y);
+                    queue.push_back(y);
+                }
+            }
+        }
+    }
+    for (auto x:candidates){
+        if (evicted.find(x) == evicted.end())
+            core[x] = K+1;
+    }
+}
+
+void BGPAnalytics::removeEdge(unsigned int u, unsigned int v){
+    auto it = adj.find(u);
+    if ((it == adj.end()) || (it->second.erase(v) == 0))
+        return;
+    adj[v].erase(u);
+    unsigned int K = min(core[u], core[v]);
+    if (K > 0){
+        // Only the vertices of core K connected to the removed edge through
+        // core K vertices can be demoted, and by one level at most.
+        std::unordered_map<unsigned int, unsigned int> cd;
+        vector<unsigned int> queue;
+        auto countK = [&](unsigned int x){
+            unsigned int count = 0;
+            for (auto y:adj[x]){
+                if (core[y] >= K)
+                    count++;
+            }
+            return count;
+        };
+        for (auto root: {u, v}){
+            if ((core[root] == K) && (cd.find(root) == cd.end())){
+                cd[root] = countK(root);
+                if (cd[root] < K)
+                    queue.push_back(root);
+            }
+        }
+        while (!queue.empty()){
+            unsigned int x = queue.back();
+            queue.pop_back();
+            if (core[x] != K)
+                continue;
+            core[x] = K-1;
+            for (auto y:adj[x]){
+                if (core[y] != K)
+                    continue;
+                auto it1 = cd.find(y);
+                if (it1 == cd.end()){
+                    it1 = cd.insert(make_pair(y, countK(y))).first;
+                } else {
+                    it1->second--;
+                }
+                if (it1->second < K)
+                    queue.push_back(y);
+            }
+        }
+    }
+    for (auto x: {u, v}){
+        if (adj[x].empty()){
+            adj.erase(x);
+            core.erase(x);
+        }
+    }
+}
+
+std::unordered_map<unsigned int, unsigned int> BGPAnalytics::fullCore(std::unordered_map<unsigned int, std::unordered_set<unsigned int>> &adj){
+    // Batagelj-Zaversnik bucket peeling
+    vector<unsigned int> vertices, deg, pos, order, bin;
+    std::unordered_map<unsigned int, unsigned int> index, result;
+    unsigned int maxDeg = 0;
+    for (auto &p:adj){
+        index[p.first] = vertices.size();
+        vertices.push_back(p.first);
+        deg.push_back(p.second.size());
+        maxDeg = max(maxDeg, (unsigned int)p.second.size());
+    }
+    size_t n = vertices.size();
+    bin.assign(maxDeg+1, 0);
+    pos.resize(n);
+    order.resize(n);
+    for (size_t i=0; i<n; i++)
+        bin[deg[i]]++;
+    unsigned int start = 0;
+    for (unsigned int d=0; d<=maxDeg; d++){
+        unsigned int num = bin[d];
+        bin[d] = start;
+        start += num;
+    }
+    for (size_t i=0; i<n; i++){
+        pos[i] = bin[deg[i]];
+        order[pos[i]] = i;
+        bin[deg[i]]++;
+    }
+    for (unsigned int d=maxDeg; d>0; d--)
+        bin[d] = bin[d-1];
+    bin[0] = 0;
+    for (size_t i=0; i<n; i++){
+        unsigned int x = order[i];
+        for (auto yAsn:adj[vertices[x]]){
+            unsigned int y = index[yAsn];
+            if (deg[y] > deg[x]){
+                unsigned int dy = deg[y], py = pos[y];
+                unsigned int pw = bin[dy], w = order[pw];
+                if (y != w){
+                    pos[y] = pw;
+                    order[py] = w;
+                    pos[w] = py;
+                    order[pw] = y;
+                }
+                bin[dy]++;
+                deg[y]--;
+            }
+        }
+    }
+    for (size_t i=0; i<n; i++)
+        result[vertices[i]] = deg[i];
+    return result;
+}
+
+// peer ASes whose sessions were all flagged partial or noisy at the last report
+void BGPAnalytics::unusablePeers(std::unordered_set<unsigned int> &asns){
+    std::unordered_set<unsigned int> usable;
+    if (cache->peerStats == NULL)
+        return;
+    unsigned int n=cache->peers.size();
+    for (unsigned int id=0; id<n; id++){
+        Peer *peer=cache->peers.at(id);
+        if (peer == NULL)
+            continue;
+        if (cache->peerStats->usable(peer))
+            usable.insert(peer->getAsn());
+        else
+            asns.insert(peer->getAsn());
+    }
+    for (auto asn:usable)
+        asns.erase(asn);
+}
+
+// unusable peers keep their routes counted but are no viewpoint of the interval
+void BGPAnalytics::computeHegemony(){
+    std::unordered_map<unsigned int, vector<pair<unsigned int, long>>> byAS;
+    std::unordered_map<unsigned int, size_t> peerIndex;
+    std::unordered_set<unsigned int> unusable;
+    vector<unsigned long> zeros;
+    vector<pair<unsigned int, ASMetrics *>> transitASes;
+
+    unusablePeers(unusable);
+    excluded = 0;
+    for (auto it=peerRoutes.begin(); it!=peerRoutes.end();){
+        if (it->second <= 0){
+            it = peerRoutes.erase(it);
+        } else if (unusable.count(it->first)){
+            excluded++;
+            ++it;
+        } else {
+            // size() read first, the evaluation order of the assignment is unspecified in C++11
+            size_t idx = peerIndex.size();
+            peerIndex[it->first] = idx;
+            ++it;
+        }
+    }
+    for (auto &p:peerTransit){
+        if (p.second <= 0){
+            zeros.push_back(p.first);
+        } else {
+            byAS[p.first & 0xFFFFFFFF].push_back(make_pair((unsigned int)(p.first>>32), p.second));
+        }
+    }
+    for (auto key:zeros)
+        peerTransit.erase(key);
+    for (auto &p:metrics){
+        p.second.transitRoutes = 0;
+        p.second.hegemony = 0.0;
+    }
+    for (auto &p:byAS){
+        transitASes.push_back(make_pair(p.first, &metrics[p.first]));
+    }
+    size_t numPeers = peerIndex.size();
+    viewpoints = numPeers;
+    size_t trimmed = (size_t)(trim*numPeers);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, transitASes.size()), [&](const tbb::blocked_range<size_t> &range){
+        vector<double> fractions(numPeers);
+        for (size_t i=range.begin(); i<range.end(); ++i){
+            std::fill(fractions.begin(), fractions.end(), 0.0);
+            long transit = 0;
+            for (auto &p:byAS.find(transitASes[i].first)->second){
+                auto itPeer = peerIndex.find(p.first);
+                transit += p.second;
+                if (itPeer != peerIndex.end()){
+                    fractions[itPeer->second] = min(1.0, p.second*1.0/peerRoutes.find(p.first)->second);
+                }
+            }
+            transitASes[i].second->transitRoutes = transit;
+            if (numPeers > 2*trimmed){
+                std::sort(fractions.begin(), fractions.end());
+                double sum = 0.0;
+                for (size_t k=trimmed; k<numPeers-trimmed; k++)
+                    sum += fractions[k];
+                transitASes[i].second->hegemony = sum/(numPeers-2*trimmed);
+            }
+        }
+    });
+    for (auto it=metrics.begin(); it!=metrics.end();){
+        if ((it->second.transitRoutes == 0) && (it->second.originRoutes <= 0)){
+            it = metrics.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// the path of an active route; the RIB may hold paths evicted from memory, they are
+// read from Redis without being cached again
+bool BGPAnalytics::ribPath(unsigned int pathHash, unsigned int peer, vector<unsigned int> &shortPath){
+    SPrefixPath path;
+    auto p = cache->pathsMap.find(pathHash);
+    if (p.first && p.second)
+        path = p.second;
+    if (!path)
+        path = cache->evictedPath(pathHash);
+    if (!path){
+        try {
+            auto str = cache->bgpRedis->getRedis(peer)->hget("PATHS", to_myencoding(pathHash));
+            if (!str)
+                return false;
+            path = std::make_shared<PrefixPath>();
+            path->fromRedis(*str);
+        } catch (const sw::redis::Error &err){
+            return false;
+        }
+    }
+    if (path->shortPathLength == 0)
+        return false;
+    shortPath.assign(path->shortPath, path->shortPath+path->shortPathLength);
+    return true;
+}
+
+// Rebuilds the routes, the AS graph and the cores from the RIB: the active routes
+// of every prefix, their paths and the links along them. The workers are held
+// while the routes are read and the pending deltas applied, so the incremental
+// state compared is the same point of the stream; the rebuilt state replaces it.
+void BGPAnalytics::recompute(){
+    std::chrono::high_resolution_clock::time_point start=std::chrono::high_resolution_clock::now();
+    std::unordered_map<unsigned int, double> previous;
+    std::unordered_map<unsigned int, long> ribRoutes;
+    std::unordered_map<unsigned int, unsigned int> pathPeer;
+    std::unordered_map<unsigned int, PathRoutes> rebuilt;
+    std::unordered_map<unsigned int, std::unordered_set<unsigned int>> ribAdj;
+    vector<bgpstream_pfx_t> pfxs;
+    vector<pair<PathRoutes *, long>> work;
+
+    cache->pauseWorkers();
+    applyRouteDeltas();
+    bgpTable->ribTrie->prefixes(pfxs);
+    for (auto &pfx:pfxs){
+        auto p = bgpTable->ribTrie->search(&pfx);
+        if (!p.first || (p.second == NULL))
+            continue;
+        vector<pair<unsigned int, unsigned int>> routes;
+        ((RIBElement *)p.second)->getRoutes(routes);
+        for (auto &route:routes){
+            ribRoutes[route.second]++;
+            Peer *peer = cache->peers.at(route.first);
+            if (peer)
+                pathPeer[route.second] = peer->getAsn();
+        }
+    }
+    cache->resumeWorkers();
+    computeHegemony();
+    for (auto &p:metrics)
+        previous[p.first] = p.second.hegemony;
+
+    unresolved = 0;
+    for (auto &p:ribRoutes){
+        PathRoutes pathRoute;
+        if (!ribPath(p.first, pathPeer[p.first], pathRoute.shortPath)){
+            unresolved += p.second;
+            continue;
+        }
+        pathRoute.routes = p.second;
+        for (size_t i=0; i+1<pathRoute.shortPath.size(); i++){
+            unsigned int u = pathRoute.shortPath[i], v = pathRoute.shortPath[i+1];
+            if (u != v){
+                ribAdj[u].insert(v);
+                ribAdj[v].insert(u);
+            }
+        }
+        rebuilt[p.first] = std::move(pathRoute);
+    }
+    std::unordered_map<unsigned int, unsigned int> cores = fullCore(ribAdj);
+
+    peerTransit.clear();
+    countryTransit.clear();
+    countryRoutes.clear();
+    peerRoutes.clear();
+    metrics.clear();
+    pathRoutes.swap(rebuilt);
+    for (auto &p:pathRoutes){
+        peerRoutes[p.second.shortPath.front()] += p.second.routes;
+        metrics[p.second.shortPath.back()].originRoutes += p.second.routes;
+        work.push_back(make_pair(&p.second, p.second.routes));
+    }
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, work.size()), [&](const tbb::blocked_range<size_t> &range){
+        for (size_t i=range.begin(); i<range.end(); ++i){
+            applyPath(work[i].first->shortPath, work[i].second);
+        }
+    });
+    computeHegemony();
+    std::chrono::duration<double, std::milli> processDuration=std::chrono::high_resolution_clock::now()-start;
+    recomputeTime = processDuration.count();
+
+    consistent = (unresolved == 0) && (cores == core) && (ribAdj == adj);
+    for (auto &p:metrics){
+        auto it = previous.find(p.first);
+        double before = (it == previous.end()) ? 0.0 : it->second;
+        if (fabs(before-p.second.hegemony) > 1e-9)
+            consistent = false;
+    }
+    cout<<"Analytics incremental "<<incrementalTime<<" msec, full recompute from the RIB "<<recomputeTime<<" msec, "
+        <<ribRoutes.size()<<" paths, "<<unresolved<<" routes unresolved, consistent:"<<consistent<<endl;
+    adj.swap(ribAdj);
+    core.swap(cores);
+}
+
+void BGPAnalytics::save(unsigned int time, unsigned int dumpDuration){
+    json j, ases, countries;
+    j["time"] = time;
+    j["end"] = time+dumpDuration;
+    j["incrementalTime"] = incrementalTime;
+    j["viewpoints"] = viewpoints;
+    j["excludedPeers"] = excluded;
+    if (benchmarkEvery > 0){
+        // the reference rebuilt from the RIB routes and paths, not from the incremental state
+        j["recomputeSource"] = "rib";
+        j["recomputeTime"] = recomputeTime;
+        j["recomputeUnresolved"] = unresolved;
+        j["consistent"] = consistent;
+    }
+    for (auto &p:adj){
+        json a;
+        a["degree"] = p.second.size();
+        a["core"] = core[p.first];
+        auto it = metrics.find(p.first);
+        if (it != metrics.end()){
+            a["hegemony"] = it->second.hegemony;
+            a["transit"] = it->second.transitRoutes;
+            a["origin"] = it->second.originRoutes;
+        }
+        ases[to_string(p.first)] = a;
+    }
+    j["ases"] = ases;
+    for (auto &p:countryRoutes){
+        if (p.second > 0){
+            countries[p.first]["routes"] = p.second;
+        }
+    }
+    for (auto &p:countryTransit){
+        size_t sep = p.first.find(':');
+        string origin = p.first.substr(0, sep);
+        concurrent_hash_map<string, long>::const_accessor accessor;
+        if ((p.second > 0) && countryRoutes.find(accessor, origin) && (accessor->second > 0)){
+            countries[origin]["dependency"][p.first.substr(sep+1)] = p.second*1.0/accessor->second;
+        }
+    }
+    j["countries"] = countries;
+    boost::iostreams::filtering_ostream out;
+    out.push(boost::iostreams::gzip_compressor());
+    out.push(boost::iostreams::file_descriptor_sink(dumpath+"/analytics"+to_string(time)+"."+to_string(time+dumpDuration)+".json.gz"));
+    out<<j.dump()<<endl;
+}
@@ -0,0 +1,111 @@
+//
+//  BGPAnalytics.h
+//  BGPGeopol
+//
+//  Interval analytics stage: per-AS degree, k-core, path based AS hegemony
+//  and per-country transit dependency, maintained incrementally from the
+//  route and link changes of each interval. Peer ASes flagged partial or
+//  noisy by PeerStats are left out of the hegemony viewpoints.
+//
+
+#ifndef BGPGEOPOLITICS_BGPANALYTICS_H
+#define BGPGEOPOLITICS_BGPANALYTICS_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include "tbb/concurrent_queue.h"
+#include "tbb/concurrent_hash_map.h"
+#include "cache.h"
+#include "json.hpp"
+
+using namespace std;
+using namespace tbb;
+using json = nlohmann::json;
+
+class RouteDelta{
+public:
+    unsigned int pathHash;
+    int sign;
+    RouteDelta(){}
+    RouteDelta(unsigned int pathHash, int sign): pathHash(pathHash), sign(sign){}
+};
+
+class LinkDelta{
+public:
+    unsigned long linkID;
+    bool active;
+    LinkDelta(){}
+    LinkDelta(unsigned long linkID, bool active): linkID(linkID), active(active){}
+};
+
+class PathRoutes{
+public:
+    vector<unsigned int> shortPath;
+    long routes=0;
+};
+
+class ASMetrics{
+public:
+    long transitRoutes=0;
+    long originRoutes=0;
+    double hegemony=0.0;
+};
+
+class BGPAnalytics{
+public:
+    // fraction of viewpoints trimmed at each end when averaging the hegemony
+    double trim=0.1;
+    // rebuild from the RIB every benchmarkEvery intervals and compare (0 disables)
+    int benchmarkEvery=0;
+
+    BGPAnalytics(string dumpath): dumpath(dumpath){}
+
+    // hot path, called by the TableFlagger workers
+    void routeDelta(unsigned int pathHash, int sign);
+    // called from makeGraph for every touched link
+    void linkChanged(unsigned long linkID, bool active);
+    // called once per interval by the saver
+    void update(unsigned int time, unsigned int dumpDuration);
+    void recompute();
+
+private:
+    string dumpath;
+    int intervals=0;
+    concurrent_queue<RouteDelta> routeDeltas;
+    concurrent_queue<LinkDelta> linkDeltas;
+
+    std::unordered_map<unsigned int, PathRoutes> pathRoutes;
+    std::unordered_map<unsigned int, std::unordered_set<unsigned int>> adj;
+    std::unordered_map<unsigned int, unsigned int> core;
+    std::unordered_map<unsigned int, ASMetrics> metrics;
+    std::unordered_map<unsigned int, long> peerRoutes;
+    // key is (peer<<32)+transit AS
+    concurrent_hash_map<unsigned long, long> peerTransit;
+    // key is originCountry+":"+transitCountry
+    concurrent_hash_map<string, long> countryTransit;
+    concurrent_hash_map<string, long> countryRoutes;
+    concurrent_hash_map<unsigned int, string> countryOf;
+
+    double incrementalTime=0.0, recomputeTime=0.0;
+    // hegemony viewpoints and peer ASes left out as unusable, last computation
+    size_t viewpoints=0, excluded=0;
+    bool consistent=true;
+    // routes of the last recompute whose path was found neither in memory nor in Redis
+    long unresolved=0;
+
+    void applyLinkDeltas();
+    void applyRouteDeltas();
+    void applyPath(const vector<unsigned int> &shortPath, long delta);
+    string getCountry(unsigned int asn);
+    void insertEdge(unsigned int u, unsigned int v);
+    void removeEdge(unsigned int u, unsigned int v);
+    void unusablePeers(std::unordered_set<unsigned int> &asns);
+    void computeHegemony();
+    std::unordered_map<unsigned int, unsigned int> fullCore(std::unordered_map<unsigned int, std::unordered_set<unsigned int>> &adj);
+    bool ribPath(unsigned int pathHash, unsigned int peer, vector<unsigned int> &shortPath);
+    void save(unsigned int time, unsigned int dumpDuration);
+};
+
+#endif //BGPGEOPOLITICS_BGPANALYTICS_H
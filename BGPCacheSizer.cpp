@@ -0,0 +1,123 @@
+//
+//  BGPCacheSizer.cpp
+//  BGPGeopol
+//
+
+#include <fstream>
+#include <iostream>
+#include "BGPCacheSizer.h"
+
+void CacheSizer::add(string name, std::function<CacheCounters()> counters, std::function<void(size_t)> resize,
+                     size_t minCapacity, size_t maxCapacity, long maxBytes){
+    std::lock_guard<std::mutex> lock(mutex_);
+    Managed m;
+    m.name = name;
+    m.counters = counters;
+    m.resize = resize;
+    m.minCapacity = minCapacity;
+    m.maxCapacity = maxCapacity;
+    m.maxBytes = maxBytes;
+    m.last = counters();
+    caches.push_back(m);
+}
+
+bool CacheSizer::loadBudget(string file){
+    std::ifstream in(file);
+    json j;
+    if (!in.is_open())
+        return false;
+    try {
+        in>>j;
+        if (j.find("caches") != j.end())
+            budget = j["caches"].get<long>();
+    } catch (json::exception &e){
+        cout<<"Bad cache budget in "<<file<<":"<<e.what()<<endl;
+        return false;
+    }
+    return true;
+}
+
+double CacheSizer::limit(Managed &m){
+    double capacity=m.maxCapacity;
+    if (m.maxBytes > 0)
+        capacity = min(capacity, m.maxBytes/m.entryBytes);
+    return max(capacity, (double)m.minCapacity);
+}
+
+double CacheSizer::shift(Managed &m, double bytes, json &j){
+    size_t capacity=m.now.capacity;
+    double target=capacity+bytes/m.entryBytes;
+    target = min(max(target, (double)m.minCapacity), limit(m));
+    if ((size_t)target == capacity)
+        return 0;
+    m.resize((size_t)target);
+    j[m.name]["resized"] = (size_t)target;
+    cout<<"Cache "<<m.name<<" resized from "<<capacity<<" to "<<(size_t)target<<endl;
+    return (target-capacity)*m.entryBytes;
+}
+
+void CacheSizer::update(json &j){
+    std::lock_guard<std::mutex> lock(mutex_);
+    double total=0;
+    Managed *best=NULL, *worst=NULL;
+    for (auto &m:caches){
+        CacheCounters &now=m.now, &last=m.last;
+        now = m.counters();
+        size_t lookups=now.lookups-last.lookups, misses=now.misses-last.misses;
+        size_t fetches=now.fetches-last.fetches, fetchTime=now.fetchTime-last.fetchTime;
+        json c;
+        c["lookups"] = lookups;
+        c["hitRatio"] = lookups ? (lookups-misses)*1.0/lookups : 0.0;
+        c["misses"] = misses;
+        c["inserts"] = now.inserts-last.inserts;
+        c["evictions"] = now.evictions-last.evictions;
+        c["fetches"] = fetches;
+        // milliseconds in Redis, and mean round trip in microseconds
+        c["fetchTime"] = fetchTime/1000.0;
+        c["missCost"] = fetches ? fetchTime*1.0/fetches : 0.0;
+        c["size"] = now.size;
+        c["capacity"] = now.capacity;
+        c["bytes"] = now.bytes;
+        j[m.name] = c;
+        if (now.size > 0)
+            m.entryBytes = now.bytes*1.0/now.size;
+        else if (m.entryBytes <= 0)
+            m.entryBytes = 1;
+        // an idle interval keeps the previous score
+        if (lookups > 0)
+            m.score = fetchTime/(m.entryBytes*max((size_t)1, now.capacity));
+        m.full = (now.size >= fullRatio*now.capacity) && (now.evictions > last.evictions);
+        total += m.entryBytes*now.capacity;
+        last = now;
+        if (m.full && (m.score > 0) && (!best || (m.score > best->score)))
+            best = &m;
+        if (!worst || (m.score < worst->score))
+            worst = &m;
+    }
+    if (caches.empty())
+        return;
+    if (budget <= 0)
+        budget = total;
+    j["budget"] = budget;
+    j["total"] = total;
+    // a cache over its own cap goes back under it before any other step
+    for (auto &m:caches){
+        if (m.now.capacity > limit(m)){
+            shift(m, (limit(m)-m.now.capacity)*m.entryBytes, j);
+            return;
+        }
+    }
+    if (total > budget){
+        shift(*worst, -min(total-budget, step*worst->entryBytes*worst->now.capacity), j);
+    } else if (best){
+        double grow=step*best->entryBytes*best->now.capacity;
+        // free budget under a tenth of a step is rounding, not room to grow
+        if (budget-total >= 0.1*grow){
+            shift(*best, min(grow, budget-total), j);
+        } else if ((worst != best) && (best->score > hysteresis*worst->score)){
+            double moved=-shift(*worst, -min(grow, step*worst->entryBytes*worst->now.capacity), j);
+            if (moved > 0)
+                shift(*best, moved, j);
+        }
+    }
+}
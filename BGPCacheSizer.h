@@ -0,0 +1,70 @@
+//
+//  BGPCacheSizer.h
+//  BGPGeopol
+//
+//  Adaptive capacities for the path and routing caches. Once per interval
+//  each cache is scored by the time its misses spent in Redis per byte it
+//  holds; a cache that evicts and has the highest score grows into the free
+//  budget, or takes a step from the lowest scored cache when its score is
+//  hysteresis times higher. Over budget, the lowest scored cache shrinks.
+//  The shared byte budget is the "caches" entry of budgets.json, or the
+//  initial footprint of the caches at capacity. A cache may also have a
+//  byte cap of its own, its subsystem budget; the sizer never grows it past
+//  the cap and shrinks it back under first. The caches it manages have no
+//  MemoryAccountant shrink action, so only the sizer resizes them.
+//
+
+#ifndef BGPGEOPOLITICS_BGPCACHESIZER_H
+#define BGPGEOPOLITICS_BGPCACHESIZER_H
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "cache_structures.h"
+#include "json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+class CacheSizer{
+public:
+    // bytes shared by the caches, 0 until set or taken from the first update
+    long budget=0;
+    // largest relative capacity change of a cache in one interval
+    double step=0.25;
+    // score ratio needed to move capacity from one cache to another
+    double hysteresis=2.0;
+    // a cache this full is evicting, growing it may save misses
+    double fullRatio=0.95;
+
+    CacheSizer(){}
+    // maxBytes caps the cache alone, 0 for none
+    void add(string name, std::function<CacheCounters()> counters, std::function<void(size_t)> resize,
+             size_t minCapacity, size_t maxCapacity, long maxBytes=0);
+    bool loadBudget(string file);
+    // accounting of the interval and at most one resize step
+    void update(json &j);
+
+private:
+    struct Managed{
+        string name;
+        std::function<CacheCounters()> counters;
+        std::function<void(size_t)> resize;
+        size_t minCapacity, maxCapacity;
+        long maxBytes;
+        CacheCounters last;
+        // filled by update
+        CacheCounters now;
+        double entryBytes=0, score=0;
+        bool full=false;
+    };
+    std::mutex mutex_;
+    vector<Managed> caches;
+    // changes the capacity by bytes, within the limits; returns the bytes really moved
+    double shift(Managed &m, double bytes, json &j);
+    // largest capacity allowed by maxCapacity and maxBytes
+    double limit(Managed &m);
+};
+
+#endif //BGPGEOPOLITICS_BGPCACHESIZER_H
@@ -0,0 +1,563 @@
+//
+//  BGPCheckpoint.cpp
+//  BGPGeopol
+//
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <fstream>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+#include "tbb/parallel_for.h"
+#include "tbb/parallel_invoke.h"
+#include "BGPCheckpoint.h"
+#include "BGPTables.h"
+#include "cache.h"
+#include "json.hpp"
+
+using json = nlohmann::json;
+using namespace std::chrono;
+
+extern BGPCache *cache;
+extern RIBTable *bgpTable;
+
+static string pfxToStr(bgpstream_pfx_t *pfx){
+    char buffer[64];
+    bgpstream_pfx_snprintf(buffer, 64, pfx);
+    return string(buffer);
+}
+
+CheckpointWriter::CheckpointWriter(string filename, int fields): filename(filename), offset(sizeof(CheckpointHeader)){
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, CHECKPOINTMAGIC, sizeof(header.magic));
+    header.version = CHECKPOINTVERSION;
+    header.fields = fields;
+    file = fopen(filename.c_str(), "wb");
+    if (file == NULL)
+        cout<<"Cannot create checkpoint file "<<filename<<endl;
+    else if (fwrite(&header, sizeof(header), 1, file) != 1)
+        failed = true;
+}
+
+CheckpointWriter::~CheckpointWriter(){
+    if (file)
+        close();
+}
+
+bool CheckpointWriter::isOpen(){
+    return (file != NULL) && !failed;
+}
+
+void CheckpointWriter::beginRecord(){
+    if (header.recordNum % CHECKPOINTCHUNK == 0)
+        chunks.push_back(offset);
+    header.recordNum++;
+}
+
+// after the first error the records are dropped, close() reports the failure
+void CheckpointWriter::write(const string &str){
+    uint32_t len=str.size();
+    if (!isOpen())
+        return;
+    if ((fwrite(&len, sizeof(len), 1, file) != 1) || (fwrite(str.data(), 1, len, file) != len))
+        failed = true;
+    offset += sizeof(len)+len;
+}
+
+void CheckpointWriter::add(const string &f1){
+    beginRecord();
+    write(f1);
+}
+
+void CheckpointWriter::add(const string &f1, const string &f2){
+    beginRecord();
+    write(f1);
+    write(f2);
+}
+
+void CheckpointWriter::add(const string &f1, const string &f2, const string &f3){
+    beginRecord();
+    write(f1);
+    write(f2);
+    write(f3);
+}
+
+void CheckpointWriter::add(const string &f1, const string &f2, const string &f3, const string &f4){
+    beginRecord();
+    write(f1);
+    write(f2);
+    write(f3);
+    write(f4);
+}
+
+void CheckpointWriter::add(const string &f1, const string &f2, const string &f3, const string &f4, const string &f5){
+    beginRecord();
+    write(f1);
+    write(f2);
+    write(f3);
+    write(f4);
+    write(f5);
+}
+
+// false unless every record, the chunk table and the header reached the disk
+bool CheckpointWriter::close(){
+    if (file == NULL)
+        return false;
+    header.chunkNum = chunks.size();
+    header.tableOffset = offset;
+    bool ok=!failed;
+    if (ok && !chunks.empty())
+        ok = (fwrite(&chunks[0], sizeof(uint64_t), chunks.size(), file) == chunks.size());
+    ok = ok && (fseek(file, 0, SEEK_SET) == 0) && (fwrite(&header, sizeof(header), 1, file) == 1) &&
+        (fflush(file) == 0) && (fsync(fileno(file)) == 0);
+    if (fclose(file) != 0)
+        ok = false;
+    file = NULL;
+    if (!ok)
+        cout<<"Cannot write checkpoint file "<<filename<<endl;
+    return ok;
+}
+
+CheckpointReader::CheckpointReader(string filename){
+    struct stat st;
+    fd = open(filename.c_str(), O_RDONLY);
+    if (fd<0)
+        return;
+    if ((fstat(fd, &st)<0) || (st.st_size<(off_t)sizeof(CheckpointHeader))){
+        ::close(fd);
+        fd = -1;
+        return;
+    }
+    length = st.st_size;
+    data = (char *)mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED){
+        data = NULL;
+        ::close(fd);
+        fd = -1;
+        return;
+    }
+    header = (CheckpointHeader *)data;
+    if ((strncmp(header->magic, CHECKPOINTMAGIC, sizeof(header->magic)) != 0) || (header->version != CHECKPOINTVERSION) ||
+        (header->chunkNum > length/sizeof(uint64_t)) || (header->tableOffset > length) ||
+        (header->tableOffset+header->chunkNum*sizeof(uint64_t) > length)){
+        cout<<"Checkpoint "<<filename<<" is not a version "<<CHECKPOINTVERSION<<" checkpoint"<<endl;
+        munmap(data, length);
+        ::close(fd);
+        data = NULL;
+        fd = -1;
+        return;
+    }
+    madvise(data, length, MADV_SEQUENTIAL);
+    chunks = (uint64_t *)(data+header->tableOffset);
+}
+
+CheckpointReader::~CheckpointReader(){
+    if (data)
+        munmap(data, length);
+    if (fd>=0)
+        ::close(fd);
+}
+
+bool CheckpointReader::isOpen(){
+    return data != NULL;
+}
+
+uint64_t CheckpointReader::size(){
+    return header ? header->recordNum : 0;
+}
+
+// walks every record once so read() can trust the lengths; a truncated or
+// corrupt file fails here instead of reading past the mapping
+bool CheckpointReader::validate(uint32_t fields){
+    if ((data == NULL) || (header->fields != fields))
+        return false;
+    uint64_t records=0, previous=sizeof(CheckpointHeader);
+    for (uint64_t c=0; c<header->chunkNum; c++){
+        uint64_t pos=chunks[c];
+        uint64_t end=(c+1<header->chunkNum) ? chunks[c+1] : header->tableOffset;
+        if ((pos != previous) || (end<pos) || (end>header->tableOffset))
+            return false;
+        while (pos<end){
+            for (uint32_t f=0; f<fields; f++){
+                uint32_t len;
+                if (end-pos<sizeof(len))
+                    return false;
+                memcpy(&len, data+pos, sizeof(len));
+                pos += sizeof(len);
+                if (end-pos<len)
+                    return false;
+                pos += len;
+            }
+            records++;
+        }
+        previous = end;
+    }
+    return (previous == header->tableOffset) && (records == header->recordNum);
+}
+
+void CheckpointReader::read(std::function<void(vector<string> &)> process){
+    if (!data)
+        return;
+    tbb::parallel_for(tbb::blocked_range<uint64_t>(0, header->chunkNum, 1), [&](tbb::blocked_range<uint64_t> range){
+        vector<string> fields(header->fields);
+        for (uint64_t c=range.begin(); c<range.end(); c++){
+            uint64_t pos=chunks[c];
+            uint64_t end=(c+1<header->chunkNum) ? chunks[c+1] : header->tableOffset;
+            while (pos<end){
+                for (uint32_t f=0; f<header->fields; f++){
+                    uint32_t len;
+                    memcpy(&len, data+pos, sizeof(len));
+                    pos += sizeof(len);
+                    fields[f].assign(data+pos, len);
+                    pos += len;
+                }
+                process(fields);
+            }
+        }
+    });
+}
+
+unsigned int BGPCheckpoint::latest(){
+    std::ifstream in(dir+"/LATEST");
+    unsigned int time=0;
+    if (in.is_open())
+        in>>time;
+    return time;
+}
+
+// the workers are held at the interval end, the checkpoint has no later update
+void BGPCheckpoint::intervalEnded(unsigned int end){
+    if (++intervals % checkpointEvery == 0)
+        save(end);
+}
+
+// Workers are paused while writing so the files describe one state; the
+// tables are written in parallel to keep the pause short.
+bool BGPCheckpoint::save(unsigned int time){
+    string path=dir+"/"+to_string(time);
+    string tmp=path+".tmp";
+    high_resolution_clock::time_point start=high_resolution_clock::now();
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(tmp, ec);
+    if (!boost::filesystem::create_directories(tmp, ec)){
+        cout<<"Cannot create checkpoint directory "<<tmp<<endl;
+        return false;
+    }
+    std::atomic<bool> ok={true};
+    cache->pauseWorkers();
+    tbb::parallel_invoke([&](){ if (!savePrefixes(tmp)) ok=false; },
+                         [&](){ if (!saveRoutes(tmp)) ok=false; },
+                         [&](){ if (!savePaths(tmp)) ok=false; },
+                         [&](){ if (!saveASes(tmp)) ok=false; },
+                         [&](){ if (!saveLinks(tmp)) ok=false; },
+                         [&](){ if (!saveBlooms(tmp)) ok=false; },
+                         [&](){ if (!savePeers(tmp)) ok=false; });
+    if (!saveManifest(tmp, time))
+        ok = false;
+    cache->resumeWorkers();
+    if (!ok){
+        // LATEST still names the previous checkpoint
+        cout<<"Checkpoint "<<time<<" failed, not installed"<<endl;
+        boost::filesystem::remove_all(tmp, ec);
+        return false;
+    }
+    boost::filesystem::remove_all(path, ec);
+    boost::filesystem::rename(tmp, path, ec);
+    if (ec){
+        cout<<"Cannot install checkpoint "<<path<<":"<<ec.message()<<endl;
+        return false;
+    }
+    unsigned int previous=latest();
+    {
+        std::ofstream out(dir+"/LATEST.tmp");
+        out<<time<<endl;
+        out.close();
+        if (!out){
+            cout<<"Cannot write "<<dir<<"/LATEST.tmp"<<endl;
+            return false;
+        }
+    }
+    boost::filesystem::rename(dir+"/LATEST.tmp", dir+"/LATEST", ec);
+    if (ec){
+        cout<<"Cannot install "<<dir<<"/LATEST:"<<ec.message()<<endl;
+        return false;
+    }
+    if ((previous != 0) && (previous != time))
+        boost::filesystem::remove_all(dir+"/"+to_string(previous), ec);
+    duration<double> elapsed=high_resolution_clock::now()-start;
+    cout<<"Checkpoint "<<time<<" written in "<<elapsed.count()<<"s"<<endl;
+    return true;
+}
+
+bool BGPCheckpoint::load(unsigned int time){
+    string path=dir+"/"+to_string(time);
+    high_resolution_clock::time_point start=high_resolution_clock::now();
+    json manifest;
+    if (!loadManifest(path, manifest))
+        return false;
+    // every table is checked before anything is restored, so a bad checkpoint
+    // leaves the state empty for the Redis restart
+    CheckpointReader prefixes(path+"/prefixes.ckp"), routes(path+"/routes.ckp"), paths(path+"/paths.ckp"),
+        ases(path+"/ases.ckp"), links(path+"/links.ckp"), blooms(path+"/blooms.ckp"), peers(path+"/peers.ckp");
+    vector<pair<CheckpointReader *, uint32_t>> tables={{&prefixes, 4}, {&routes, 2}, {&paths, 2}, {&ases, 3},
+        {&links, 2}, {&blooms, 3}, {&peers, 4}};
+    const char *names[]={"prefixes", "routes", "paths", "ases", "links", "blooms", "peers"};
+    for (size_t i=0; i<tables.size(); i++){
+        if (!tables[i].first->validate(tables[i].second)){
+            cout<<"Checkpoint "<<path<<": "<<names[i]<<".ckp missing or corrupt"<<endl;
+            return false;
+        }
+    }
+    cache->pathsMap.setID(manifest["pathID"].get<unsigned int>());
+    cache->numActivePath = manifest["numActivePath"].get<int>();
+    // ASes first as links, paths and prefixes refer to them
+    loadASes(ases);
+    tbb::parallel_invoke([&](){ loadLinks(links); },
+                         [&](){ loadPrefixes(prefixes); },
+                         [&](){ loadPaths(paths); },
+                         [&](){ loadRoutes(routes); },
+                         [&](){ loadBlooms(blooms); },
+                         [&](){ loadPeers(peers); });
+    duration<double> elapsed=high_resolution_clock::now()-start;
+    cout<<"Checkpoint "<<time<<" loaded in "<<elapsed.count()<<"s"<<endl;
+    return true;
+}
+
+// prefix, visible peer count, origin ASes, id:pathHash of the active routes; the
+// sessions get their ids back from peers.ckp
+bool BGPCheckpoint::savePrefixes(string path){
+    CheckpointWriter writer(path+"/prefixes.ckp", 4);
+    vector<bgpstream_pfx_t> pfxs;
+    bgpTable->ribTrie->prefixes(pfxs);
+    for (auto &pfx:pfxs){
+        auto p=bgpTable->ribTrie->search(&pfx);
+        RIBElement *ribElement=(RIBElement *)p.second;
+        if (!p.first || (ribElement == NULL))
+            continue;
+        string origins, routes;
+        vector<unsigned int> ases;
+        vector<pair<unsigned int, unsigned int>> active;
+        ribElement->getOrigins(ases);
+        for (auto as:ases)
+            origins += to_myencoding(as)+",";
+        ribElement->getRoutes(active);
+        for (auto &p:active)
+            routes += to_myencoding(p.first)+":"+to_myencoding(p.second)+",";
+        writer.add(pfxToStr(&pfx), to_myencoding(ribElement->visiblePeerNum), origins, routes);
+    }
+    return writer.close();
+}
+
+void BGPCheckpoint::loadPrefixes(CheckpointReader &reader){
+    reader.read([](vector<string> &fields){
+        bgpstream_pfx_t pfx;
+        vector<string> origins;
+        bgpstream_str2pfx(fields[0].c_str(), &pfx);
+        RIBElement *ribElement=(RIBElement *)bgpTable->ribTrie->checkinsert(&pfx).second;
+        ribElement->visiblePeerNum = from_myencoding(fields[1]);
+        cache->numActiveRoutes += ribElement->visiblePeerNum;
+        boost::split(origins, fields[2], [](char c){return c == ',';});
+        for (auto &as:origins){
+            if (!as.empty())
+                ribElement->addAS(from_myencoding(as));
+        }
+        if (fields.size()>3){
+            vector<string> routes;
+            boost::split(routes, fields[3], [](char c){return c == ',';});
+            for (auto &route:routes){
+                size_t sep=route.find(':');
+                if (sep != string::npos)
+                    ribElement->setRoute(from_myencoding(route.substr(0, sep)), from_myencoding(route.substr(sep+1)));
+            }
+        }
+    });
+    cout<<"Checkpoint: "<<reader.size()<<" prefixes"<<endl;
+}
+
+// routing entries held in memory, the rest stays behind routingBF
+bool BGPCheckpoint::saveRoutes(string path){
+    CheckpointWriter writer(path+"/routes.ckp", 2);
+    vector<string> keys;
+    ThreadSafeScalableCache<string,unsigned int>::ConstAccessor accessor;
+    cache->routingentries.snapshotKeys(keys);
+    for (auto &key:keys){
+        if (cache->routingentries.find(accessor, key))
+            writer.add(key, to_myencoding(*accessor));
+    }
+    return writer.close();
+}
+
+void BGPCheckpoint::loadRoutes(CheckpointReader &reader){
+    reader.read([](vector<string> &fields){
+        cache->routingentries.insert(fields[0], from_myencoding(fields[1]));
+    });
+    cout<<"Checkpoint: "<<reader.size()<<" routing entries"<<endl;
+}
+
+// paths use the PATHS STR serialization
+bool BGPCheckpoint::savePaths(string path){
+    CheckpointWriter writer(path+"/paths.ckp", 2);
+    vector<SPrefixPath> paths;
+    std::unordered_map<string, string> map;
+    cache->pathsMap.snapshot(paths);
+    for (auto &p:paths){
+        map.clear();
+        p->toRedis(map);
+        writer.add(map["HSH"], map["STR"]);
+    }
+    return writer.close();
+}
+
+void BGPCheckpoint::loadPaths(CheckpointReader &reader){
+    reader.read([](vector<string> &fields){
+        unsigned int hash=from_myencoding(fields[0]);
+        SPrefixPath p=std::make_shared<PrefixPath>(fields[1]);
+        cache->pathsMap.insert(hash, p, p->lastChange);
+    });
+    cout<<"Checkpoint: "<<reader.size()<<" paths"<<endl;
+}
+
+// ASN, ASN STR serialization, active prefixes
+bool BGPCheckpoint::saveASes(string path){
+    CheckpointWriter writer(path+"/ases.ckp", 3);
+    vector<bgpstream_pfx_t> pfxs;
+    for (auto &p:cache->asCache){
+        string prefixes;
+        pfxs.clear();
+        p.second->getActivePrefixes(pfxs);
+        for (auto &pfx:pfxs)
+            prefixes += pfxToStr(&pfx)+",";
+        writer.add(to_myencoding(p.first), p.second->toRedisStr(), prefixes);
+    }
+    return writer.close();
+}
+
+void BGPCheckpoint::loadASes(CheckpointReader &reader){
+    reader.read([](vector<string> &fields){
+        std::unordered_map<string, string> asMap;
+        vector<string> prefixes;
+        bgpstream_pfx_t pfx;
+        asMap["ASN"]=fields[0];
+        asMap["STR"]=fields[1];
+        SAS as=std::make_shared<AS>(asMap);
+        auto p=cache->asCache.insert(make_pair(as->getNum(), as));
+        if (!p.first)
+            return;
+        as->touch();
+        boost::split(prefixes, fields[2], [](char c){return c == ',';});
+        for (auto &str:prefixes){
+            if (str.empty())
+                continue;
+            bgpstream_str2pfx(str.c_str(), &pfx);
+            as->restorePrefix(&pfx);
+        }
+    });
+    cout<<"Checkpoint: "<<reader.size()<<" ASes"<<endl;
+}
+
+// link id, LINKS STR serialization
+bool BGPCheckpoint::saveLinks(string path){
+    CheckpointWriter writer(path+"/links.ckp", 2);
+    for (auto &p:cache->linksMap)
+        writer.add(p.second->linkStr(), p.second->toRedisStr());
+    return writer.close();
+}
+
+void BGPCheckpoint::loadLinks(CheckpointReader &reader){
+    reader.read([](vector<string> &fields){
+        std::unordered_map<string, string> linkMap;
+        linkMap["STR"]=fields[1];
+        Link *lnk=new Link(linkMap);
+        cache->linksMap.insert(make_pair(lnk->linkID(),lnk));
+        if (lnk->isActive())
+            lnk->addLinks(0);
+    });
+    cout<<"Checkpoint: "<<reader.size()<<" links"<<endl;
+}
+
+// filter name, shard, bit table
+bool BGPCheckpoint::saveBlooms(string path){
+    CheckpointWriter writer(path+"/blooms.ckp", 3);
+    for (size_t i=0; i<cache->pathsBF.shardNum(); i++)
+        writer.add("PATHS", to_string(i), cache->pathsBF.shard(i).dump());
+    for (size_t i=0; i<cache->routingBF.shardNum(); i++)
+        writer.add("ROUTING", to_string(i), cache->routingBF.shard(i).dump());
+    return writer.close();
+}
+
+void BGPCheckpoint::loadBlooms(CheckpointReader &reader){
+    reader.read([](vector<string> &fields){
+        ThreadSafeScalableBF &bf=(fields[0] == "PATHS") ? cache->pathsBF : cache->routingBF;
+        size_t i=stoul(fields[1]);
+        if ((i>=bf.shardNum()) || !bf.shard(i).restore(fields[2]))
+            cout<<"Checkpoint: Bloom filter "<<fields[0]<<":"<<i<<" does not match, skipped"<<endl;
+    });
+}
+
+// collector, raw peer address, ASN, IPv4 and IPv6 route counts; the counts
+// match the restored routes, so withdrawals do not drive them negative
+bool BGPCheckpoint::savePeers(string path){
+    CheckpointWriter writer(path+"/peers.ckp", 5);
+    for (unsigned int id=0; id<cache->peers.size(); id++){
+        Peer *peer=cache->peers.at(id);
+        if (peer == NULL)
+            continue;
+        writer.add(to_myencoding(peer->collector), string((char *)&peer->address, sizeof(bgpstream_ip_addr_t)),
+                   to_myencoding(peer->getAsn()), to_string(peer->prefixes(0))+":"+to_string(peer->prefixes(1)),
+                   to_myencoding(id));
+    }
+    return writer.close();
+}
+
+void BGPCheckpoint::loadPeers(CheckpointReader &reader){
+    reader.read([](vector<string> &fields){
+        bgpstream_ip_addr_t address;
+        size_t sep=fields[3].find(':');
+        if ((fields[1].size() != sizeof(bgpstream_ip_addr_t)) || (sep == string::npos))
+            return;
+        memcpy(&address, fields[1].data(), sizeof(bgpstream_ip_addr_t));
+        Peer *peer=cache->peers.restore(from_myencoding(fields[4]), from_myencoding(fields[0]), address, from_myencoding(fields[2]));
+        peer->restorePrefixes(0, stoi(fields[3].substr(0, sep)));
+        peer->restorePrefixes(1, stoi(fields[3].substr(sep+1)));
+    });
+    cout<<"Checkpoint: "<<reader.size()<<" peers"<<endl;
+}
+
+bool BGPCheckpoint::saveManifest(string path, unsigned int time){
+    json j;
+    j["version"] = CHECKPOINTVERSION;
+    j["time"] = time;
+    j["pathID"] = cache->pathsMap.getCurrentID();
+    j["numActivePath"] = cache->numActivePath.load();
+    std::ofstream out(path+"/manifest.json");
+    out<<j.dump()<<endl;
+    out.close();
+    return !out.fail();
+}
+
+// checks the manifest, the values are applied once every table is validated
+bool BGPCheckpoint::loadManifest(string path, json &j){
+    std::ifstream in(path+"/manifest.json");
+    if (!in.is_open()){
+        cout<<"No checkpoint manifest in "<<path<<endl;
+        return false;
+    }
+    try {
+        in>>j;
+        if (j["version"] != CHECKPOINTVERSION){
+            cout<<"Checkpoint "<<path<<" has version "<<j["version"]<<", expected "<<CHECKPOINTVERSION<<endl;
+            return false;
+        }
+        if (!j["pathID"].is_number() || !j["numActivePath"].is_number()){
+            cout<<"Bad checkpoint manifest in "<<path<<endl;
+            return false;
+        }
+    } catch (json::exception &e){
+        cout<<"Bad checkpoint manifest in "<<path<<":"<<e.what()<<endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,116 @@
+//
+//  BGPCheckpoint.h
+//  BGPGeopol
+//
+//  Binary checkpoint of the in-memory state (RIB trie, routing entries,
+//  paths, ASes, links, peers and Bloom filters) written at CAPTTIME boundaries so a
+//  restart does not need to read everything back from Redis.
+//
+//  A checkpoint is a directory <dir>/<time> holding one file per table.
+//  Each file is a header, length prefixed records grouped in chunks, and a
+//  chunk offset table at the end so a mmapped file is read by parallel tasks.
+//  <dir>/LATEST names the last complete checkpoint.
+//
+
+#ifndef BGPGEOPOLITICS_BGPCHECKPOINT_H
+#define BGPGEOPOLITICS_BGPCHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdio.h>
+#include <stdint.h>
+#include "json.hpp"
+
+using namespace std;
+
+#define CHECKPOINTVERSION 3
+#define CHECKPOINTMAGIC "BGPCKPT"
+// records per chunk, the unit of parallel loading
+#define CHECKPOINTCHUNK 65536
+
+struct CheckpointHeader{
+    char magic[8];
+    uint32_t version;
+    uint32_t fields;
+    uint64_t recordNum;
+    uint64_t chunkNum;
+    uint64_t tableOffset;
+};
+
+class CheckpointWriter{
+public:
+    CheckpointWriter(string filename, int fields);
+    ~CheckpointWriter();
+    bool isOpen();
+    void add(const string &f1);
+    void add(const string &f1, const string &f2);
+    void add(const string &f1, const string &f2, const string &f3);
+    void add(const string &f1, const string &f2, const string &f3, const string &f4);
+    void add(const string &f1, const string &f2, const string &f3, const string &f4, const string &f5);
+    // false if any write failed, the checkpoint is then not installed
+    bool close();
+private:
+    string filename;
+    FILE *file;
+    bool failed=false;
+    CheckpointHeader header;
+    vector<uint64_t> chunks;
+    uint64_t offset;
+    void beginRecord();
+    void write(const string &str);
+};
+
+class CheckpointReader{
+public:
+    CheckpointReader(string filename);
+    ~CheckpointReader();
+    bool isOpen();
+    uint64_t size();
+    // header, chunk table and every record length within the file
+    bool validate(uint32_t fields);
+    // calls process on every record of a validated file, chunks are handled by parallel tasks
+    void read(std::function<void(vector<string> &)> process);
+private:
+    int fd=-1;
+    char *data=NULL;
+    size_t length=0;
+    CheckpointHeader *header=NULL;
+    uint64_t *chunks=NULL;
+};
+
+class BGPCheckpoint{
+public:
+    // write a checkpoint every checkpointEvery intervals
+    int checkpointEvery=6;
+
+    BGPCheckpoint(string dir): dir(dir){}
+    // time of the last complete checkpoint, 0 if none
+    unsigned int latest();
+    bool save(unsigned int time);
+    // called at the cut of each interval, the state is the one at its end
+    void intervalEnded(unsigned int end);
+    // false, with nothing restored, unless every table is present and well formed
+    bool load(unsigned int time);
+private:
+    string dir;
+    int intervals=0;
+    bool savePrefixes(string path);
+    bool saveRoutes(string path);
+    bool savePaths(string path);
+    bool saveASes(string path);
+    bool saveLinks(string path);
+    bool saveBlooms(string path);
+    bool savePeers(string path);
+    bool saveManifest(string path, unsigned int time);
+    bool loadManifest(string path, nlohmann::json &j);
+    void loadPrefixes(CheckpointReader &reader);
+    void loadRoutes(CheckpointReader &reader);
+    void loadPaths(CheckpointReader &reader);
+    void loadASes(CheckpointReader &reader);
+    void loadLinks(CheckpointReader &reader);
+    void loadBlooms(CheckpointReader &reader);
+    void loadPeers(CheckpointReader &reader);
+};
+
+#endif //BGPGEOPOLITICS_BGPCHECKPOINT_H
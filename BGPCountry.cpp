@@ -0,0 +1,95 @@
+//
+//  BGPCountry.cpp
+//  BGPGeopol
+//
+
+#include "BGPCountry.h"
+
+CountryGraph::CountryGraph(){
+    // index 0 collects ASes with unknown country and any overflow
+    countries[0].code="??";
+    indexes.insert(make_pair(string("??"), (short)0));
+    countryNum=1;
+}
+
+short CountryGraph::index(string code){
+    auto it=indexes.find(code);
+    if (it != indexes.end())
+        return it->second;
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    it=indexes.find(code);
+    if (it != indexes.end())
+        return it->second;
+    int idx=countryNum.load();
+    if (idx >= MAXCOUNTRIES)
+        return 0;
+    countries[idx].code=code;
+    indexes.insert(make_pair(code, (short)idx));
+    countryNum++;
+    return idx;
+}
+
+string CountryGraph::code(short idx){
+    return countries[idx].code;
+}
+
+void CountryGraph::addPrefix(short idx, int afi, long prefixActive, long prefixInactive, long addrActive, long addrInactive){
+    CountryStats &country=countries[idx];
+    country.activePrefixNum += prefixActive;
+    country.inactivePrefixNum += prefixInactive;
+    if (afi == 0){
+        country.activeAddrNum += addrActive;
+        country.inactiveAddrNum += addrInactive;
+    } else {
+        country.activeAddr6Num += addrActive;
+        country.inactiveAddr6Num += addrInactive;
+    }
+}
+
+long CountryGraph::activeAddr(short idx, int afi){
+    return (afi == 0) ? countries[idx].activeAddrNum : countries[idx].activeAddr6Num;
+}
+
+void CountryGraph::addPaths(short src, short dst, long paths, long links){
+    concurrent_hash_map<unsigned int, CountryEdge>::accessor accessor;
+    unsigned int key;
+    if (src>dst){
+        short tmp=src;
+        src=dst;
+        dst=tmp;
+    }
+    key=((unsigned int)src<<16)+dst;
+    edges.insert(accessor, key);
+    accessor->second.pathNum += paths;
+    accessor->second.linkNum += links;
+}
+
+Graph *CountryGraph::makeGraph(unsigned int time){
+    Graph *g=new Graph();
+    vector<boost::graph_traits<Graph>::vertex_descriptor> vertices(MAXCOUNTRIES, -1);
+    int num=countryNum.load();
+
+    auto vertex=[&](short idx){
+        if (vertices[idx] == (boost::graph_traits<Graph>::vertex_descriptor)-1){
+            CountryStats &country=countries[idx];
+            long active=country.activePrefixNum, inactive=country.inactivePrefixNum;
+            long activeAddr=country.activeAddrNum, inactiveAddr=country.inactiveAddrNum;
+            long activeAddr6=country.activeAddr6Num, inactiveAddr6=country.inactiveAddr6Num;
+            vertices[idx]=boost::add_vertex(VertexP{country.code, country.code, country.code, time, (int)active,
+                (int)(active+inactive), activeAddr, activeAddr+inactiveAddr, activeAddr6, activeAddr6+inactiveAddr6, 0}, *g);
+        }
+        return vertices[idx];
+    };
+
+    for (short i=0; i<num; i++){
+        if ((countries[i].activePrefixNum>0) || (countries[i].inactivePrefixNum>0))
+            vertex(i);
+    }
+    for (auto &p:edges){
+        if ((p.second.pathNum<=0) && (p.second.linkNum<=0))
+            continue;
+        short src=p.first>>16, dst=p.first & 0xFFFF;
+        boost::add_edge(vertex(src), vertex(dst), EdgeP{(int)p.second.pathNum, 0, 0, (int)p.second.linkNum, time}, *g);
+    }
+    return g;
+}
@@ -0,0 +1,60 @@
+//
+//  BGPCountry.h
+//  BGPGeopol
+//
+//  Country level view of the AS graph: announced address space per country
+//  and a country x country transit graph, maintained incrementally from
+//  AS::update/withdraw and Link::addPath/withdraw.
+//
+
+#ifndef BGPGEOPOLITICS_BGPCOUNTRY_H
+#define BGPGEOPOLITICS_BGPCOUNTRY_H
+
+#include <atomic>
+#include <string>
+#include "tbb/concurrent_hash_map.h"
+#include "tbb/concurrent_unordered_map.h"
+#include "BGPGraph.h"
+
+#define MAXCOUNTRIES 512
+
+using namespace std;
+using namespace tbb;
+
+class CountryStats{
+public:
+    string code;
+    std::atomic<long> activePrefixNum={0};
+    std::atomic<long> inactivePrefixNum={0};
+    // IPv4 space in /24, IPv6 space in /48, never added together
+    std::atomic<long> activeAddrNum={0};
+    std::atomic<long> inactiveAddrNum={0};
+    std::atomic<long> activeAddr6Num={0};
+    std::atomic<long> inactiveAddr6Num={0};
+};
+
+class CountryEdge{
+public:
+    long pathNum=0;
+    long linkNum=0;
+};
+
+class CountryGraph{
+public:
+    CountryGraph();
+    short index(string code);
+    string code(short idx);
+    // afi from afiIndex(), the address counts are in its unit
+    void addPrefix(short idx, int afi, long prefixActive, long prefixInactive, long addrActive, long addrInactive);
+    long activeAddr(short idx, int afi);
+    void addPaths(short src, short dst, long paths, long links);
+    Graph *makeGraph(unsigned int time);
+private:
+    CountryStats countries[MAXCOUNTRIES];
+    std::atomic<int> countryNum={0};
+    concurrent_unordered_map<string, short> indexes;
+    concurrent_hash_map<unsigned int, CountryEdge> edges;
+    boost::mutex mutex_;
+};
+
+#endif //BGPGEOPOLITICS_BGPCOUNTRY_H
@@ -9,8 +9,10 @@
 #ifndef BGPEvent_h
 #define BGPEvent_h
 #include <unordered_map>
+#include <vector>
 #include<string>
-enum BGPEventType {PATHA=0, PATHW=1, NEWPATH=2, NEWAS=3, NEWLINK=4, NEWPREFIX=5, LINKDROP=6, ASDROP=7, TRIM=8, PATHAW=9, ASPREFA=10, ASPREFW=11, CAPTBEGIN=12, CAPTTIME=13, PATHACT=14,PATHNACT=15,ENDE=16,WITHDRAW=17, PATHAD=18, ASUPD=19, LNKUPD=20, PTHUPD=21};
+#include <cstdint>
+enum BGPEventType {PATHA=0, PATHW=1, NEWPATH=2, NEWAS=3, NEWLINK=4, NEWPREFIX=5, LINKDROP=6, ASDROP=7, TRIM=8, PATHAW=9, ASPREFA=10, ASPREFW=11, CAPTBEGIN=12, CAPTTIME=13, PATHACT=14,PATHNACT=15,ENDE=16,WITHDRAW=17, PATHAD=18, ASUPD=19, LNKUPD=20, PTHUPD=21, BATCHUPD=22, HIJACKA=23, HIJACKW=24};
 using namespace std;
 
 class BGPEvent{
@@ -19,11 +21,27 @@ public:
     BGPEventType eventType;
     std::unordered_map<string, string> map;
     unsigned int hash;
+    // set on sampled events when queued, see PipelineTracer
+    uint64_t traceStart=0;
     BGPEvent(unsigned int time, BGPEventType event): timestamp(time), eventType(event){};
-    ~BGPEvent(){
+    virtual ~BGPEvent(){
         map.clear();
     }
 };
 
+// all AS, link and dirty path records of one shard for an interval, written with one HSET per hash
+class BGPBatchEvent: public BGPEvent{
+public:
+    std::vector<std::pair<string, string>> ases;
+    std::vector<std::pair<string, string>> links;
+    std::vector<std::pair<string, string>> paths;
+    // APATHS membership of the written paths
+    std::vector<string> activePaths;
+    std::vector<string> inactivePaths;
+    BGPBatchEvent(unsigned int time, unsigned int shard): BGPEvent(time, BATCHUPD){
+        hash = shard;
+    }
+};
+
 
 #endif /* BGPEvent_h */
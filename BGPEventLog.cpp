@@ -0,0 +1,368 @@
+//
+//  BGPEventLog.cpp
+//  BGPGeopol
+//
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include "BGPEventLog.h"
+#include "BGPGeopolitics.h"
+
+static void putVarint(string &out, uint64_t val){
+    while (val>=0x80){
+        out += (char)((val & 0x7F) | 0x80);
+        val >>= 7;
+    }
+    out += (char)val;
+}
+
+// false if the value runs past end or over 64 bits
+static bool getVarint(const char *data, size_t &pos, size_t end, uint64_t &val){
+    int shift=0;
+    uint8_t b;
+    val = 0;
+    do {
+        if ((pos>=end) || (shift>63))
+            return false;
+        b=data[pos++];
+        val |= (uint64_t)(b & 0x7F)<<shift;
+        shift += 7;
+    } while (b & 0x80);
+    return true;
+}
+
+static uint64_t zigzag(int64_t val){
+    return (val<<1) ^ (val>>63);
+}
+
+static int64_t unzigzag(uint64_t val){
+    return (val>>1) ^ -(int64_t)(val & 1);
+}
+
+EventSegment::EventSegment(string filename){
+    struct stat st;
+    fd = open(filename.c_str(), O_RDONLY);
+    if (fd<0)
+        return;
+    if ((fstat(fd, &st)<0) || (st.st_size<(off_t)sizeof(EventSegmentHeader))){
+        ::close(fd);
+        fd = -1;
+        return;
+    }
+    length = st.st_size;
+    data = (char *)mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED){
+        data = NULL;
+        ::close(fd);
+        fd = -1;
+        return;
+    }
+    header = (EventSegmentHeader *)data;
+    bool valid=(strncmp(header->magic, EVENTLOGMAGIC, sizeof(header->magic)) == 0) && (header->version == EVENTLOGVERSION) &&
+        (header->columns[0] == sizeof(EventSegmentHeader)) && (header->columns[7]<=length);
+    // columns in order, one type byte per event
+    for (int i=0; valid && (i<7); i++)
+        valid = header->columns[i]<=header->columns[i+1];
+    if (valid)
+        valid = header->columns[7]-header->columns[6] == header->count;
+    if (!valid){
+        cout<<"Event log segment "<<filename<<" is not a valid version "<<EVENTLOGVERSION<<" segment"<<endl;
+        munmap(data, length);
+        ::close(fd);
+        data = NULL;
+        header = NULL;
+        fd = -1;
+    }
+}
+
+EventSegment::~EventSegment(){
+    if (data)
+        munmap(data, length);
+    if (fd>=0)
+        ::close(fd);
+}
+
+bool EventSegment::isOpen(){
+    return data != NULL;
+}
+
+EventSegmentHeader *EventSegment::getHeader(){
+    return header;
+}
+
+// the whole segment is decoded before any event is given out, a damaged
+// segment is skipped without a partial replay
+void EventSegment::scan(unsigned int from, unsigned int to, std::function<void(EventRecord &)> process){
+    struct Event{
+        unsigned int time;
+        uint32_t prefixId;
+        uint32_t peerId;
+        unsigned int pathId;
+        uint8_t type;
+    };
+    size_t pos, timePos, prefixPos, peerPos, pathPos, typePos;
+    uint64_t val, prefixId, peerId, pathId;
+    EventRecord record;
+    vector<Event> events;
+    bool valid=true;
+
+    if (!data || (header->maxTime<from) || (header->minTime>to))
+        return;
+    // a dictionary entry takes a byte at least
+    if ((header->prefixNum>header->columns[1]-header->columns[0]) || (header->peerNum>header->columns[2]-header->columns[1])){
+        cout<<"Event log segment "<<header->start<<" has a damaged dictionary, skipped"<<endl;
+        return;
+    }
+    vector<string> prefixes(header->prefixNum);
+    vector<unsigned int> peers(header->peerNum);
+    int64_t time=header->start;
+    pos=header->columns[0];
+    for (auto &prefix:prefixes){
+        valid = valid && getVarint(data, pos, header->columns[1], val) && (val<=header->columns[1]-pos);
+        if (!valid)
+            break;
+        prefix.assign(data+pos, val);
+        pos += val;
+    }
+    pos=header->columns[1];
+    for (auto &peer:peers){
+        valid = valid && getVarint(data, pos, header->columns[2], val) && (val<=UINT32_MAX);
+        peer=val;
+    }
+    timePos=header->columns[2];
+    prefixPos=header->columns[3];
+    peerPos=header->columns[4];
+    pathPos=header->columns[5];
+    typePos=header->columns[6];
+    events.reserve(header->count);
+    for (uint32_t i=0; valid && (i<header->count); i++){
+        valid = getVarint(data, timePos, header->columns[3], val) &&
+            getVarint(data, prefixPos, header->columns[4], prefixId) && (prefixId<header->prefixNum) &&
+            getVarint(data, peerPos, header->columns[5], peerId) && (peerId<header->peerNum) &&
+            getVarint(data, pathPos, header->columns[6], pathId) && (pathId<=UINT32_MAX);
+        time += unzigzag(val);
+        valid = valid && (time>=0) && (time<=UINT32_MAX);
+        if (valid)
+            events.push_back(Event{(unsigned int)time, (uint32_t)prefixId, (uint32_t)peerId, (unsigned int)pathId,
+                                   (uint8_t)data[typePos++]});
+    }
+    if (!valid){
+        cout<<"Event log segment "<<header->start<<" is damaged, skipped"<<endl;
+        return;
+    }
+    for (auto &event:events){
+        if ((event.time<from) || (event.time>to))
+            continue;
+        record.timestamp = event.time;
+        record.type = (BGPEventType)event.type;
+        record.prefix = prefixes[event.prefixId];
+        record.peer = peers[event.peerId];
+        record.pathId = event.pathId;
+        process(record);
+    }
+}
+
+BGPEventLog::BGPEventLog(string dir, int shard, unsigned int segmentDuration): dir(dir+"/"+to_string(shard)), segmentDuration(segmentDuration){
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(this->dir, ec);
+}
+
+BGPEventLog::~BGPEventLog(){
+    flush();
+}
+
+bool BGPEventLog::accepts(BGPEventType type){
+    return (type == PATHA) || (type == WITHDRAW) || (type == ASPREFA) || (type == ASPREFW) || (type == HIJACKA) || (type == HIJACKW);
+}
+
+void BGPEventLog::write(BGPEvent *event){
+    switch (event->eventType){
+        case PATHA:
+            append(event->timestamp, PATHA, event->map["pfxID"], from_myencoding(event->map["peer"]), from_myencoding(event->map["pathHash"]));
+            break;
+        case WITHDRAW:
+            append(event->timestamp, WITHDRAW, event->map["pfxID"], from_myencoding(event->map["peer"]), 0);
+            break;
+        case ASPREFA:
+        case ASPREFW:
+            append(event->timestamp, event->eventType, event->map["pfxID"], from_myencoding(event->map["asNum"]), 0);
+            break;
+        case HIJACKA:
+        case HIJACKW:
+            append(event->timestamp, event->eventType, event->map["pfxID"], from_myencoding(event->map["origin"]), from_myencoding(event->map["victim"]));
+            break;
+        default:
+            break;
+    }
+}
+
+void BGPEventLog::append(unsigned int time, BGPEventType type, const string &prefix, unsigned int peer, unsigned int pathId){
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!times.empty() && ((time >= segmentStart+segmentDuration) || (time >= bufferStart+flushEvery) || (times.size() >= maxBuffered)))
+        flushBuffer();
+    if (!times.empty() && (time >= segmentStart+segmentDuration)){
+        // a failed segment cannot take the events of the next window
+        cout<<"Event log "<<dir<<" drops "<<times.size()<<" events"<<endl;
+        clear();
+    }
+    if (times.empty()){
+        segmentStart = (time/segmentDuration)*segmentDuration;
+        bufferStart = time;
+    }
+    auto p=prefixDict.insert(make_pair(prefix, (uint32_t)prefixes.size()));
+    if (p.second)
+        prefixes.push_back(prefix);
+    auto q=peerDict.insert(make_pair(peer, (uint32_t)peers.size()));
+    if (q.second)
+        peers.push_back(peer);
+    times.push_back(time);
+    prefixIds.push_back(p.first->second);
+    peerIds.push_back(q.first->second);
+    pathIds.push_back(pathId);
+    types.push_back(type);
+}
+
+void BGPEventLog::flush(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    flushBuffer();
+}
+
+void BGPEventLog::buffered(unsigned int from, unsigned int to, std::function<void(EventRecord &)> process){
+    EventRecord record;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i=0; i<times.size(); i++){
+        if ((times[i]<from) || (times[i]>to))
+            continue;
+        record.timestamp = times[i];
+        record.type = (BGPEventType)types[i];
+        record.prefix = prefixes[prefixIds[i]];
+        record.peer = peers[peerIds[i]];
+        record.pathId = pathIds[i];
+        process(record);
+    }
+}
+
+void BGPEventLog::flushBuffer(){
+    if (times.empty())
+        return;
+    if (!writeSegment()){
+        // retried flushEvery later, unless the buffer is full
+        if (times.size() < 4*maxBuffered){
+            bufferStart = times.back();
+            return;
+        }
+        cout<<"Event log "<<dir<<" drops "<<times.size()<<" events"<<endl;
+    }
+    clear();
+}
+
+bool BGPEventLog::writeSegment(){
+    EventSegmentHeader header;
+    string columns[7];
+    int64_t previous;
+    string filename;
+
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, EVENTLOGMAGIC, sizeof(header.magic));
+    header.version = EVENTLOGVERSION;
+    header.start = segmentStart;
+    header.count = times.size();
+    header.prefixNum = prefixes.size();
+    header.peerNum = peers.size();
+    header.minTime = *std::min_element(times.begin(), times.end());
+    header.maxTime = *std::max_element(times.begin(), times.end());
+    for (auto &prefix:prefixes){
+        putVarint(columns[0], prefix.size());
+        columns[0] += prefix;
+    }
+    for (auto peer:peers)
+        putVarint(columns[1], peer);
+    previous = segmentStart;
+    for (size_t i=0; i<times.size(); i++){
+        putVarint(columns[2], zigzag((int64_t)times[i]-previous));
+        previous = times[i];
+        putVarint(columns[3], prefixIds[i]);
+        putVarint(columns[4], peerIds[i]);
+        putVarint(columns[5], pathIds[i]);
+        columns[6] += (char)types[i];
+    }
+    header.columns[0] = sizeof(header);
+    for (int i=0; i<7; i++)
+        header.columns[i+1] = header.columns[i]+columns[i].size();
+
+    // several flushes may happen in one window (CAPTTIME, end of data)
+    do {
+        filename = dir+"/"+to_string(segmentStart)+"-"+to_string(seq++)+".seg";
+    } while (boost::filesystem::exists(filename));
+    boost::system::error_code ec;
+    std::ofstream out(filename+".tmp", std::ios::binary);
+    out.write((const char *)&header, sizeof(header));
+    for (int i=0; i<7; i++)
+        out.write(columns[i].data(), columns[i].size());
+    out.close();
+    if (out.fail()){
+        cout<<"Cannot write event log segment "<<filename<<endl;
+        boost::filesystem::remove(filename+".tmp", ec);
+        return false;
+    }
+    boost::filesystem::rename(filename+".tmp", filename, ec);
+    if (ec){
+        cout<<"Cannot write event log segment "<<filename<<":"<<ec.message()<<endl;
+        boost::filesystem::remove(filename+".tmp", ec);
+        return false;
+    }
+    return true;
+}
+
+void BGPEventLog::clear(){
+    prefixDict.clear();
+    peerDict.clear();
+    prefixes.clear();
+    peers.clear();
+    times.clear();
+    prefixIds.clear();
+    peerIds.clear();
+    pathIds.clear();
+    types.clear();
+}
+
+// sorted on the numbers, 10 comes after 9 within a window
+void BGPEventLog::segments(string shardDir, unsigned int first, unsigned int last, vector<SegmentFile> &files){
+    boost::system::error_code ec;
+    if (!boost::filesystem::is_directory(shardDir, ec))
+        return;
+    for (auto &entry:boost::filesystem::directory_iterator(shardDir)){
+        SegmentFile file;
+        char end;
+        if (entry.path().extension() != ".seg")
+            continue;
+        string name=entry.path().stem().string();
+        if (sscanf(name.c_str(), "%u-%u%c", &file.start, &file.seq, &end) != 2)
+            continue;
+        if ((file.start<first) || (file.start>last))
+            continue;
+        file.path = entry.path().string();
+        files.push_back(file);
+    }
+    std::sort(files.begin(), files.end(), [](const SegmentFile &a, const SegmentFile &b){
+        return (a.start<b.start) || ((a.start == b.start) && (a.seq<b.seq));
+    });
+}
+
+void BGPEventLog::query(string dir, int shard, unsigned int from, unsigned int to, std::function<void(EventRecord &)> process){
+    vector<SegmentFile> files;
+    segments(dir+"/"+to_string(shard), 0, to, files);
+    for (auto &f:files){
+        EventSegment segment(f.path);
+        if (segment.isOpen())
+            segment.scan(from, to, process);
+    }
+}
@@ -0,0 +1,133 @@
+//
+//  BGPEventLog.h
+//  BGPGeopol
+//
+//  Append-only columnar log of the routing history events (PATHA, WITHDRAW,
+//  ASPREFA, ASPREFW) replacing the unbounded PRE:/ASR: Redis lists, and of
+//  the origin conflicts (HIJACKA, HIJACKW).
+//
+//  Each Redis shard thread owns one log. Events are buffered per time window
+//  and written as a segment file <dir>/<shard>/<windowStart>-<seq>.seg with
+//  one column per field: zigzag varint timestamp deltas, prefix and peer ids
+//  into per-segment dictionaries, varint path ids and one byte event types.
+//  Segments are memory-mapped for queries. The buffer is also written out
+//  every flushEvery seconds of event time or maxBuffered events, so a crash
+//  loses at most that much of the history.
+//
+
+#ifndef BGPGEOPOLITICS_BGPEVENTLOG_H
+#define BGPGEOPOLITICS_BGPEVENTLOG_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <stdint.h>
+#include "BGPEvent.h"
+
+using namespace std;
+
+#define EVENTLOGVERSION 1
+#define EVENTLOGMAGIC "BGPELOG"
+
+class BGPEventSink{
+public:
+    virtual ~BGPEventSink(){}
+    // true if the sink keeps the history of this event type
+    virtual bool accepts(BGPEventType type)=0;
+    // does not take ownership of event
+    virtual void write(BGPEvent *event)=0;
+    virtual void flush()=0;
+};
+
+class EventRecord{
+public:
+    unsigned int timestamp;
+    BGPEventType type;
+    // pfxID encoding as in the events
+    string prefix;
+    // peer ASN for PATHA/WITHDRAW, origin ASN for ASPREFA/ASPREFW/HIJACKA/HIJACKW
+    unsigned int peer;
+    // path hash, victim ASN for HIJACKA/HIJACKW, 0 otherwise
+    unsigned int pathId;
+};
+
+struct EventSegmentHeader{
+    char magic[8];
+    uint32_t version;
+    uint32_t start;
+    uint32_t count;
+    uint32_t prefixNum;
+    uint32_t peerNum;
+    uint32_t minTime;
+    uint32_t maxTime;
+    // prefix dictionary, peer dictionary, time, prefix, peer, path, type, end
+    uint64_t columns[8];
+};
+
+class EventSegment{
+public:
+    EventSegment(string filename);
+    ~EventSegment();
+    bool isOpen();
+    EventSegmentHeader *getHeader();
+    // decodes all records, calling process for those within [from, to]
+    void scan(unsigned int from, unsigned int to, std::function<void(EventRecord &)> process);
+private:
+    int fd=-1;
+    char *data=NULL;
+    size_t length=0;
+    EventSegmentHeader *header=NULL;
+};
+
+// a segment file <start>-<seq>.seg of a shard
+struct SegmentFile{
+    unsigned int start;
+    unsigned int seq;
+    string path;
+};
+
+class BGPEventLog: public BGPEventSink{
+public:
+    // seconds of event time kept in memory before a segment is written
+    unsigned int flushEvery=60;
+    // events kept in memory before a segment is written
+    size_t maxBuffered=1<<16;
+
+    BGPEventLog(string dir, int shard, unsigned int segmentDuration);
+    ~BGPEventLog();
+    bool accepts(BGPEventType type);
+    void write(BGPEvent *event);
+    void flush();
+    // events not written to a segment yet within [from, to], for queries of the live history
+    void buffered(unsigned int from, unsigned int to, std::function<void(EventRecord &)> process);
+    // segments of a shard directory with a window start in [first, last], in write order
+    static void segments(string shardDir, unsigned int first, unsigned int last, vector<SegmentFile> &files);
+    // reads the segments of one shard overlapping [from, to]
+    static void query(string dir, int shard, unsigned int from, unsigned int to, std::function<void(EventRecord &)> process);
+private:
+    string dir;
+    unsigned int segmentDuration;
+    unsigned int segmentStart=0;
+    unsigned int bufferStart=0;
+    int seq=0;
+    // the shard thread appends, queries read the buffer
+    std::mutex mutex_;
+    std::unordered_map<string, uint32_t> prefixDict;
+    std::unordered_map<unsigned int, uint32_t> peerDict;
+    vector<string> prefixes;
+    vector<unsigned int> peers;
+    vector<unsigned int> times;
+    vector<uint32_t> prefixIds;
+    vector<uint32_t> peerIds;
+    vector<unsigned int> pathIds;
+    vector<uint8_t> types;
+    void append(unsigned int time, BGPEventType type, const string &prefix, unsigned int peer, unsigned int pathId);
+    void flushBuffer();
+    // false if the segment could not be written, the buffer is kept
+    bool writeSegment();
+    void clear();
+};
+
+#endif //BGPGEOPOLITICS_BGPEVENTLOG_H
@@ -1,6 +1,8 @@
 //
 // Created by Kave Salamatian on 2018-12-01.
 //
+#include <string.h>
+#include <climits>
 #include "BGPGeopolitics.h"
 #include "cache.h"
 #include "BGPEvent.h"
@@ -28,7 +30,7 @@ bool BGPMessage::fill(long order, bgpstream_elem_t *elem, unsigned int time, std
     type = elem->type;
     
     
-//    memcpy(&peerAddress, &elem->peer_ip , sizeof(bgpstream_addr_storage_t));
+    memcpy(&peerAddress, &elem->peer_ip , sizeof(bgpstream_ip_addr_t));
     memcpy(&nextHop, &elem->nexthop, sizeof(bgpstream_ip_addr_t));
     memcpy(&pfx, &elem->prefix,sizeof(bgpstream_pfx_t));
     timestamp = time;
@@ -56,12 +58,7 @@ bool BGPMessage::fill(long order, bgpstream_elem_t *elem, unsigned int time, std
             if (shortPath.size()==0) {
                 return false;
             } else {
-                peer = new Peer(elem->peer_asn);
-                auto res=cache->peersMap.insert(make_pair(asPath[0],peer));
-                if (!res.first){
-                    delete peer;
-                    peer=res.second;
-                }
+                peer = cache->peers.get(collectorId(), elem->peer_ip, elem->peer_asn);
                 pathStr.clear();
                 pathStr=pathString();
                 pfxStr.clear();
@@ -72,17 +69,18 @@ bool BGPMessage::fill(long order, bgpstream_elem_t *elem, unsigned int time, std
             return false;
         }
     } else if (type == BGPSTREAM_ELEM_TYPE_WITHDRAWAL){
-        peer = new Peer(elem->peer_asn);
-        auto res=cache->peersMap.insert(make_pair(elem->peer_asn,peer));
-        if (!res.first){
-            delete peer;
-            peer =res.second;
-        }
+        peer = cache->peers.get(collectorId(), elem->peer_ip, elem->peer_asn);
         return true;
     }
     return false;
 }
 
+// USHRT_MAX for a collector outside the configured list
+unsigned short int BGPMessage::collectorId(){
+    auto it=cache->collectors.find(collector);
+    return (it != cache->collectors.end()) ? it->second : USHRT_MAX;
+}
+
 bool BGPMessage::setPath(unsigned int time){
     auto p=cache->pathsMap.find(pathStr);
     if (p.first){
@@ -105,8 +103,6 @@ bool BGPMessage::setPath(unsigned int time){
             dest = cache->asCache[shortPath.back()];
             pathHash =path->hash;
             return true;
-        } else {
-            cache->pathsMap.strCacheMissed();
         }
     }
     dest = cache->asCache[shortPath.back()];
@@ -149,11 +145,21 @@ pair<bool,unsigned int> BGPMessage::checkRedis(SPrefixPath path, unsigned int ti
     encodedPath=to_myencodingPath(shortPath.data(),shortPath.size());
     if (cache->pathsBF.contains(path->str())){
         unsigned int hash1=path->getPeer();
+        auto start=std::chrono::steady_clock::now();
         Redis *_redis1=cache->bgpRedis->getRedis(hash1);
         auto hashStr=_redis1->hget("PATH2ID",encodedPath);
+        SPrefixPath evicted=hashStr ? cache->evictedPath(from_myencoding(*hashStr)) : NULL;
+        if (evicted){
+            // its last state is not on Redis yet
+            cache->pathsMap.strFetched(std::chrono::steady_clock::now()-start);
+            prefixPath = cache->pathsMap.insert(evicted->hash, evicted, timestamp).second;
+            pathHash = prefixPath->hash;
+            return make_pair(true, pathHash);
+        }
         if (hashStr){
             Redis *_redis2=cache->bgpRedis->getRedis(hash1);
             auto str=_redis2->hget("PATHS",*hashStr);
+            cache->pathsMap.strFetched(std::chrono::steady_clock::now()-start);
             if (str) {
                 path->fromRedis(*str);
                 auto ret=cache->pathsMap.insert(path->hash,path,timestamp);
@@ -167,7 +173,8 @@ pair<bool,unsigned int> BGPMessage::checkRedis(SPrefixPath path, unsigned int ti
                     return make_pair(true, pathHash);
                 }
             }
-        }
+        } else
+            cache->pathsMap.strFetched(std::chrono::steady_clock::now()-start);
     }
     //the path is not in Redis
     auto ret=cache->pathsMap.insert(path,timestamp);
@@ -284,3 +291,30 @@ void from_myencodingPref(string str, bgpstream_pfx_t *inpfx ){
     pfxstr+="/"+to_string(len);
     bgpstream_str2pfx(pfxstr.c_str(),inpfx);
  }
+
+long pfxSpace(bgpstream_pfx_t *pfx){
+    if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4){
+        if (pfx->mask_len>24)
+            return 0;
+        return 1L<<(24-pfx->mask_len);
+    } else if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV6){
+        if (pfx->mask_len>48)
+            return 0;
+        if (pfx->mask_len<8)
+            return 1L<<40;
+        return 1L<<(48-pfx->mask_len);
+    }
+    return 0;
+}
+
+bool pfxContains(const bgpstream_pfx_t *outer, const bgpstream_pfx_t *inner){
+    if ((outer->address.version != inner->address.version) || (inner->mask_len<outer->mask_len))
+        return false;
+    int bytes=outer->mask_len/8, bits=outer->mask_len%8;
+    if (memcmp(outer->address.addr, inner->address.addr, bytes) != 0)
+        return false;
+    if (bits == 0)
+        return true;
+    uint8_t mask=(uint8_t)(0xFF<<(8-bits));
+    return (outer->address.addr[bytes] & mask) == (inner->address.addr[bytes] & mask);
+}
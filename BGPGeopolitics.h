@@ -11,6 +11,7 @@ extern "C" {
 
 //#include "cache.h"
 #include <string>
+#include <atomic>
 #include "cache_structures.h"
 
 
@@ -55,6 +56,11 @@ public:
     bool newPath = false;
     Category category = UNDFND;
     string pathStr;
+    // stage stamps of a sampled message, see PipelineTracer
+    bool traced = false;
+    uint64_t traceFill = 0, traceEnqueue = 0, traceDequeue = 0;
+    // read by the saver after the message went back to the pool, cleared when it is reused
+    std::atomic<uint64_t> traceDone = {0};
 
     BGPMessage(int order);
     bool fill(long order, bgpstream_elem_t *elem, unsigned int time, string collector);
@@ -64,6 +70,7 @@ public:
     string pfxString();
     unsigned int getIP();
     bool setPath(unsigned int time);
+    unsigned short int collectorId();
     pair<bool,unsigned int> checkRedis(SPrefixPath path, unsigned int timestamp);
 };
 
@@ -88,5 +95,9 @@ string to_myencodingPref(bgpstream_pfx_t *inpfx);
 unsigned int from_myencoding(string str);
 void from_myencodingPath(string str, vector<unsigned int> &vect);
 void from_myencodingPref(string str, bgpstream_pfx_t *inpfx );
+// address space of a prefix in /24 (IPv4) or /48 (IPv6) equivalents
+long pfxSpace(bgpstream_pfx_t *pfx);
+// true if outer is equal to or less specific than inner
+bool pfxContains(const bgpstream_pfx_t *outer, const bgpstream_pfx_t *inner);
 #endif //BGPGEOPOLITICS_BGPGEOPOLITICS_H
 
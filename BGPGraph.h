@@ -54,8 +54,10 @@ struct VertexP {
     unsigned int time;
     int prefixNum;
     int prefixAll;
-    int addNum;//number of Addresses
-    int addAll; // number of overall Adresses
+    long addNum;//number of IPv4 Addresses (/24 equivalents)
+    long addAll; // number of overall IPv4 Adresses
+    long addNum6;//number of IPv6 Addresses (/48 equivalents)
+    long addAll6;
     int pathNum;
 }; //bundled property map for nodes
 
@@ -135,6 +137,8 @@ public:
         g[v].prefixAll = vertexP.prefixAll;
         g[v].addNum = vertexP.addNum;
         g[v].addAll = vertexP.addAll;
+        g[v].addNum6 = vertexP.addNum6;
+        g[v].addAll6 = vertexP.addAll6;
         g[v].pathNum = vertexP.pathNum;
         g[v].time = vertexP.time;
     }
@@ -149,6 +153,8 @@ public:
         vertexP.prefixAll = g[v].prefixAll;
         vertexP.addNum = g[v].addNum;
         vertexP.addAll = g[v].addAll;
+        vertexP.addNum6 = g[v].addNum6;
+        vertexP.addAll6 = g[v].addAll6;
         vertexP.pathNum = g[v].pathNum;
 
     }
@@ -221,6 +227,8 @@ public:
         dp.property("prefixAll", get(&VertexP::prefixAll, *g));
         dp.property("addNum", get(&VertexP::addNum, *g));
         dp.property("addAll", get(&VertexP::addAll, *g));
+        dp.property("addNum6", get(&VertexP::addNum6, *g));
+        dp.property("addAll6", get(&VertexP::addAll6, *g));
         dp.property("pathNum", get(&VertexP::pathNum, *g));
         dp.property("pathCount", get(&EdgeP::pathCount, *g));
         dp.property("prefCount", get(&EdgeP::prefCount, *g));
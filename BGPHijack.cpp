@@ -0,0 +1,146 @@
+//
+//  BGPHijack.cpp
+//  BGPGeopol
+//
+
+#include <algorithm>
+#include "BGPHijack.h"
+#include "BGPTables.h"
+#include "BGPRedis.hpp"
+
+extern BGPCache *cache;
+extern RIBTable *bgpTable;
+
+// the victim upstream of the origin is a provider delegating its space
+static bool onPath(SPrefixPath path, unsigned int asn){
+    for (int i=0; i<path->shortPathLength-1; i++){
+        if (path->shortPath[i] == asn)
+            return true;
+    }
+    return false;
+}
+
+bool HijackDetector::check(RIBElement *element, SPrefixPath path, unsigned int time){
+    unsigned int origin=path->getDest();
+    vector<unsigned int> origins;
+    vector<void *> parents;
+    OriginConflict conflict;
+    bool found=false;
+
+    conflict.element = element;
+    conflict.pfxID = element->getPfxID();
+    conflict.origin = origin;
+    conflict.victim = 0;
+    // the origin set of the element, kept by the workers whether the paths are in memory or not
+    element->getOrigins(origins);
+    for (auto o:origins){
+        if ((o != origin) && !onPath(path, o)){
+            conflict.type = MOAS;
+            conflict.victim = o;
+            raise(conflict, time);
+            found = true;
+            break;
+        }
+    }
+    // closest routed less specific prefix
+    bgpTable->ribTrie->covering(element->getPfx(), parents);
+    for (auto it=parents.rbegin(); it!=parents.rend(); it++){
+        RIBElement *parent=(RIBElement *)*it;
+        if ((parent == element) || (parent == NULL) || (parent->getVisiblePeerNum()<=0))
+            continue;
+        origins.clear();
+        parent->getOrigins(origins);
+        if (origins.empty() || (std::find(origins.begin(), origins.end(), origin) != origins.end()))
+            break;
+        if (!onPath(path, origins[0])){
+            conflict.type = SUBMOAS;
+            conflict.victim = origins[0];
+            conflict.parentID = parent->getPfxID();
+            raise(conflict, time);
+            found = true;
+        }
+        break;
+    }
+    return found;
+}
+
+void HijackDetector::raise(OriginConflict &conflict, unsigned int time){
+    concurrent_hash_map<string, bool>::accessor accessor;
+    string key=conflict.pfxID+":"+to_myencoding(conflict.origin)+":"+to_string(conflict.type);
+    if (open.insert(accessor, key)){
+        accessor->second = true;
+        conflict.start = time;
+        opened.push(conflict);
+        emit(conflict, HIJACKA, time);
+    }
+}
+
+void HijackDetector::emit(OriginConflict &conflict, BGPEventType type, unsigned int time){
+    BGPEvent *event=new BGPEvent(time, type);
+    event->map["pfxID"] = conflict.pfxID;
+    event->map["origin"] = to_myencoding(conflict.origin);
+    event->map["victim"] = to_myencoding(conflict.victim);
+    event->map["TYP"] = (conflict.type == MOAS) ? "MOAS" : "SUBMOAS";
+    event->map["parentID"] = conflict.parentID;
+    event->hash = std::hash<std::string>{}(conflict.pfxID+":"+event->map["origin"]);
+    cache->bgpRedis->add(event);
+}
+
+bool HijackDetector::stillOriginated(OriginConflict &conflict){
+    vector<unsigned int> origins;
+    conflict.element->getOrigins(origins);
+    if (std::find(origins.begin(), origins.end(), conflict.origin) == origins.end())
+        return false;
+    if (conflict.type == MOAS)
+        return std::find(origins.begin(), origins.end(), conflict.victim) != origins.end();
+    return true;
+}
+
+void HijackDetector::update(unsigned int time){
+    OriginConflict conflict;
+    vector<unsigned int> closed;
+    vector<RIBElement *> ended;
+    int newNum=0;
+
+    while (opened.try_pop(conflict)){
+        string key=conflict.pfxID+":"+to_myencoding(conflict.origin)+":"+to_string(conflict.type);
+        active[key] = conflict;
+        newNum++;
+    }
+    for (auto it=active.begin(); it!=active.end();){
+        if (stillOriginated(it->second)){
+            it++;
+            continue;
+        }
+        emit(it->second, HIJACKW, time);
+        open.erase(it->first);
+        closed.push_back(it->second.origin);
+        closed.push_back(it->second.victim);
+        ended.push_back(it->second.element);
+        it = active.erase(it);
+    }
+    // only the prefixes of the open conflicts check every origin
+    for (auto element:ended)
+        element->setHijack(false);
+    for (auto &a:active)
+        a.second.element->setHijack(true);
+    // status bits follow the open conflicts
+    for (auto asn:closed){
+        auto p=cache->asCache.find(asn);
+        if (p.first)
+            p.second->setStatus(HIJACKED | HIJACKING, false);
+    }
+    for (auto &a:active){
+        auto p=cache->asCache.find(a.second.origin);
+        if (p.first)
+            p.second->setStatus(HIJACKING, true);
+        p=cache->asCache.find(a.second.victim);
+        if (p.first)
+            p.second->setStatus(HIJACKED, true);
+    }
+    cout<<"Hijack: "<<active.size()<<" open conflicts, "<<newNum<<" new, "<<closed.size()/2<<" closed"<<endl;
+}
+
+long HijackDetector::activeNum(){
+    return active.size();
+}
@@ -0,0 +1,69 @@
+//
+//  BGPHijack.h
+//  BGPGeopol
+//
+//  Origin conflict detection fed by RIBElement::addPath: a prefix announced
+//  by several origin ASes (MOAS) or a more specific prefix announced by an
+//  origin absent from its closest routed less specific prefix (SUBMOAS).
+//
+//  Only new origins of a prefix, and prefixes already flagged, are checked,
+//  so the workers pay one flag test per announcement otherwise. An origin
+//  stops being known once no active route originates it, and comes back
+//  new. Conflicts are opened with a HIJACKA event and closed with HIJACKW
+//  once the suspect origin no longer originates an active route, checked
+//  each interval; the flag of a prefix is cleared with its last conflict.
+//
+
+#ifndef BGPGEOPOLITICS_BGPHIJACK_H
+#define BGPGEOPOLITICS_BGPHIJACK_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "tbb/concurrent_hash_map.h"
+#include "tbb/concurrent_queue.h"
+#include "cache.h"
+#include "BGPEvent.h"
+
+using namespace std;
+using namespace tbb;
+
+class RIBElement;
+
+enum ConflictType {MOAS=0, SUBMOAS=1};
+
+class OriginConflict{
+public:
+    ConflictType type;
+    RIBElement *element;
+    string pfxID;
+    // origin announcing the conflicting route
+    unsigned int origin;
+    // origin of the prefix (MOAS) or of the less specific prefix (SUBMOAS)
+    unsigned int victim;
+    string parentID;
+    unsigned int start;
+};
+
+class HijackDetector{
+public:
+    HijackDetector(){}
+    // hot path, called when origin announces element's prefix; true if in conflict
+    bool check(RIBElement *element, SPrefixPath path, unsigned int time);
+    // called once per interval by the saver, closes the ended conflicts
+    void update(unsigned int time);
+    long activeNum();
+
+private:
+    // pfxID:origin of the open conflicts
+    concurrent_hash_map<string, bool> open;
+    concurrent_queue<OriginConflict> opened;
+    // saver side copy of the open conflicts
+    std::unordered_map<string, OriginConflict> active;
+
+    void raise(OriginConflict &conflict, unsigned int time);
+    bool stillOriginated(OriginConflict &conflict);
+    void emit(OriginConflict &conflict, BGPEventType type, unsigned int time);
+};
+
+#endif //BGPGEOPOLITICS_BGPHIJACK_H
@@ -0,0 +1,235 @@
+//
+//  BGPHistory.cpp
+//  BGPGeopol
+//
+
+#include <chrono>
+#include <atomic>
+#include <unistd.h>
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+#include "tbb/parallel_for.h"
+#include "BGPHistory.h"
+#include "BGPCheckpoint.h"
+#include "BGPRedis.hpp"
+
+using namespace std::chrono;
+
+// keys read per pipelined batch of LRANGE in Redis mode
+#define HISTORYBATCH 1000
+
+bool RIBQuery::match(const string &prefix, unsigned int p){
+    if ((peer != 0) && (peer != p))
+        return false;
+    if (hasRange){
+        bgpstream_pfx_t pfx;
+        from_myencodingPref(prefix, &pfx);
+        return pfxContains(&range, &pfx);
+    }
+    return true;
+}
+
+RIBHistory::RIBHistory(string logDir, int numShards): logDir(logDir), snapDir(logDir+"-snapshots"), numShards(numShards){}
+
+RIBHistory::RIBHistory(ShardedBGPRedis *bgpRedis): bgpRedis(bgpRedis){
+    numShards = bgpRedis->getNumShards();
+}
+
+void RIBHistory::follow(ShardedBGPRedis *live){
+    liveLogs.assign(numShards, NULL);
+    for (int shard=0; shard<numShards; shard++)
+        liveLogs[shard] = live->eventLog(shard);
+}
+
+unsigned int RIBHistory::pathAt(string prefix, unsigned int peer, unsigned int time){
+    string key=prefix+":"+to_myencoding(peer);
+    unsigned int shard=std::hash<std::string>{}(key) % numShards;
+    if (bgpRedis){
+        vector<string> entries, results;
+        // newest first, entries are pathHash:A:time or :W:time
+        bgpRedis->getRedis(shard)->lrange("PRE:"+key, 0, -1, std::back_inserter(entries));
+        for (auto &entry:entries){
+            results.clear();
+            boost::split(results, entry, [](char c){return c == ':';});
+            if ((results.size()<3) || (from_myencoding(results[2])>time))
+                continue;
+            return (results[1] == "A") ? from_myencoding(results[0]) : 0;
+        }
+        return 0;
+    }
+    ShardState state;
+    logShardAt(shard, time, state);
+    auto it=state.find(key);
+    return (it == state.end()) ? 0 : it->second.pathHash;
+}
+
+void RIBHistory::ribAt(unsigned int time, RIBQuery &query, vector<RouteState> &routes){
+    vector<vector<RouteState>> shardRoutes(numShards);
+    tbb::parallel_for(tbb::blocked_range<int>(0, numShards, 1), [&](tbb::blocked_range<int> range){
+        for (int shard=range.begin(); shard<range.end(); shard++){
+            if (bgpRedis){
+                redisShardAt(shard, time, query, shardRoutes[shard]);
+            } else {
+                ShardState state;
+                logShardAt(shard, time, state);
+                for (auto &p:state){
+                    if ((p.second.pathHash != 0) && query.match(p.second.prefix, p.second.peer))
+                        shardRoutes[shard].push_back(p.second);
+                }
+            }
+        }
+    });
+    for (auto &v:shardRoutes)
+        routes.insert(routes.end(), v.begin(), v.end());
+}
+
+// latest snapshot at or before time, returns its time or 0
+unsigned int RIBHistory::loadSnapshot(int shard, unsigned int time, ShardState &state){
+    string dir=snapDir+"/"+to_string(shard);
+    unsigned int best=0;
+    boost::system::error_code ec;
+    if (!boost::filesystem::is_directory(dir, ec))
+        return 0;
+    for (auto &entry:boost::filesystem::directory_iterator(dir)){
+        if (entry.path().extension() != ".snap")
+            continue;
+        unsigned int t=stoul(entry.path().stem().string());
+        if ((t<=time) && (t>best))
+            best = t;
+    }
+    if (best == 0)
+        return 0;
+    CheckpointReader reader(dir+"/"+to_string(best)+".snap");
+    if (!reader.isOpen())
+        return 0;
+    boost::mutex mutex_;
+    reader.read([&](vector<string> &fields){
+        RouteState route;
+        size_t sep=fields[0].find(':');
+        route.prefix = fields[0].substr(0, sep);
+        route.peer = from_myencoding(fields[0].substr(sep+1));
+        route.pathHash = from_myencoding(fields[1]);
+        route.time = from_myencoding(fields[2]);
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        state[fields[0]] = route;
+    });
+    return best;
+}
+
+// queries run concurrently, each writes its own temporary file
+static std::atomic<unsigned int> snapshotSeq={0};
+
+void RIBHistory::saveSnapshot(int shard, unsigned int time, ShardState &state){
+    string dir=snapDir+"/"+to_string(shard);
+    string filename=dir+"/"+to_string(time)+".snap";
+    string tmp=filename+"."+to_string(getpid())+"-"+to_string(snapshotSeq++)+".tmp";
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(dir, ec);
+    CheckpointWriter writer(tmp, 3);
+    if (!writer.isOpen())
+        return;
+    for (auto &p:state)
+        writer.add(p.first, to_myencoding(p.second.pathHash), to_myencoding(p.second.time));
+    if (writer.close())
+        boost::filesystem::rename(tmp, filename, ec);
+    if (boost::filesystem::exists(tmp))
+        boost::filesystem::remove(tmp, ec);
+}
+
+// Snapshot at W holds every segment whose window starts before W. Segments
+// are replayed in window order; snapshots missing on the way are written so
+// later queries replay less. The unflushed events are copied before the
+// segments are listed: an event flushed meanwhile is replayed twice, which
+// leaves the state unchanged, instead of being missed.
+void RIBHistory::logShardAt(int shard, unsigned int time, ShardState &state){
+    string dir=logDir+"/"+to_string(shard);
+    vector<SegmentFile> segments;
+    vector<EventRecord> pending;
+    unsigned int snapshot=loadSnapshot(shard, time, state);
+    unsigned int window=0;
+    int windows=0;
+    auto replay=[&](EventRecord &record){
+        if ((record.type != PATHA) && (record.type != WITHDRAW))
+            return;
+        string key=record.prefix+":"+to_myencoding(record.peer);
+        RouteState &route=state[key];
+        if (record.timestamp<route.time)
+            return;
+        route.prefix = record.prefix;
+        route.peer = record.peer;
+        route.pathHash = (record.type == PATHA) ? record.pathId : 0;
+        route.time = record.timestamp;
+    };
+
+    if (((size_t)shard<liveLogs.size()) && liveLogs[shard])
+        liveLogs[shard]->buffered(0, time, [&](EventRecord &record){pending.push_back(record);});
+    BGPEventLog::segments(dir, snapshot, time, segments);
+    for (auto &s:segments){
+        if (s.start != window){
+            window = s.start;
+            // earlier windows end before window<=time, so the state is complete here
+            if ((++windows % snapshotEvery == 0) && (window>snapshot))
+                saveSnapshot(shard, window, state);
+        }
+        EventSegment segment(s.path);
+        if (!segment.isOpen())
+            continue;
+        segment.scan(0, time, replay);
+    }
+    for (auto &record:pending)
+        replay(record);
+}
+
+void RIBHistory::redisShardAt(int shard, unsigned int time, RIBQuery &query, vector<RouteState> &routes){
+    Redis *_redis=bgpRedis->getRedis(shard);
+    vector<string> keys;
+    for (string key: {"ROUTINGENTRIES", "INACTIVEROUTINGENTRIES"}){
+        long long cursor=0;
+        do {
+            cursor = _redis->sscan(key, cursor, HISTORYBATCH, std::back_inserter(keys));
+        } while (cursor != 0);
+    }
+    for (size_t i=0; i<keys.size(); i+=HISTORYBATCH){
+        size_t last=std::min(keys.size(), i+HISTORYBATCH);
+        vector<RouteState> batch;
+        Pipeline pipe=_redis->pipeline();
+        for (size_t j=i; j<last; j++){
+            size_t sep=keys[j].find(':');
+            RouteState route;
+            route.prefix = keys[j].substr(0, sep);
+            route.peer = from_myencoding(keys[j].substr(sep+1));
+            if (!query.match(route.prefix, route.peer))
+                continue;
+            batch.push_back(route);
+            pipe.lrange("PRE:"+keys[j], 0, -1);
+        }
+        auto replies=pipe.exec();
+        for (size_t j=0; j<batch.size(); j++){
+            vector<string> entries, results;
+            replies.get(j, std::back_inserter(entries));
+            for (auto &entry:entries){
+                results.clear();
+                boost::split(results, entry, [](char c){return c == ':';});
+                if ((results.size()<3) || (from_myencoding(results[2])>time))
+                    continue;
+                if (results[1] == "A"){
+                    batch[j].pathHash = from_myencoding(results[0]);
+                    batch[j].time = from_myencoding(results[2]);
+                    routes.push_back(batch[j]);
+                }
+                break;
+            }
+        }
+    }
+}
+
+void RIBHistory::benchmark(unsigned int time){
+    RIBQuery query;
+    vector<RouteState> routes;
+    high_resolution_clock::time_point start=high_resolution_clock::now();
+    ribAt(time, query, routes);
+    duration<double> elapsed=high_resolution_clock::now()-start;
+    cout<<"RIB at "<<time<<" ("<<(bgpRedis ? "redis" : "event log")<<"): "<<routes.size()<<" routes in "<<elapsed.count()<<"s, "
+        <<(long)(routes.size()/max(elapsed.count(), 0.001))<<" routes/s"<<endl;
+}
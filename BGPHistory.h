@@ -0,0 +1,80 @@
+//
+//  BGPHistory.h
+//  BGPGeopol
+//
+//  Point-in-time RIB reconstruction over the stored routing history, either
+//  the local event log segments or the Redis PRE:<pfx>:<peer> lists.
+//
+//  With the event log, per-shard snapshots of the routing state are kept
+//  every snapshotEvery windows in a directory of their own
+//  (<logDir>-snapshots/<shard>/<time>.snap); a query loads the closest
+//  snapshot before T and replays the segments up to T, then the events the
+//  live log of the shard has not written yet, when following one. Shards
+//  are reconstructed in parallel.
+//
+
+#ifndef BGPGEOPOLITICS_BGPHISTORY_H
+#define BGPGEOPOLITICS_BGPHISTORY_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "BGPGeopolitics.h"
+#include "BGPEventLog.h"
+
+using namespace std;
+
+class ShardedBGPRedis;
+
+class RouteState{
+public:
+    string prefix;      // pfxID encoding
+    unsigned int peer=0;
+    unsigned int pathHash=0;    // 0 when withdrawn
+    unsigned int time=0;        // time of the last change
+};
+
+class RIBQuery{
+public:
+    // restrict to the prefixes covered by range, when set
+    bool hasRange=false;
+    bgpstream_pfx_t range;
+    // restrict to one peer, 0 for all
+    unsigned int peer=0;
+    bool match(const string &prefix, unsigned int peer);
+};
+
+class RIBHistory{
+public:
+    // windows between two snapshots of the event log state
+    int snapshotEvery=24;
+
+    // event log history
+    RIBHistory(string logDir, int numShards);
+    // Redis history
+    RIBHistory(ShardedBGPRedis *bgpRedis);
+    // event log history also reads the unflushed events of the running logs
+    void follow(ShardedBGPRedis *live);
+
+    // path hash routed by peer for prefix at time, 0 if none or withdrawn
+    unsigned int pathAt(string prefix, unsigned int peer, unsigned int time);
+    // active routes at time matching query
+    void ribAt(unsigned int time, RIBQuery &query, vector<RouteState> &routes);
+    // full table reconstruction latency
+    void benchmark(unsigned int time);
+
+private:
+    string logDir;
+    string snapDir;
+    int numShards;
+    ShardedBGPRedis *bgpRedis=NULL;
+    vector<BGPEventLog *> liveLogs;
+
+    typedef std::unordered_map<string, RouteState> ShardState;
+    void logShardAt(int shard, unsigned int time, ShardState &state);
+    void redisShardAt(int shard, unsigned int time, RIBQuery &query, vector<RouteState> &routes);
+    unsigned int loadSnapshot(int shard, unsigned int time, ShardState &state);
+    void saveSnapshot(int shard, unsigned int time, ShardState &state);
+};
+
+#endif //BGPGEOPOLITICS_BGPHISTORY_H
@@ -0,0 +1,225 @@
+//
+//  BGPLookup.cpp
+//  BGPGeopol
+//
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+#include "tbb/parallel_for.h"
+#include "BGPLookup.h"
+#include "BGPTables.h"
+#ifdef __linux
+    #include <sys/prctl.h>
+#endif
+
+extern BGPCache *cache;
+
+string PrefixInfo::str(){
+    char buffer[64];
+    bgpstream_pfx_snprintf(buffer, 64, &pfx);
+    return string(buffer);
+}
+
+// withdrawn prefixes stay in the trie, they are skipped here
+bool RIBLookup::fill(RIBElement *element, PrefixInfo &info, int maxPaths){
+    if ((element == NULL) || (element->getVisiblePeerNum()<=0))
+        return false;
+    bgpstream_pfx_copy(&info.pfx, element->getPfx());
+    info.origins.clear();
+    info.paths.clear();
+    element->getOrigins(info.origins);
+    info.visiblePeers = element->getVisiblePeerNum();
+    if (maxPaths>0){
+        vector<pair<unsigned int, unsigned int>> routes;
+        element->getRoutes(routes);
+        for (auto &route:routes){
+            // only paths held in memory, a lookup never goes to Redis
+            auto p=cache->pathsMap.find(route.second);
+            if (p.first && p.second)
+                info.paths.push_back(p.second);
+        }
+        std::sort(info.paths.begin(), info.paths.end(), [](const SPrefixPath &a, const SPrefixPath &b){
+            if (a->shortPathLength != b->shortPathLength)
+                return a->shortPathLength<b->shortPathLength;
+            return a->getPeer()<b->getPeer();
+        });
+        if (info.paths.size()>(size_t)maxPaths)
+            info.paths.resize(maxPaths);
+    }
+    return true;
+}
+
+bool RIBLookup::longestMatch(bgpstream_pfx_t *addr, PrefixInfo &info, int maxPaths){
+    vector<void *> elements;
+    table->ribTrie->covering(addr, elements);
+    for (auto it=elements.rbegin(); it!=elements.rend(); it++){
+        if (fill((RIBElement *)*it, info, maxPaths))
+            return true;
+    }
+    return false;
+}
+
+void RIBLookup::longestMatch(vector<bgpstream_pfx_t> &addrs, vector<PrefixInfo> &infos, vector<bool> &found, int maxPaths){
+    infos.resize(addrs.size());
+    found.assign(addrs.size(), false);
+    vector<char> matched(addrs.size(), 0);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, addrs.size(), 4096), [&](tbb::blocked_range<size_t> range){
+        for (size_t i=range.begin(); i<range.end(); i++)
+            matched[i] = longestMatch(&addrs[i], infos[i], maxPaths);
+    });
+    for (size_t i=0; i<addrs.size(); i++)
+        found[i] = matched[i];
+}
+
+void RIBLookup::covering(bgpstream_pfx_t *pfx, vector<PrefixInfo> &infos, int maxPaths){
+    vector<void *> elements;
+    PrefixInfo info;
+    table->ribTrie->covering(pfx, elements);
+    for (auto element:elements){
+        if (fill((RIBElement *)element, info, maxPaths))
+            infos.push_back(info);
+    }
+}
+
+void RIBLookup::covered(bgpstream_pfx_t *pfx, vector<PrefixInfo> &infos, size_t limit, int maxPaths){
+    vector<void *> elements;
+    PrefixInfo info;
+    table->ribTrie->covered(pfx, elements, limit);
+    for (auto element:elements){
+        if (fill((RIBElement *)element, info, maxPaths))
+            infos.push_back(info);
+    }
+}
+
+bool RIBLookup::parse(string str, bgpstream_pfx_t *pfx){
+    if (str.find('/') == string::npos)
+        str += (str.find(':') == string::npos) ? "/32" : "/128";
+    return bgpstream_str2pfx(str.c_str(), pfx) != NULL;
+}
+
+RIBLookupServer::RIBLookupServer(RIBLookup *lookup, string socketPath): lookup(lookup), socketPath(socketPath){
+    struct sockaddr_un addr;
+    if (socketPath.size() >= sizeof(addr.sun_path)){
+        cout<<"Lookup socket path too long: "<<socketPath<<endl;
+        return;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path)-1);
+    unlink(socketPath.c_str());
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((fd<0) || (::bind(fd, (struct sockaddr *)&addr, sizeof(addr))<0) || (listen(fd, 16)<0)){
+        cout<<"Cannot open lookup socket "<<socketPath<<endl;
+        if (fd>=0)
+            ::close(fd);
+        fd = -1;
+    }
+}
+
+RIBLookupServer::~RIBLookupServer(){
+    if (fd>=0){
+        ::close(fd);
+        unlink(socketPath.c_str());
+    }
+}
+
+void RIBLookupServer::run(){
+#ifdef __linux
+    prctl(PR_SET_NAME,"RIBLOOKUP");
+#endif
+    while (fd>=0){
+        int client=accept(fd, NULL, NULL);
+        if (client<0)
+            break;
+        if (clients.fetch_add(1)>=maxClients){
+            string reply="{\"error\":\"too many connections\"}\n";
+            send(client, reply.data(), reply.size(), MSG_NOSIGNAL);
+            ::close(client);
+            clients--;
+            continue;
+        }
+        std::thread(&RIBLookupServer::serve, this, client).detach();
+    }
+}
+
+void RIBLookupServer::serve(int client){
+    char buffer[4096];
+    string pending;
+    ssize_t len;
+    while ((len=::read(client, buffer, sizeof(buffer)))>0){
+        pending.append(buffer, len);
+        size_t pos;
+        while ((pos=pending.find('\n')) != string::npos){
+            string reply=answer(pending.substr(0, pos))+"\n";
+            pending.erase(0, pos+1);
+            if (send(client, reply.data(), reply.size(), MSG_NOSIGNAL)<0){
+                pending.clear();
+                len = -1;
+                break;
+            }
+        }
+        // a query is one short line
+        if ((len<0) || (pending.size()>sizeof(buffer)))
+            break;
+    }
+    ::close(client);
+    clients--;
+}
+
+// a malformed query gets an error line, it never ends the connection thread
+string RIBLookupServer::answer(string query){
+    try {
+        return process(query);
+    } catch (std::exception &e){
+        json j;
+        j["query"] = query;
+        j["error"] = e.what();
+        return j.dump();
+    }
+}
+
+string RIBLookupServer::process(string query){
+    vector<string> args;
+    vector<PrefixInfo> infos;
+    bgpstream_pfx_t pfx;
+    json j, prefixes=json::array();
+
+    boost::trim(query);
+    boost::split(args, query, boost::is_any_of(" \t"), boost::token_compress_on);
+    j["query"] = query;
+    if ((args.size()<2) || !RIBLookup::parse(args[1], &pfx)){
+        j["error"] = "usage: LPM <address> | COVERING <prefix> | COVERED <prefix> [limit]";
+        return j.dump();
+    }
+    if (args[0] == "LPM"){
+        PrefixInfo info;
+        if (lookup->longestMatch(&pfx, info, maxPaths))
+            infos.push_back(info);
+    } else if (args[0] == "COVERING"){
+        lookup->covering(&pfx, infos, maxPaths);
+    } else if (args[0] == "COVERED"){
+        bool hasLimit=(args.size()>2) && !args[2].empty() && boost::all(args[2], boost::is_digit());
+        lookup->covered(&pfx, infos, hasLimit ? stoul(args[2]) : coveredLimit, maxPaths);
+    } else {
+        j["error"] = "unknown query "+args[0];
+        return j.dump();
+    }
+    for (auto &info:infos){
+        json p, paths=json::array();
+        p["prefix"] = info.str();
+        p["origins"] = info.origins;
+        p["peers"] = info.visiblePeers;
+        for (auto &path:info.paths){
+            vector<unsigned int> asns(path->shortPath, path->shortPath+path->shortPathLength);
+            paths.push_back(asns);
+        }
+        p["paths"] = paths;
+        prefixes.push_back(p);
+    }
+    j["prefixes"] = prefixes;
+    return j.dump();
+}
@@ -0,0 +1,81 @@
+//
+//  BGPLookup.h
+//  BGPGeopol
+//
+//  Longest prefix match and covering/covered prefix queries over the live
+//  RIBTable trie. Queries only take the trie shared lock for the walk and
+//  read RIBElement state without locking, so they run alongside the
+//  TableFlagger workers.
+//
+//  RIBLookupServer answers the same queries on a local Unix socket, one
+//  query per line and one JSON line per answer:
+//      LPM <address>
+//      COVERING <prefix>
+//      COVERED <prefix> [limit]
+//
+
+#ifndef BGPGEOPOLITICS_BGPLOOKUP_H
+#define BGPGEOPOLITICS_BGPLOOKUP_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "BGPGeopolitics.h"
+#include "cache.h"
+
+using namespace std;
+
+class RIBTable;
+class RIBElement;
+
+class PrefixInfo{
+public:
+    bgpstream_pfx_t pfx;
+    vector<unsigned int> origins;
+    int visiblePeers=0;
+    // shortest AS paths first
+    vector<SPrefixPath> paths;
+    string str();
+};
+
+class RIBLookup{
+public:
+    RIBLookup(RIBTable *table): table(table){}
+    // most specific routed prefix covering addr, false if none
+    bool longestMatch(bgpstream_pfx_t *addr, PrefixInfo &info, int maxPaths=0);
+    // batch of longest matches, split across TBB tasks; found[i] tells if infos[i] is set
+    void longestMatch(vector<bgpstream_pfx_t> &addrs, vector<PrefixInfo> &infos, vector<bool> &found, int maxPaths=0);
+    // routed prefixes covering pfx, least specific first
+    void covering(bgpstream_pfx_t *pfx, vector<PrefixInfo> &infos, int maxPaths=0);
+    // routed prefixes covered by pfx
+    void covered(bgpstream_pfx_t *pfx, vector<PrefixInfo> &infos, size_t limit, int maxPaths=0);
+    // parses an address or prefix, addresses become host prefixes
+    static bool parse(string str, bgpstream_pfx_t *pfx);
+private:
+    RIBTable *table;
+    bool fill(RIBElement *element, PrefixInfo &info, int maxPaths);
+};
+
+class RIBLookupServer{
+public:
+    // paths returned per prefix
+    int maxPaths=3;
+    // prefixes returned by COVERED without a limit
+    size_t coveredLimit=1000;
+    // connections served at once, later ones get an error line and are closed
+    int maxClients=16;
+
+    RIBLookupServer(RIBLookup *lookup, string socketPath);
+    ~RIBLookupServer();
+    void run();
+private:
+    RIBLookup *lookup;
+    string socketPath;
+    int fd=-1;
+    std::atomic<int> clients={0};
+    void serve(int client);
+    string answer(string query);
+    string process(string query);
+};
+
+#endif //BGPGEOPOLITICS_BGPLOOKUP_H
@@ -0,0 +1,104 @@
+//
+//  BGPMemory.cpp
+//  BGPGeopol
+//
+
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include "BGPMemory.h"
+
+std::atomic<long> memCounters[MEMSUBSYSTEMS];
+
+static const char *memNames[MEMSUBSYSTEMS]={"ribTrie", "routingentries", "pathsMapId", "pathsMapStr", "paths",
+    "bloomFilters", "asCache", "linksMap", "asTries", "queues", "pools"};
+
+const char *MemoryAccountant::name(MemSubsystem subsystem){
+    return memNames[subsystem];
+}
+
+void MemoryAccountant::addProbe(MemSubsystem subsystem, std::function<long()> probe){
+    std::lock_guard<std::mutex> lock(mutex_);
+    probes[subsystem].push_back(probe);
+}
+
+void MemoryAccountant::setBudget(MemSubsystem subsystem, long bytes){
+    std::lock_guard<std::mutex> lock(mutex_);
+    budgets[subsystem] = bytes;
+}
+
+long MemoryAccountant::budget(MemSubsystem subsystem){
+    std::lock_guard<std::mutex> lock(mutex_);
+    return budgets[subsystem];
+}
+
+void MemoryAccountant::setShrink(MemSubsystem subsystem, std::function<void(double)> shrink){
+    setShrink(vector<MemSubsystem>{subsystem}, shrink);
+}
+
+// a subsystem is shrunk by one action, a later one replaces it
+void MemoryAccountant::setShrink(vector<MemSubsystem> group, std::function<void(double)> shrink){
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it=shrinks.begin(); it!=shrinks.end();){
+        bool overlaps=false;
+        for (auto subsystem:group)
+            overlaps |= std::find(it->group.begin(), it->group.end(), subsystem) != it->group.end();
+        it = overlaps ? shrinks.erase(it) : it+1;
+    }
+    if (shrink)
+        shrinks.push_back(Shrink{group, shrink});
+}
+
+bool MemoryAccountant::loadBudgets(string file){
+    std::ifstream in(file);
+    json j;
+    if (!in.is_open())
+        return false;
+    try {
+        in>>j;
+        for (int i=0; i<MEMSUBSYSTEMS; i++){
+            if (j.find(memNames[i]) != j.end())
+                setBudget((MemSubsystem)i, j[memNames[i]].get<long>());
+        }
+    } catch (json::exception &e){
+        cout<<"Bad memory budgets in "<<file<<":"<<e.what()<<endl;
+        return false;
+    }
+    return true;
+}
+
+long MemoryAccountant::usage(MemSubsystem subsystem){
+    long bytes=memCounters[subsystem].load(std::memory_order_relaxed);
+    for (auto &probe:probes[subsystem])
+        bytes += probe();
+    return bytes;
+}
+
+void MemoryAccountant::report(json &j){
+    std::lock_guard<std::mutex> lock(mutex_);
+    long total=0, bytes[MEMSUBSYSTEMS];
+    for (int i=0; i<MEMSUBSYSTEMS; i++){
+        bytes[i] = usage((MemSubsystem)i);
+        total += bytes[i];
+        j[memNames[i]] = bytes[i];
+    }
+    j["total"] = total;
+    // subsystems without a budget are not limited, nor counted in their group
+    for (auto &shrink:shrinks){
+        long used=0, budget=0;
+        string names;
+        for (auto subsystem:shrink.group){
+            if (budgets[subsystem]<=0)
+                continue;
+            used += bytes[subsystem];
+            budget += budgets[subsystem];
+            names += (names.empty() ? "" : "+")+string(memNames[subsystem]);
+        }
+        if ((budget<=0) || (used<=budget))
+            continue;
+        double keep=shrinkMargin*budget/used;
+        cout<<"Memory: "<<names<<" uses "<<used<<" bytes over a budget of "<<budget<<", shrinking to "<<keep<<endl;
+        shrink.action(keep);
+        j["shrunk"].push_back(names);
+    }
+}
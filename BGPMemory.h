@@ -0,0 +1,69 @@
+//
+//  BGPMemory.h
+//  BGPGeopol
+//
+//  Byte accounting per subsystem. Structures without a cheap size (paths,
+//  tries and RIB elements) keep an incremental counter updated where they
+//  allocate; caches, filters, maps and queues register a probe computing
+//  their size from their element count. Both are O(1) to read, so the
+//  report written each interval to perf.dat does not walk any structure.
+//
+//  A subsystem may be given a budget with a shrink action; when the report
+//  finds it over budget the action is called with the fraction to keep.
+//  Subsystems of one structure share a single action, called once on the
+//  sum of their usages against the sum of their budgets.
+//
+
+#ifndef BGPGEOPOLITICS_BGPMEMORY_H
+#define BGPGEOPOLITICS_BGPMEMORY_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <functional>
+#include "json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+enum MemSubsystem{MEMRIBTRIE=0, MEMROUTING=1, MEMPATHID=2, MEMPATHSTR=3, MEMPATHS=4, MEMBLOOM=5, MEMASCACHE=6,
+    MEMLINKS=7, MEMASTRIES=8, MEMQUEUES=9, MEMPOOLS=10, MEMSUBSYSTEMS=11};
+
+extern std::atomic<long> memCounters[MEMSUBSYSTEMS];
+
+inline void memAdd(MemSubsystem subsystem, long bytes){
+    memCounters[subsystem].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+class MemoryAccountant{
+public:
+    // shrink by this much more than needed, so a budget is not hit every interval
+    double shrinkMargin=0.9;
+
+    MemoryAccountant(){}
+    void addProbe(MemSubsystem subsystem, std::function<long()> probe);
+    void setBudget(MemSubsystem subsystem, long bytes);
+    long budget(MemSubsystem subsystem);
+    void setShrink(MemSubsystem subsystem, std::function<void(double)> shrink);
+    // one action for subsystems accounting parts of the same structure
+    void setShrink(vector<MemSubsystem> group, std::function<void(double)> shrink);
+    // budgets in bytes keyed by subsystem name, "total" is not enforced
+    bool loadBudgets(string file);
+    long usage(MemSubsystem subsystem);
+    // per subsystem bytes, enforces the budgets; called once per interval
+    void report(json &j);
+    static const char *name(MemSubsystem subsystem);
+
+private:
+    std::mutex mutex_;
+    vector<std::function<long()>> probes[MEMSUBSYSTEMS];
+    long budgets[MEMSUBSYSTEMS]={0};
+    struct Shrink{
+        vector<MemSubsystem> group;
+        std::function<void(double)> action;
+    };
+    vector<Shrink> shrinks;
+};
+
+#endif //BGPGEOPOLITICS_BGPMEMORY_H
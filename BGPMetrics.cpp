@@ -0,0 +1,192 @@
+//
+//  BGPMetrics.cpp
+//  BGPGeopol
+//
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include "BGPMetrics.h"
+#include "BGPQueues.h"
+#include "BGPTrace.h"
+#ifdef __linux
+    #include <sys/prctl.h>
+#endif
+
+MetricsServer *metricsServer=NULL;
+
+// upper bounds of the latency histogram buckets, in seconds
+static const double latencyBounds[]={1e-5, 1e-4, 1e-3, 1e-2, 0.1, 1, 10, 60};
+
+static void header(ostringstream &out, set<string> &done, const string &name, const string &help, const string &type){
+    string base=name.substr(0, name.find('{'));
+    if (!done.insert(base).second)
+        return;
+    out<<"# HELP "<<base<<" "<<help<<"\n";
+    out<<"# TYPE "<<base<<" "<<type<<"\n";
+}
+
+MetricsServer::MetricsServer(int port): port(port){
+    struct sockaddr_in addr;
+    int on=1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd>=0)
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if ((fd<0) || (::bind(fd, (struct sockaddr *)&addr, sizeof(addr))<0) || (listen(fd, 16)<0)){
+        cout<<"Cannot open metrics port "<<port<<endl;
+        if (fd>=0)
+            ::close(fd);
+        fd = -1;
+    }
+}
+
+MetricsServer::~MetricsServer(){
+    if (fd>=0)
+        ::close(fd);
+}
+
+void MetricsServer::addGauge(string name, string help, std::function<double()> value){
+    std::lock_guard<std::mutex> lock(mutex_);
+    metrics.push_back({name, help, "gauge", value});
+}
+
+void MetricsServer::addCounter(string name, string help, std::function<double()> value){
+    std::lock_guard<std::mutex> lock(mutex_);
+    metrics.push_back({name, help, "counter", value});
+}
+
+void MetricsServer::publish(unsigned int time, json &report){
+    std::lock_guard<std::mutex> lock(mutex_);
+    lastReport = report;
+    lastTime = time;
+    lastPublished = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// scrapes are rare, they are served one at a time on the accept thread
+void MetricsServer::run(){
+#ifdef __linux
+    prctl(PR_SET_NAME,"BGPMETRICS");
+#endif
+    while (fd>=0){
+        int client=accept(fd, NULL, NULL);
+        if (client<0)
+            break;
+        serve(client);
+    }
+}
+
+void MetricsServer::serve(int client){
+    char buffer[4096];
+    string request, reply, body;
+    ssize_t len;
+    struct timeval timeout={2, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    while ((request.find("\r\n\r\n") == string::npos) && (request.size()<16384) &&
+           ((len=::read(client, buffer, sizeof(buffer)))>0))
+        request.append(buffer, len);
+    if ((request.compare(0, 13, "GET /metrics ") == 0) || (request.compare(0, 6, "GET / ") == 0)){
+        body = render();
+        reply = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n";
+    } else {
+        body = "not found\n";
+        reply = "HTTP/1.0 404 Not Found\r\nContent-Type: text/plain\r\n";
+    }
+    reply += "Content-Length: "+to_string(body.size())+"\r\nConnection: close\r\n\r\n"+body;
+    size_t sent=0;
+    while (sent<reply.size()){
+        ssize_t n=send(client, reply.data()+sent, reply.size()-sent, MSG_NOSIGNAL);
+        if (n<=0)
+            break;
+        sent += n;
+    }
+    ::close(client);
+}
+
+string MetricsServer::render(){
+    ostringstream out;
+    set<string> done;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &m:metrics){
+        header(out, done, m.name, m.help, m.type);
+        out<<m.name<<" "<<m.value()<<"\n";
+    }
+    renderQueues(out);
+    renderLatency(out);
+    if (lastTime != 0){
+        header(out, done, "bgpgeopol_report_time", "End of the last interval reported by the saver, BGP time", "gauge");
+        out<<"bgpgeopol_report_time "<<lastTime<<"\n";
+        header(out, done, "bgpgeopol_report_timestamp_seconds", "Wall clock of the last interval report", "gauge");
+        out<<"bgpgeopol_report_timestamp_seconds "<<lastPublished<<"\n";
+        for (auto it=lastReport.begin(); it!=lastReport.end(); ++it){
+            if (!it.value().is_number())
+                continue;
+            string name="bgpgeopol_interval_"+it.key();
+            header(out, done, name, "Last interval report field "+it.key(), "gauge");
+            out<<name<<" "<<it.value().get<double>()<<"\n";
+        }
+    }
+    return out.str();
+}
+
+void MetricsServer::renderQueues(ostringstream &out){
+    ostringstream depth, maxDepth, capacity, adds, takes, blocked, idle, wait, hold;
+    if (!queueRegistry)
+        return;
+    queueRegistry->forEach([&](const string &name, QueueMetrics &metrics){
+        QueueTotals totals(metrics);
+        string label="{queue=\""+name+"\"}";
+        depth<<"bgpgeopol_queue_depth"<<label<<" "<<metrics.depth.load(std::memory_order_relaxed)<<"\n";
+        maxDepth<<"bgpgeopol_queue_max_depth"<<label<<" "<<metrics.maxDepth.load(std::memory_order_relaxed)<<"\n";
+        if (metrics.capacity != SIZE_MAX)
+            capacity<<"bgpgeopol_queue_capacity"<<label<<" "<<metrics.capacity<<"\n";
+        adds<<"bgpgeopol_queue_adds_total"<<label<<" "<<totals.adds<<"\n";
+        takes<<"bgpgeopol_queue_takes_total"<<label<<" "<<totals.takes<<"\n";
+        blocked<<"bgpgeopol_queue_producer_blocked_seconds_total"<<label<<" "<<totals.producerBlocked/1e9<<"\n";
+        idle<<"bgpgeopol_queue_consumer_idle_seconds_total"<<label<<" "<<totals.consumerIdle/1e9<<"\n";
+        wait<<"bgpgeopol_queue_lock_wait_seconds_total"<<label<<" "<<totals.lockWait/1e9<<"\n";
+        hold<<"bgpgeopol_queue_lock_hold_seconds_total"<<label<<" "<<totals.lockHold/1e9<<"\n";
+    });
+    out<<"# HELP bgpgeopol_queue_depth Items in the queue\n# TYPE bgpgeopol_queue_depth gauge\n"<<depth.str();
+    out<<"# HELP bgpgeopol_queue_max_depth Peak depth since the last interval report\n# TYPE bgpgeopol_queue_max_depth gauge\n"<<maxDepth.str();
+    out<<"# HELP bgpgeopol_queue_capacity Bound of the queue\n# TYPE bgpgeopol_queue_capacity gauge\n"<<capacity.str();
+    out<<"# HELP bgpgeopol_queue_adds_total Items added\n# TYPE bgpgeopol_queue_adds_total counter\n"<<adds.str();
+    out<<"# HELP bgpgeopol_queue_takes_total Items taken\n# TYPE bgpgeopol_queue_takes_total counter\n"<<takes.str();
+    out<<"# HELP bgpgeopol_queue_producer_blocked_seconds_total Time producers waited on a full queue\n# TYPE bgpgeopol_queue_producer_blocked_seconds_total counter\n"<<blocked.str();
+    out<<"# HELP bgpgeopol_queue_consumer_idle_seconds_total Time consumers waited on an empty queue\n# TYPE bgpgeopol_queue_consumer_idle_seconds_total counter\n"<<idle.str();
+    out<<"# HELP bgpgeopol_queue_lock_wait_seconds_total Estimated time spent acquiring the queue lock\n# TYPE bgpgeopol_queue_lock_wait_seconds_total counter\n"<<wait.str();
+    out<<"# HELP bgpgeopol_queue_lock_hold_seconds_total Estimated time the queue lock was held\n# TYPE bgpgeopol_queue_lock_hold_seconds_total counter\n"<<hold.str();
+}
+
+void MetricsServer::renderLatency(ostringstream &out){
+    vector<uint64_t> counts;
+    if (!tracer)
+        return;
+    out<<"# HELP bgpgeopol_stage_latency_seconds Latency of the sampled messages and events per pipeline stage\n";
+    out<<"# TYPE bgpgeopol_stage_latency_seconds histogram\n";
+    for (int i=0; i<TRACESTAGES; i++){
+        TraceStage stage=(TraceStage)i;
+        uint64_t sum=tracer->cumulative(stage, counts), seen=0;
+        size_t b=0;
+        string label="stage=\""+string(PipelineTracer::name(stage))+"\"";
+        for (double bound:latencyBounds){
+            for (; (b<counts.size()) && (HdrHistogram::bucketValue(b)<=bound*1e6); b++)
+                seen += counts[b];
+            out<<"bgpgeopol_stage_latency_seconds_bucket{"<<label<<",le=\""<<bound<<"\"} "<<seen<<"\n";
+        }
+        for (; b<counts.size(); b++)
+            seen += counts[b];
+        out<<"bgpgeopol_stage_latency_seconds_bucket{"<<label<<",le=\"+Inf\"} "<<seen<<"\n";
+        out<<"bgpgeopol_stage_latency_seconds_sum{"<<label<<"} "<<sum/1e6<<"\n";
+        out<<"bgpgeopol_stage_latency_seconds_count{"<<label<<"} "<<seen<<"\n";
+    }
+}
@@ -0,0 +1,56 @@
+//
+//  BGPMetrics.h
+//  BGPGeopol
+//
+//  Prometheus text exposition on a loopback TCP port, GET /metrics. A scrape
+//  only reads atomics and sizes: the registered gauges and counters, the
+//  QueueRegistry counters, the PipelineTracer histograms and the numeric
+//  fields of the last interval report published by the saver.
+//
+
+#ifndef BGPGEOPOLITICS_BGPMETRICS_H
+#define BGPGEOPOLITICS_BGPMETRICS_H
+
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+class MetricsServer{
+public:
+    MetricsServer(int port);
+    ~MetricsServer();
+    void run();
+    // name may carry labels, e.g. bgpgeopol_cache_size{cache="paths"}
+    void addGauge(string name, string help, std::function<double()> value);
+    void addCounter(string name, string help, std::function<double()> value);
+    // the interval report of the saver, its numbers become gauges
+    void publish(unsigned int time, json &report);
+    string render();
+
+private:
+    struct Metric{
+        string name, help, type;
+        std::function<double()> value;
+    };
+    int port;
+    int fd=-1;
+    std::mutex mutex_;
+    vector<Metric> metrics;
+    json lastReport;
+    unsigned int lastTime=0;
+    // wall clock of the publication, a stalled pipeline stops moving it
+    long lastPublished=0;
+    void serve(int client);
+    void renderQueues(ostringstream &out);
+    void renderLatency(ostringstream &out);
+};
+
+extern MetricsServer *metricsServer;
+
+#endif //BGPGEOPOLITICS_BGPMETRICS_H
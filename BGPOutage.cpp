@@ -0,0 +1,188 @@
+//
+//  BGPOutage.cpp
+//  BGPGeopol
+//
+
+#include <fstream>
+#include <algorithm>
+#include <unordered_set>
+#include "BGPOutage.h"
+#include "BGPCountry.h"
+
+extern BGPCache *cache;
+
+void OutageDetector::prefixDown(unsigned int asn, const string &pfxID, int afi, long space, unsigned int time){
+    deltas.push(OutageDelta(asn, pfxID, afi, space, time, true));
+}
+
+void OutageDetector::prefixUp(unsigned int asn, const string &pfxID, unsigned int time){
+    deltas.push(OutageDelta(asn, pfxID, 0, 0, time, false));
+}
+
+double OutageDetector::share(const long down[2], const long active[2]){
+    double share=0.0;
+    for (int afi=0; afi<2; afi++){
+        if (down[afi]+active[afi]>0)
+            share = max(share, (double)down[afi]/(down[afi]+active[afi]));
+    }
+    return share;
+}
+
+void OutageDetector::apply(OutageDelta &delta){
+    if (delta.down){
+        ASOutage &state=ases[delta.asn];
+        if (state.buckets.empty()){
+            state.buckets.assign(windowBuckets, 0);
+            state.bucketStamp.assign(windowBuckets, 0);
+        }
+        if (!state.down.insert(make_pair(delta.pfxID, make_pair(delta.afi, delta.space))).second)
+            return;
+        if (state.down.size() == 1)
+            state.firstDown = delta.time;
+        state.downSpace[delta.afi] += delta.space;
+        unsigned int stamp=delta.time/bucketDuration;
+        int slot=stamp % windowBuckets;
+        if (state.bucketStamp[slot] != stamp){
+            state.bucketStamp[slot] = stamp;
+            state.buckets[slot] = 0;
+        }
+        state.buckets[slot]++;
+    } else {
+        auto it=ases.find(delta.asn);
+        if (it == ases.end())
+            return;
+        auto p=it->second.down.find(delta.pfxID);
+        if (p == it->second.down.end())
+            return;
+        it->second.downSpace[p->second.first] -= p->second.second;
+        it->second.down.erase(p);
+        it->second.lastUp = delta.time;
+    }
+}
+
+int OutageDetector::windowDown(ASOutage &state, unsigned int time){
+    unsigned int now=time/bucketDuration;
+    int sum=0;
+    for (int i=0; i<windowBuckets; i++){
+        if (state.bucketStamp[i]+windowBuckets > now)
+            sum += state.buckets[i];
+    }
+    return sum;
+}
+
+json OutageDetector::record(string kind, string id, OutageEpisode &episode, bool open){
+    json j;
+    j["kind"] = kind;
+    j["id"] = id;
+    j["start"] = episode.start;
+    if (!open)
+        j["end"] = episode.end;
+    j["prefixes"] = episode.prefixes;
+    j["space24"] = episode.space[0];
+    j["space48"] = episode.space[1];
+    j["share"] = episode.share;
+    j["open"] = open;
+    return j;
+}
+
+// Only ASes with withdrawn prefixes are kept, so the work is bounded by the
+// deltas of the interval and the open episodes.
+void OutageDetector::update(unsigned int time, unsigned int dumpDuration){
+    OutageDelta delta;
+    std::unordered_set<unsigned int> changed;
+    std::unordered_map<short, CountryOutage> affected;
+    json records=json::array();
+    unsigned int now=time+dumpDuration-1;
+
+    while (deltas.try_pop(delta)){
+        apply(delta);
+        changed.insert(delta.asn);
+    }
+    for (auto it=ases.begin(); it!=ases.end();){
+        ASOutage &state=it->second;
+        if (!state.inEpisode && (changed.find(it->first) == changed.end())){
+            it++;
+            continue;
+        }
+        long prefixes=0, space[2]={0, 0}, downNum=state.down.size();
+        double share=0.0;
+        auto p=cache->asCache.find(it->first);
+        if (p.first && p.second)
+            p.second->activeCounts(prefixes, space);
+        // space is 0 for prefixes longer than /24 (/48), use counts then
+        if (space[0]+space[1]+state.downSpace[0]+state.downSpace[1]>0)
+            share = OutageDetector::share(state.downSpace, space);
+        else if (prefixes+downNum>0)
+            share = (double)downNum/(prefixes+downNum);
+        if (!state.inEpisode){
+            if ((windowDown(state, now)>=minPrefixes) && (share>=startShare)){
+                state.inEpisode = true;
+                state.episode = OutageEpisode();
+                state.episode.start = state.firstDown;
+            }
+        } else if (share<endShare){
+            state.episode.end = state.lastUp ? state.lastUp : now;
+            records.push_back(record("AS", to_string(it->first), state.episode, false));
+            state.inEpisode = false;
+        }
+        if (state.inEpisode){
+            state.episode.prefixes = max(state.episode.prefixes, downNum);
+            for (int afi=0; afi<2; afi++)
+                state.episode.space[afi] = max(state.episode.space[afi], state.downSpace[afi]);
+            state.episode.share = max(state.episode.share, share);
+            records.push_back(record("AS", to_string(it->first), state.episode, true));
+            if (p.first && p.second){
+                CountryOutage &country=affected[p.second->getCountryIdx()];
+                country.space[0] += state.downSpace[0];
+                country.space[1] += state.downSpace[1];
+                country.prefixes += downNum;
+                if ((country.episode.start == 0) || (state.episode.start<country.episode.start))
+                    country.episode.start = state.episode.start;
+            }
+        }
+        if (!state.inEpisode && state.down.empty())
+            it = ases.erase(it);
+        else
+            it++;
+    }
+
+    // country rollup of the AS episodes
+    if (cache->countryGraph){
+        for (auto &a:affected)
+            countries[a.first];
+        for (auto it=countries.begin(); it!=countries.end();){
+            CountryOutage &country=it->second;
+            auto a=affected.find(it->first);
+            long space[2]={0, 0}, active[2];
+            long prefixes=(a == affected.end()) ? 0 : a->second.prefixes;
+            for (int afi=0; afi<2; afi++){
+                if (a != affected.end())
+                    space[afi] = a->second.space[afi];
+                active[afi] = cache->countryGraph->activeAddr(it->first, afi);
+            }
+            double share=OutageDetector::share(space, active);
+            if (!country.inEpisode && (share>=countryShare)){
+                country.inEpisode = true;
+                country.episode = OutageEpisode();
+                country.episode.start = a->second.episode.start;
+            } else if (country.inEpisode && (share<countryShare/2)){
+                country.episode.end = now;
+                records.push_back(record("country", cache->countryGraph->code(it->first), country.episode, false));
+                country.inEpisode = false;
+            }
+            if (country.inEpisode){
+                country.episode.prefixes = max(country.episode.prefixes, prefixes);
+                for (int afi=0; afi<2; afi++)
+                    country.episode.space[afi] = max(country.episode.space[afi], space[afi]);
+                country.episode.share = max(country.episode.share, share);
+                records.push_back(record("country", cache->countryGraph->code(it->first), country.episode, true));
+                it++;
+            } else
+                it = countries.erase(it);
+        }
+    }
+
+    std::ofstream out(dumpath+"/outages"+to_string(time)+"."+to_string(time+dumpDuration)+".json");
+    out<<records.dump()<<endl;
+    cout<<"Outage: "<<ases.size()<<" ASes with withdrawn prefixes, "<<records.size()<<" episode records"<<endl;
+}
@@ -0,0 +1,104 @@
+//
+//  BGPOutage.h
+//  BGPGeopol
+//
+//  Outage episodes per origin AS and per country. RIBElement reports a
+//  prefix going dark (withdrawn by every peer) or coming back; the saver
+//  applies these deltas once per interval.
+//
+//  Withdrawals are counted in time buckets forming a sliding window, so an
+//  episode opens on a burst of withdrawals covering enough of the AS space
+//  and closes once most of it is announced again. Open and closed episodes
+//  are written each interval to outages<t>.<t+d>.json.
+//
+
+#ifndef BGPGEOPOLITICS_BGPOUTAGE_H
+#define BGPGEOPOLITICS_BGPOUTAGE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "tbb/concurrent_queue.h"
+#include "cache.h"
+
+using namespace std;
+using namespace tbb;
+
+class OutageDelta{
+public:
+    unsigned int asn;
+    string pfxID;
+    int afi;
+    long space;
+    unsigned int time;
+    bool down;
+    OutageDelta(){}
+    OutageDelta(unsigned int asn, string pfxID, int afi, long space, unsigned int time, bool down): asn(asn), pfxID(pfxID), afi(afi), space(space), time(time), down(down){}
+};
+
+class OutageEpisode{
+public:
+    unsigned int start=0;
+    unsigned int end=0;
+    long prefixes=0;
+    // /24 for IPv4, /48 for IPv6
+    long space[2]={0, 0};
+    double share=0.0;
+};
+
+class ASOutage{
+public:
+    // withdrawn prefixes of the AS, their address family and /24 (/48) space
+    std::unordered_map<string, pair<int, long>> down;
+    long downSpace[2]={0, 0};
+    unsigned int firstDown=0;
+    unsigned int lastUp=0;
+    // withdrawals per bucket, bucketStamp tells which bucket a slot holds
+    vector<int> buckets;
+    vector<unsigned int> bucketStamp;
+    bool inEpisode=false;
+    OutageEpisode episode;
+};
+
+class CountryOutage{
+public:
+    long space[2]={0, 0};
+    long prefixes=0;
+    bool inEpisode=false;
+    OutageEpisode episode;
+};
+
+class OutageDetector{
+public:
+    // sliding window of withdrawals, windowBuckets buckets of bucketDuration seconds
+    unsigned int bucketDuration=60;
+    int windowBuckets=15;
+    // withdrawals in the window needed to open an episode
+    int minPrefixes=2;
+    // share of the space withdrawn to open and to close an episode
+    double startShare=0.5;
+    double endShare=0.1;
+    // share of a country space in AS episodes to open a country episode, closed at half
+    double countryShare=0.05;
+
+    OutageDetector(string dumpath): dumpath(dumpath){}
+    // hot path, called by the TableFlagger workers
+    void prefixDown(unsigned int asn, const string &pfxID, int afi, long space, unsigned int time);
+    void prefixUp(unsigned int asn, const string &pfxID, unsigned int time);
+    // called once per interval by the saver
+    void update(unsigned int time, unsigned int dumpDuration);
+
+private:
+    string dumpath;
+    concurrent_queue<OutageDelta> deltas;
+    std::unordered_map<unsigned int, ASOutage> ases;
+    std::unordered_map<short, CountryOutage> countries;
+
+    void apply(OutageDelta &delta);
+    int windowDown(ASOutage &state, unsigned int time);
+    json record(string kind, string id, OutageEpisode &episode, bool open);
+    // largest withdrawn share over the address families, each in its own unit
+    static double share(const long down[2], const long active[2]);
+};
+
+#endif //BGPGEOPOLITICS_BGPOUTAGE_H
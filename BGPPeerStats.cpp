@@ -0,0 +1,166 @@
+//
+//  BGPPeerStats.cpp
+//  BGPGeopol
+//
+
+#include <fstream>
+#include <iostream>
+#include "BGPPeerStats.h"
+#include "BGPGeopolitics.h"
+
+PeerStats::PeerStats(PeerRegistry &registry, string dumpath): registry(registry), dumpath(dumpath){
+    for (int i=0; i<PEERBLOCKS; i++)
+        blocks[i].store(NULL, std::memory_order_relaxed);
+}
+
+PeerStats::~PeerStats(){
+    for (int i=0; i<PEERBLOCKS; i++)
+        delete[] blocks[i].load();
+}
+
+// the first thread to see a peer of the block allocates it, a loser frees its copy
+PeerCounters *PeerStats::counters(unsigned int id){
+    unsigned int b=id/PEERBLOCK;
+    if (b>=PEERBLOCKS)
+        return NULL;
+    PeerCounters *block=blocks[b].load(std::memory_order_acquire);
+    if (block == NULL){
+        PeerCounters *fresh=new PeerCounters[PEERBLOCK];
+        if (blocks[b].compare_exchange_strong(block, fresh, std::memory_order_acq_rel))
+            block = fresh;
+        else
+            delete[] fresh;
+    }
+    return &block[id%PEERBLOCK];
+}
+
+void PeerStats::update(BGPMessage *bgpMessage){
+    if (bgpMessage->peer == NULL)
+        return;
+    PeerCounters *c=counters(bgpMessage->peer->id);
+    if (c == NULL)
+        return;
+    switch (bgpMessage->type){
+        case BGPSTREAM_ELEM_TYPE_ANNOUNCEMENT:
+            c->announcements.fetch_add(1, std::memory_order_relaxed);
+            break;
+        case BGPSTREAM_ELEM_TYPE_WITHDRAWAL:
+            c->withdrawals.fetch_add(1, std::memory_order_relaxed);
+            break;
+        default:
+            // RIB dumps are not updates
+            return;
+    }
+    switch (bgpMessage->category){
+        case AADup:
+        case WWDup:
+            c->duplicates.fetch_add(1, std::memory_order_relaxed);
+            break;
+        case AADiff:
+            c->pathChanges.fetch_add(1, std::memory_order_relaxed);
+            break;
+        default:
+            break;
+    }
+}
+
+void PeerStats::sessionReset(Peer *peer){
+    PeerCounters *c=counters(peer->id);
+    if (c)
+        c->resets.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool PeerStats::usable(Peer *peer){
+    PeerCounters *c=counters(peer->id);
+    return (c == NULL) || c->usable.load(std::memory_order_relaxed);
+}
+
+void PeerStats::update(unsigned int time, unsigned int dumpDuration){
+    int max[2];
+    long totalUpdates=0, fullFeeds[2]={0, 0}, unusable=0, resets=0;
+    unsigned int n=registry.size();
+    json peers=json::array();
+
+    registry.maxPrefixes(max);
+    for (unsigned int id=0; id<n; id++){
+        Peer *peer=registry.at(id);
+        PeerCounters *c=counters(id);
+        if ((peer == NULL) || (c == NULL))
+            continue;
+        long announcements=c->announcements.load(std::memory_order_relaxed);
+        long withdrawals=c->withdrawals.load(std::memory_order_relaxed);
+        long duplicates=c->duplicates.load(std::memory_order_relaxed);
+        long pathChanges=c->pathChanges.load(std::memory_order_relaxed);
+        long sessionResets=c->resets.load(std::memory_order_relaxed);
+        long a=announcements-c->lastAnnouncements, w=withdrawals-c->lastWithdrawals;
+        long d=duplicates-c->lastDuplicates, p=pathChanges-c->lastPathChanges, r=sessionResets-c->lastResets;
+        c->lastAnnouncements = announcements;
+        c->lastWithdrawals = withdrawals;
+        c->lastDuplicates = duplicates;
+        c->lastPathChanges = pathChanges;
+        c->lastResets = sessionResets;
+
+        double coverage=0.0;
+        for (int afi=0; afi<2; afi++){
+            if (max[afi]>0)
+                coverage = std::max(coverage, (double)peer->prefixes(afi)/max[afi]);
+            if (registry.isFullFeed(peer, afi, max))
+                fullFeeds[afi]++;
+        }
+        double dupRatio=(a+w) ? (double)d/(a+w) : 0.0;
+        double score=coverage*(1-dupRatio)/(1+r);
+        bool ok=(score>=minScore);
+        c->usable.store(ok, std::memory_order_relaxed);
+        totalUpdates += a+w;
+        resets += r;
+        if (!ok)
+            unusable++;
+        if (!perPeer)
+            continue;
+        json e;
+        e["id"] = id;
+        e["asn"] = peer->getAsn();
+        e["address"] = peer->addressStr();
+        e["collector"] = peer->collector;
+        e["prefixes4"] = peer->prefixes(0);
+        e["prefixes6"] = peer->prefixes(1);
+        e["fullFeed4"] = registry.isFullFeed(peer, 0, max);
+        e["fullFeed6"] = registry.isFullFeed(peer, 1, max);
+        e["updates"] = a+w;
+        e["updateRate"] = (double)(a+w)/dumpDuration;
+        e["withdrawalRatio"] = (a+w) ? (double)w/(a+w) : 0.0;
+        e["duplicateRatio"] = dupRatio;
+        e["pathChanges"] = p;
+        e["resets"] = r;
+        e["score"] = score;
+        e["usable"] = ok;
+        peers.push_back(e);
+    }
+
+    json s;
+    s["peers"] = n;
+    s["fullFeed4"] = fullFeeds[0];
+    s["fullFeed6"] = fullFeeds[1];
+    s["maxPrefixes4"] = max[0];
+    s["maxPrefixes6"] = max[1];
+    s["unusable"] = unusable;
+    s["resets"] = resets;
+    s["updates"] = totalUpdates;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastSummary = s;
+    }
+    if (perPeer){
+        json j;
+        j["summary"] = s;
+        j["peers"] = peers;
+        std::ofstream out(dumpath+"/peers"+to_string(time)+"."+to_string(time+dumpDuration)+".json");
+        out<<j.dump()<<endl;
+    }
+    cout<<"Peers: "<<n<<" sessions, "<<fullFeeds[0]<<" IPv4 and "<<fullFeeds[1]<<" IPv6 full feeds, "<<unusable<<" partial or noisy"<<endl;
+}
+
+void PeerStats::summary(json &j){
+    std::lock_guard<std::mutex> lock(mutex_);
+    j = lastSummary;
+}
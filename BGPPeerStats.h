@@ -0,0 +1,72 @@
+//
+//  BGPPeerStats.h
+//  BGPGeopol
+//
+//  Feed quality of every peer. The workers count announcements,
+//  withdrawals, duplicates (AADup and WWDup) and path changes per peer
+//  from RIBTable::update; the source counts session resets from the
+//  PEERSTATE elements. Counters are atomics in blocks indexed by the
+//  PeerRegistry id, allocated when a peer of the block is first seen.
+//
+//  Once per interval the saver writes peers<t>.<t+d>.json with the rates
+//  and ratios of each peer and a score:
+//      coverage * (1 - duplicate ratio) / (1 + resets)
+//  where coverage is the share of the largest peer's routes, per address
+//  family. Peers scoring under minScore are flagged; analyses ask usable()
+//  to leave partial or noisy feeds out.
+//
+
+#ifndef BGPGEOPOLITICS_BGPPEERSTATS_H
+#define BGPGEOPOLITICS_BGPPEERSTATS_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include "json.hpp"
+#include "BGPPeers.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+class BGPMessage;
+
+#define PEERBLOCK 256
+#define PEERBLOCKS 256
+
+struct PeerCounters{
+    std::atomic<long> announcements={0}, withdrawals={0}, duplicates={0}, pathChanges={0}, resets={0};
+    std::atomic<bool> usable={true};
+    // totals at the last report, saver only
+    long lastAnnouncements=0, lastWithdrawals=0, lastDuplicates=0, lastPathChanges=0, lastResets=0;
+};
+
+class PeerStats{
+public:
+    double minScore=0.5;
+    // per peer entries in the interval file, the summary goes to perf.dat
+    bool perPeer=true;
+
+    PeerStats(PeerRegistry &registry, string dumpath);
+    ~PeerStats();
+    // hot path, once the message category is known
+    void update(BGPMessage *bgpMessage);
+    // the session left the Established state
+    void sessionReset(Peer *peer);
+    // false for a peer flagged partial or noisy at the last report
+    bool usable(Peer *peer);
+    // scores the interval, writes the per peer file; called once per interval
+    void update(unsigned int time, unsigned int dumpDuration);
+    // peer counts of the last interval, for perf.dat
+    void summary(json &j);
+
+private:
+    PeerRegistry &registry;
+    string dumpath;
+    std::atomic<PeerCounters *> blocks[PEERBLOCKS];
+    std::mutex mutex_;
+    json lastSummary;
+
+    PeerCounters *counters(unsigned int id);
+};
+
+#endif //BGPGEOPOLITICS_BGPPEERSTATS_H
@@ -0,0 +1,139 @@
+//
+//  BGPPeers.cpp
+//  BGPGeopol
+//
+
+#include <arpa/inet.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include "BGPPeers.h"
+
+Peer::Peer(unsigned int asNum, unsigned int id, unsigned short int collector, const bgpstream_ip_addr_t &address):
+        asNum(asNum), id(id), collector(collector){
+    prefNum[0] = 0;
+    prefNum[1] = 0;
+    memcpy(&this->address, &address, sizeof(bgpstream_ip_addr_t));
+}
+
+string Peer::addressStr(){
+    char buffer[INET6_ADDRSTRLEN];
+    if (address.version == BGPSTREAM_ADDR_VERSION_IPV4)
+        inet_ntop(AF_INET, &address.bs_ipv4, buffer, INET6_ADDRSTRLEN);
+    else if (address.version == BGPSTREAM_ADDR_VERSION_IPV6)
+        inet_ntop(AF_INET6, &address.bs_ipv6, buffer, INET6_ADDRSTRLEN);
+    else
+        return "";
+    return string(buffer);
+}
+
+PeerKey::PeerKey(unsigned short int collector, const bgpstream_ip_addr_t &address, unsigned int asn):
+        asn(asn), collector(collector), version(address.version){
+    memset(addr, 0, 16);
+    if (address.version == BGPSTREAM_ADDR_VERSION_IPV4)
+        memcpy(addr, &address.bs_ipv4, 4);
+    else if (address.version == BGPSTREAM_ADDR_VERSION_IPV6)
+        memcpy(addr, &address.bs_ipv6, 16);
+}
+
+bool PeerKey::operator==(const PeerKey &other) const{
+    return (asn == other.asn) && (collector == other.collector) && (version == other.version) &&
+        (memcmp(addr, other.addr, 16) == 0);
+}
+
+size_t PeerKeyHash::operator()(const PeerKey &key) const{
+    uint64_t h=((uint64_t)key.asn<<24)^((uint64_t)key.collector<<8)^key.version;
+    uint64_t words[2];
+    memcpy(words, key.addr, 16);
+    for (auto w:words){
+        h ^= w;
+        h *= 0x9e3779b97f4a7c15ULL;
+        h ^= h>>29;
+    }
+    return (size_t)h;
+}
+
+PeerRegistry::PeerRegistry(unsigned int capacity): peers(new std::atomic<Peer *>[capacity]), capacity(capacity){
+    for (unsigned int i=0; i<capacity; i++)
+        peers[i].store(NULL, std::memory_order_relaxed);
+}
+
+PeerRegistry::~PeerRegistry(){
+    for (unsigned int i=0; i<count; i++)
+        delete peers[i].load();
+}
+
+Peer *PeerRegistry::get(unsigned short int collector, const bgpstream_ip_addr_t &address, unsigned int asn){
+    PeerKey key(collector, address, asn);
+    auto it=index.find(key);
+    if (it != index.end())
+        return it->second;
+    std::lock_guard<std::mutex> lock(mutex_);
+    it=index.find(key);
+    if (it != index.end())
+        return it->second;
+    unsigned int id=count;
+    if (id == capacity){
+        // never expected, a few thousand sessions at most; the last peer is shared
+        cout<<"Peer registry full, AS"<<asn<<" not registered"<<endl;
+        return peers[capacity-1].load(std::memory_order_acquire);
+    }
+    Peer *peer=new Peer(asn, id, collector, address);
+    peers[id].store(peer, std::memory_order_release);
+    count = id+1;
+    index.insert(make_pair(key, peer));
+    return peer;
+}
+
+// called before any session is seen, the ids not saved stay free
+Peer *PeerRegistry::restore(unsigned int id, unsigned short int collector, const bgpstream_ip_addr_t &address, unsigned int asn){
+    if (id>=capacity)
+        return get(collector, address, asn);
+    PeerKey key(collector, address, asn);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it=index.find(key);
+    if (it != index.end())
+        return it->second;
+    Peer *peer=new Peer(asn, id, collector, address);
+    peers[id].store(peer, std::memory_order_release);
+    if (count<=id)
+        count = id+1;
+    index.insert(make_pair(key, peer));
+    return peer;
+}
+
+Peer *PeerRegistry::at(unsigned int id){
+    if (id>=count.load(std::memory_order_acquire))
+        return NULL;
+    return peers[id].load(std::memory_order_acquire);
+}
+
+unsigned int PeerRegistry::size(){
+    return count.load(std::memory_order_acquire);
+}
+
+void PeerRegistry::maxPrefixes(int max[2]){
+    unsigned int n=size();
+    max[0] = max[1] = 0;
+    for (unsigned int i=0; i<n; i++){
+        Peer *peer=peers[i].load(std::memory_order_acquire);
+        for (int afi=0; afi<2; afi++)
+            max[afi] = std::max(max[afi], peer->prefixes(afi));
+    }
+}
+
+bool PeerRegistry::isFullFeed(Peer *peer, int afi, const int max[2]){
+    return (max[afi] >= minFullFeed) && (peer->prefixes(afi) >= fullFeedRatio*max[afi]);
+}
+
+// full feed in either address family
+void PeerRegistry::fullFeeds(vector<Peer *> &full){
+    int max[2];
+    unsigned int n=size();
+    maxPrefixes(max);
+    for (unsigned int i=0; i<n; i++){
+        Peer *peer=peers[i].load(std::memory_order_acquire);
+        if (isFullFeed(peer, 0, max) || isFullFeed(peer, 1, max))
+            full.push_back(peer);
+    }
+}
@@ -0,0 +1,115 @@
+//
+//  BGPPeers.h
+//  BGPGeopol
+//
+//  BGP sessions seen by the collectors. A peer is identified by its
+//  collector, address and ASN, so a 4-byte ASN or an AS peering with
+//  several collectors does not collide. The registry gives each one a
+//  dense id, an index for per-peer arrays; known peers are found without
+//  locking, the mutex is only taken to register a new one.
+//
+//  A peer is a full feed for an address family when it has at least
+//  fullFeedRatio of the routes of the largest peer of that family, so the
+//  rule follows the growth of the table and works for IPv6 as well.
+//
+
+#ifndef BGPGEOPOLITICS_BGPPEERS_H
+#define BGPGEOPOLITICS_BGPPEERS_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "tbb/concurrent_unordered_map.h"
+extern "C" {
+#include "bgpstream.h"
+}
+
+using namespace std;
+
+// index of the per address family counters
+inline int afiIndex(const bgpstream_pfx_t &pfx){
+    return (pfx.address.version == BGPSTREAM_ADDR_VERSION_IPV6) ? 1 : 0;
+}
+
+class Peer{
+protected:
+    unsigned int asNum;
+    // routes of the peer, IPv4 then IPv6
+    std::atomic<int> prefNum[2];
+public:
+    // dense index given by the PeerRegistry
+    unsigned int id;
+    unsigned short int collector;
+    bgpstream_ip_addr_t address;
+
+    Peer(unsigned int asNum, unsigned int id, unsigned short int collector, const bgpstream_ip_addr_t &address);
+    string str(){
+        return to_string(asNum);
+    }
+    string addressStr();
+    // kept by RIBElement::setRoute as routes of the peer become active or are withdrawn
+    void addPref(int afi){
+        prefNum[afi]++;
+    }
+    void removePref(int afi){
+        prefNum[afi]--;
+    }
+    int prefixes(int afi){
+        return prefNum[afi].load(std::memory_order_relaxed);
+    }
+    // counts saved in a checkpoint
+    void restorePrefixes(int afi, int num){
+        prefNum[afi].store(num, std::memory_order_relaxed);
+    }
+    unsigned int getAsn(){
+        return asNum;
+    }
+};
+
+struct PeerKey{
+    uint8_t addr[16];
+    unsigned int asn;
+    unsigned short int collector;
+    uint8_t version;
+
+    PeerKey(unsigned short int collector, const bgpstream_ip_addr_t &address, unsigned int asn);
+    bool operator==(const PeerKey &other) const;
+};
+
+struct PeerKeyHash{
+    size_t operator()(const PeerKey &key) const;
+};
+
+class PeerRegistry{
+public:
+    double fullFeedRatio=0.9;
+    // below this many routes no peer is a full feed of the family
+    int minFullFeed=1000;
+
+    PeerRegistry(unsigned int capacity=65536);
+    ~PeerRegistry();
+    PeerRegistry(const PeerRegistry &)=delete;
+    PeerRegistry &operator=(const PeerRegistry &)=delete;
+    // the peer of a session, registered on first sight
+    Peer *get(unsigned short int collector, const bgpstream_ip_addr_t &address, unsigned int asn);
+    // the peer of a checkpoint under its saved id, routes refer to the id
+    Peer *restore(unsigned int id, unsigned short int collector, const bgpstream_ip_addr_t &address, unsigned int asn);
+    // NULL for an id not given yet
+    Peer *at(unsigned int id);
+    unsigned int size();
+    // routes of the largest peer per address family
+    void maxPrefixes(int max[2]);
+    bool isFullFeed(Peer *peer, int afi, const int max[2]);
+    void fullFeeds(vector<Peer *> &peers);
+
+private:
+    tbb::concurrent_unordered_map<PeerKey, Peer *, PeerKeyHash> index;
+    std::unique_ptr<std::atomic<Peer *>[]> peers;
+    unsigned int capacity;
+    std::atomic<unsigned int> count={0};
+    std::mutex mutex_;
+};
+
+#endif //BGPGEOPOLITICS_BGPPEERS_H
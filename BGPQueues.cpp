@@ -0,0 +1,66 @@
+//
+//  BGPQueues.cpp
+//  BGPGeopol
+//
+
+#include "BGPQueues.h"
+
+QueueRegistry *queueRegistry=NULL;
+
+QueueTotals::QueueTotals(QueueMetrics &metrics){
+    adds = metrics.adds.load(std::memory_order_relaxed);
+    takes = metrics.takes.load(std::memory_order_relaxed);
+    fullWaits = metrics.fullWaits.load(std::memory_order_relaxed);
+    emptyWaits = metrics.emptyWaits.load(std::memory_order_relaxed);
+    producerBlocked = metrics.producerBlocked.load(std::memory_order_relaxed);
+    consumerIdle = metrics.consumerIdle.load(std::memory_order_relaxed);
+    // only one operation in lockSample is timed
+    lockWait = metrics.lockWait.load(std::memory_order_relaxed)*QueueMetrics::lockSample;
+    lockHold = metrics.lockHold.load(std::memory_order_relaxed)*QueueMetrics::lockSample;
+}
+
+QueueMetrics *QueueRegistry::add(string name){
+    std::lock_guard<std::mutex> lock(mutex_);
+    queues.push_back(make_pair(name, unique_ptr<QueueMetrics>(new QueueMetrics())));
+    last.push_back(QueueTotals());
+    return queues.back().second.get();
+}
+
+long QueueRegistry::depth(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    long total=0;
+    for (auto &q:queues)
+        total += q.second->depth.load(std::memory_order_relaxed);
+    return total;
+}
+
+void QueueRegistry::forEach(std::function<void(const string &, QueueMetrics &)> f){
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &q:queues)
+        f(q.first, *q.second);
+}
+
+void QueueRegistry::report(json &j){
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i=0; i<queues.size(); i++){
+        QueueMetrics &metrics=*queues[i].second;
+        QueueTotals now(metrics), &prev=last[i];
+        size_t depth=metrics.depth.load(std::memory_order_relaxed);
+        json q;
+        q["depth"] = depth;
+        q["maxDepth"] = metrics.maxDepth.exchange(depth, std::memory_order_relaxed);
+        if (metrics.capacity != SIZE_MAX)
+            q["capacity"] = metrics.capacity;
+        q["adds"] = now.adds-prev.adds;
+        q["takes"] = now.takes-prev.takes;
+        q["fullWaits"] = now.fullWaits-prev.fullWaits;
+        q["emptyWaits"] = now.emptyWaits-prev.emptyWaits;
+        // milliseconds
+        q["producerBlocked"] = (now.producerBlocked-prev.producerBlocked)/1e6;
+        q["consumerIdle"] = (now.consumerIdle-prev.consumerIdle)/1e6;
+        q["lockWait"] = (now.lockWait-prev.lockWait)/1e6;
+        q["lockHold"] = (now.lockHold-prev.lockHold)/1e6;
+        j[queues[i].first] = q;
+        prev = now;
+    }
+}
@@ -0,0 +1,57 @@
+//
+//  BGPQueues.h
+//  BGPGeopol
+//
+//  Named QueueMetrics of the pipeline queues. main instruments each queue
+//  with a metrics object owned here, the saver scrapes them once per
+//  interval into perf.dat: depth, peak depth since the last scrape,
+//  throughput, producer blocked and consumer idle time, lock wait and hold.
+//
+
+#ifndef BGPGEOPOLITICS_BGPQUEUES_H
+#define BGPGEOPOLITICS_BGPQUEUES_H
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "BlockingQueue.h"
+#include "json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+// cumulative counters of a queue at one time
+struct QueueTotals{
+    uint64_t adds=0, takes=0, fullWaits=0, emptyWaits=0;
+    uint64_t producerBlocked=0, consumerIdle=0, lockWait=0, lockHold=0;
+    QueueTotals(){}
+    QueueTotals(QueueMetrics &metrics);
+};
+
+class QueueRegistry{
+public:
+    QueueRegistry(){}
+    // metrics to pass to BlockingCollection::instrument, valid as long as the registry
+    QueueMetrics *add(string name);
+    template <typename Queue> void instrument(string name, Queue &queue){
+        queue.instrument(add(name));
+    }
+    // sum of the current depths, for the memory accounting
+    long depth();
+    // per queue counters of the interval, resets the peak depths
+    void report(json &j);
+    // name and metrics of every queue, counters are cumulative
+    void forEach(std::function<void(const string &, QueueMetrics &)> f);
+
+private:
+    std::mutex mutex_;
+    vector<pair<string, unique_ptr<QueueMetrics>>> queues;
+    // counters at the previous report, to give per interval values
+    vector<QueueTotals> last;
+};
+
+extern QueueRegistry *queueRegistry;
+
+#endif //BGPGEOPOLITICS_BGPQUEUES_H
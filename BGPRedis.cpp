@@ -8,10 +8,13 @@
 
 #include "BGPRedis.hpp"
 #include "BGPEvent.h"
+#include "BGPEventLog.h"
+#include "BGPTrace.h"
 #include "BGPTables.h"
 #include "cache.h"
 #include "tbb/parallel_for.h"
 #include "tbb/concurrent_vector.h"
+#include "tbb/task_group.h"
 #ifdef __linux
     #include <sys/prctl.h>
 #endif
@@ -21,9 +24,21 @@
 using namespace sw::redis;
 using namespace std;
 using namespace boost;
+using namespace std::chrono;
 extern BGPCache *cache;
 extern RIBTable *bgpTable;
 
+// fields per HSET command when writing interval batches
+#define BATCHFIELDS 1000
+// warm start: elements asked per SCAN call, records per processing batch,
+// batches queued for processing before fetchers wait, progress report step
+#define SCANCOUNT 1000
+#define SCANBATCH 10000
+#define SCANINFLIGHT 64
+#define SCANREPORT 1000000
+// attempts of a failed SCAN call, from the same cursor
+#define SCANRETRIES 3
+
 
 
 ShardedBGPRedis::ShardedBGPRedis(string host, int basePort, int dbase, int numShards):numShards(numShards), host(host), basePort(basePort), dbase(dbase){
@@ -96,117 +111,143 @@ void ShardedBGPRedis::resetSavingMode(){
     }
 }
 
-void ShardedBGPRedis::getPrefixes(){
-    Redis *_redis;
-    concurrent_vector<string> keys;
-    cout<<"Begin Getting Prefixes"<<endl;
-    tbb::parallel_for( tbb::blocked_range<unsigned long >(0,numShards),
-                       [&](tbb::blocked_range<unsigned long> range)
-    {
-        for (int i=range.begin(); i<range.end(); ++i){
-            _redis=getRedis(i);
-            vector<string> keys;
-            _redis->smembers("PREFIXES",std::back_inserter(keys));
-        }
-    });
-    tbb::parallel_for( tbb::blocked_range<unsigned long >(0,keys.size()),
-                       [&](tbb::blocked_range<unsigned long> range)
-    {
+// Streams key from every shard with HSCAN/SSCAN cursors, one fetcher per shard, and hands
+// bounded batches to TBB tasks so processing overlaps with the next fetches.
+static long long scanOnce(Redis *_redis, string &key, long long cursor, vector<string> &batch){
+    return _redis->sscan(key, cursor, SCANCOUNT, std::back_inserter(batch));
+}
+
+static long long scanOnce(Redis *_redis, string &key, long long cursor, vector<pair<string,string>> &batch){
+    return _redis->hscan(key, cursor, SCANCOUNT, std::back_inserter(batch));
+}
+
+// false if a shard could not be read to the end, the state is then partial
+template <typename Record>
+bool ShardedBGPRedis::scanShards(string key, std::function<void(vector<Record> &)> process, string what){
+    std::atomic<long> count={0}, nextReport={SCANREPORT};
+    std::atomic<int> inflight={0};
+    std::atomic<bool> failed={false};
+    tbb::task_group tasks;
+    vector<std::thread> fetchers;
+    high_resolution_clock::time_point start=high_resolution_clock::now();
+
+    auto report=[&](long n, bool last){
+        duration<double> elapsed=high_resolution_clock::now()-start;
+        cout<<(last ? "Finish Getting " : "Getting ")<<n<<" "<<what<<" ("<<(long)(n/max(elapsed.count(),0.001))<<"/s)"<<endl;
+    };
+    cout<<"Begin Getting "<<what<<endl;
+    for (int i=0; i<numShards; i++){
+        fetchers.push_back(std::thread([&,i](){
+            Redis *_redis=getRedis(i);
+            long long cursor=0;
+            std::shared_ptr<vector<Record>> batch=std::make_shared<vector<Record>>();
+            auto flush=[&](){
+                while (inflight>=SCANINFLIGHT)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                inflight++;
+                tasks.run([&, batch](){
+                    process(*batch);
+                    inflight--;
+                });
+                long n=(count += batch->size()), r=nextReport;
+                if ((n>=r) && nextReport.compare_exchange_strong(r, r+SCANREPORT))
+                    report(n, false);
+                batch=std::make_shared<vector<Record>>();
+            };
+            int attempts=0;
+            while (true) {
+                try {
+                    cursor=scanOnce(_redis, key, cursor, *batch);
+                    attempts=0;
+                } catch (const Error &err) {
+                    cout<<"Redis scan error on "<<key<<" shard "<<i<<":"<<err.what()<<endl;
+                    if (++attempts == SCANRETRIES){
+                        failed = true;
+                        break;
+                    }
+                    std::this_thread::sleep_for(std::chrono::seconds(attempts));
+                    continue;
+                }
+                if (cursor == 0)
+                    break;
+                if (batch->size()>=SCANBATCH)
+                    flush();
+            }
+            if (!batch->empty())
+                flush();
+        }));
+    }
+    for (auto &t:fetchers)
+        t.join();
+    tasks.wait();
+    if (failed){
+        cout<<"Stopped Getting "<<what<<" after "<<count<<", a shard could not be read"<<endl;
+        return false;
+    }
+    report(count, true);
+    return true;
+}
+
+bool ShardedBGPRedis::getPrefixes(){
+    return scanShards<string>("PREFIXES", [](vector<string> &keys){
         bgpstream_pfx_t pfx;
-        string pfxStr;
-        vector<string> keysID(range.end()-range.begin());
-        for (int i=range.begin(); i<range.end(); ++i){
-//            bgpstream_str2pfx(keys[i].substr(4).c_str(),&pfx);
-            bgpstream_str2pfx(keys[i].c_str(),&pfx);
+        for (auto &key:keys){
+            bgpstream_str2pfx(key.c_str(),&pfx);
             bgpTable->ribTrie->checkinsert(&pfx);
-            keysID.clear();
         }
-    });
-    keys.clear();
-    cout<<"Finish Getting"<<keys.size()<<" Prefixes"<<endl;
+    }, "Prefixes");
 }
 
 
-void ShardedBGPRedis::getASes(){
-    Redis *_redis;
-    concurrent_vector<pair<string,string>> keys;
-    cout<<"Begin Getting ASes"<<endl;
-    tbb::parallel_for( tbb::blocked_range<unsigned long >(0,numShards),
-                       [&](tbb::blocked_range<unsigned long> range)
-    {
-        for (int i=range.begin(); i<range.end(); ++i){
-            _redis=getRedis(i);
-            _redis->hgetall("ASN", std::back_inserter(keys));
-        }
-    });
-
-    tbb::parallel_for( tbb::blocked_range<unsigned long >(0,keys.size()),
-                      [&](tbb::blocked_range<unsigned long> range)
-    {
+bool ShardedBGPRedis::getASes(){
+    return scanShards<pair<string,string>>("ASN", [](vector<pair<string,string>> &keys){
         SAS as;
         std::unordered_map<string, string> asMap;
-        for (size_t i=range.begin(); i<range.end(); ++i) {
+        for (auto &key:keys) {
+            // SCAN may return an element more than once
+            if (cache->asCache.find(from_myencoding(key.first)).first)
+                continue;
             asMap.clear();
-            asMap["ASN"]=keys[i].first;
-            asMap["STR"]=keys[i].second;
+            asMap["ASN"]=key.first;
+            asMap["STR"]=key.second;
             as=std::make_shared<AS>(asMap);
-            as->touch();
-            cache->asCache.insert(make_pair(as->getNum(), as));
+            if (cache->asCache.insert(make_pair(as->getNum(), as)).first)
+                as->touch();
         }
-    });
-    cout<<"Finish Getting "<<keys.size()<<" ASes"<<endl;
-    return;
+    }, "ASes");
 }
 
-bool myComp(pair<string, string> p1, pair<string, string>p2){ return from_myencoding(p2.second) < from_myencoding(p1.second); }
-
-void ShardedBGPRedis::getPaths(){
-    concurrent_vector<pair<string, string>> keys;
-    Redis *_redis;
-    
-    cout << "Begin Getting Paths" << endl;
-    tbb::parallel_for( tbb::blocked_range<unsigned long >(0,numShards),
-                       [&](tbb::blocked_range<unsigned long> range)
-    {
-        for (int i=range.begin(); i<range.end(); ++i){
-            _redis=getRedis(i);
-            _redis->hgetall("PATH2ID",std::back_inserter(keys));
+bool ShardedBGPRedis::getPaths(){
+    std::atomic<unsigned int> maxID={0};
+    bool ok=scanShards<pair<string,string>>("PATH2ID", [&](vector<pair<string,string>> &keys){
+        unsigned int localMax=0, id, cur;
+        for (auto &key:keys) {
+            cache->pathsBF.insert(key.first);
+            id=from_myencoding(key.second);
+            if (id>localMax)
+                localMax=id;
         }
-    });
-    unsigned max=from_myencoding(std::max_element(keys.begin(),keys.end(), myComp)->first);
-    cache->pathsMap.setID(max+1);
-    tbb::parallel_for( tbb::blocked_range<unsigned long >(0,keys.size()), [&](tbb::blocked_range<unsigned long> range)
-    {
-        for (size_t i = range.begin(); i < range.end(); ++i) {
-            cache->pathsBF.insert(keys[i].first);
-        }
-    });
-    keys.clear();
-    cout<<"Finish Getting "<<keys.size()<<" Paths"<<endl;
-    return;
+        cur=maxID;
+        while ((localMax>cur) && !maxID.compare_exchange_weak(cur, localMax));
+    }, "Paths");
+    cache->pathsMap.setID(maxID+1);
+    return ok;
 }
 
-void ShardedBGPRedis::getLinks(){
-    concurrent_vector<pair<string, string>> keys;
-    Redis *_redis;
-    
-    cout<<"Begin Getting Links"<<endl;
-    tbb::parallel_for( tbb::blocked_range<unsigned long >(0,numShards),
-                       [&](tbb::blocked_range<unsigned long> range)
-    {
-        for (int i=range.begin(); i<range.end(); ++i){
-            _redis=getRedis(i);
-            _redis->hgetall("LINKS", std::back_inserter(keys));
-        }
-    });
-    tbb::parallel_for( tbb::blocked_range<unsigned long >(0,keys.size()),
-                       [&](tbb::blocked_range<unsigned long> range)
-    {
+bool ShardedBGPRedis::getLinks(){
+    return scanShards<pair<string,string>>("LINKS", [](vector<pair<string,string>> &keys){
         std::unordered_map<string, string> linkMap;
-        string linkID;
-        for (int i=range.begin(); i<range.end(); ++i) {
-            linkID=keys[i].first;
-            linkMap["STR"]=keys[i].second;
+        vector<string> ends;
+        unsigned long linkID;
+        for (auto &key:keys) {
+            // SCAN may return an element more than once
+            ends.clear();
+            boost::split(ends, key.first, [](char c){return c == ':';});
+            linkID=from_myencoding(ends[0]);
+            linkID=(linkID<<32)+from_myencoding(ends[1]);
+            if (cache->linksMap.find(linkID).first)
+                continue;
+            linkMap["STR"]=key.second;
             Link *lnk=new Link(linkMap);
             linkMap.clear();
             cache->linksMap.insert(make_pair(lnk->linkID(),lnk));
@@ -214,45 +255,40 @@ void ShardedBGPRedis::getLinks(){
                 lnk->addLinks(0);
             }
         }
-    });
-    cout<<"Finish Getting "<< cache->linksMap.size()<<" Links"<<endl;
-    return;
+    }, "Links");
 }
 
-void ShardedBGPRedis::getRoutingTable(){
-    concurrent_vector<string> keys;
-    Redis *_redis;
-    cout << "Begin Getting Routing Entries" << endl;
-    tbb::parallel_for( tbb::blocked_range<unsigned long >(0,numShards),
-                       [&](tbb::blocked_range<unsigned long> range)
-    {
-        for (int i=range.begin(); i<range.end(); ++i){
-            _redis=getRedis(i);
-            _redis->smembers("ROUTINGENTRIES", std::back_inserter(keys));
-            _redis->smembers("INACTIVEROUTINGENTRIES", std::back_inserter(keys));
-        }
-    });
-    tbb::parallel_for( tbb::blocked_range<unsigned long >(0,keys.size()),[&](tbb::blocked_range<unsigned long> range)
-    {
-       for (size_t i = range.begin(); i < range.end(); ++i) {
-           cache->routingBF.insert(keys[i]);
+bool ShardedBGPRedis::getRoutingTable(){
+    auto process=[](vector<string> &keys){
+        for (auto &key:keys)
+            cache->routingBF.insert(key);
+    };
+    // active entries also give back the visible peers of each prefix, the outage detection counts on them
+    bool ok=scanShards<string>("ROUTINGENTRIES", [&](vector<string> &keys){
+        bgpstream_pfx_t pfx;
+        process(keys);
+        for (auto &key:keys){
+            size_t sep=key.find(':');
+            if (sep == string::npos)
+                continue;
+            from_myencodingPref(key.substr(0, sep), &pfx);
+            auto p=bgpTable->ribTrie->search(&pfx);
+            if (p.first && p.second)
+                ((RIBElement *)p.second)->restoreRoute();
         }
-    });
-    cout<<"Finish Getting "<<keys.size()<<" active routing entries"<<endl;
-    keys.clear();
-    return;
+    }, "active routing entries");
+    return ok && scanShards<string>("INACTIVEROUTINGENTRIES", process, "inactive routing entries");
 }
 
-void  ShardedBGPRedis::populate(){
-    getPrefixes();
-    getASes();
-    getLinks();
-    getPaths();
-    getRoutingTable();
+// stops at the first table not read completely, the process must not start on a partial state
+bool ShardedBGPRedis::populate(){
+    return getPrefixes() && getASes() && getLinks() && getPaths() && getRoutingTable();
 }
 
 
 void ShardedBGPRedis::add(BGPEvent *event){
+    if (tracer && tracer->sampleEvent())
+        event->traceStart = PipelineTracer::now();
     getQueue(event->hash)->add(event);
 }
 
@@ -285,6 +321,22 @@ int ShardedBGPRedis::getNumShards(){
     return numShards;
 }
 
+void ShardedBGPRedis::useEventLog(string dir, unsigned int segmentDuration, unsigned int flushEvery){
+    for (int i=0;i<numShards;i++){
+        BGPEventLog *log=new BGPEventLog(dir, i, segmentDuration);
+        log->flushEvery = flushEvery;
+        redisShards[i]->historySink = log;
+    }
+}
+
+bool ShardedBGPRedis::hasHistorySink(){
+    return redisShards[0]->historySink != NULL;
+}
+
+BGPEventLog *ShardedBGPRedis::eventLog(int shard){
+    return dynamic_cast<BGPEventLog *>(redisShards[shard]->historySink);
+}
+
 BGPRedis::BGPRedis(BlockingCollection<BGPEvent *> *queue, Redis *_redis):queue(queue), _redis(_redis){}
 
 BGPRedis:: ~BGPRedis(){}
@@ -299,6 +351,10 @@ void BGPRedis::run(){
     try {
         while(cont){
             queue->take(event);
+            if (event->traceStart)
+                traced.push_back(event->traceStart);
+            if (historySink && historySink->accepts(event->eventType))
+                historySink->write(event);
             if (savingMode){
                 switch (event->eventType) {
                     case NEWAS:{
@@ -376,20 +432,25 @@ void BGPRedis::run(){
                         string entry,pathHashStr, peerStr, pfxID;
                         pipe.srem("INACTIVEROUTING",event->map["pfxID"]+":"+event->map["peer"]);
                         pipe.sadd("ROUTINGENTRIES",event->map["pfxID"]+":"+event->map["peer"]);
-                        pipe.lpush("PRE:"+event->map["pfxID"]+":"+event->map["peer"],{event->map["pathHash"]+ ":A:"+to_myencoding(event->timestamp)});
+                        if (historySink)
+                            pipe.hset("ROUTES",event->map["pfxID"]+":"+event->map["peer"],event->map["pathHash"]+ ":A:"+to_myencoding(event->timestamp));
+                        else
+                            pipe.lpush("PRE:"+event->map["pfxID"]+":"+event->map["peer"],{event->map["pathHash"]+ ":A:"+to_myencoding(event->timestamp)});
                         event->map.clear();
                         delete event;
                         break;
                     }
                     case ASPREFA:{
-                        pipe.lpush("ASR:"+event->map["dstAS"],{event->map["pfxID"]+
+                        if (!historySink)
+                            pipe.lpush("ASR:"+event->map["dstAS"],{event->map["pfxID"]+
                             ":A:"+to_myencoding(event->timestamp)});
                         event->map.clear();
                         delete event;
                         break;
                     }
                     case ASPREFW:{
-                        pipe.lpush("ASR:"+event->map["dstAS"],{event->map["pfxID"]+
+                        if (!historySink)
+                            pipe.lpush("ASR:"+event->map["dstAS"],{event->map["pfxID"]+
                             ":W:"+to_myencoding(event->timestamp)});
                         event->map.clear();
                         delete event;
@@ -403,6 +464,8 @@ void BGPRedis::run(){
                         break;
                     }
                     case CAPTTIME:{
+                        if (historySink)
+                            historySink->flush();
                         pipe.lpush("CAPT",to_myencoding(event->timestamp));
                         event->map.clear();
                         delete event;
@@ -411,13 +474,18 @@ void BGPRedis::run(){
                     }
                     case ENDE:{
                         cout<<"END BGP REDIS" <<endl;
-                        pipe.exec();
+                        if (historySink)
+                            historySink->flush();
+                        exec(pipe);
                         cont=false;
                         queue->add(event);
                         break;
                     }
                     case WITHDRAW:{
-                        pipe.lpush("PRE:"+event->map["pfxID"]+":"+event->map["peer"],{":W:"+to_myencoding(event->timestamp)});
+                        if (historySink)
+                            pipe.hset("ROUTES",event->map["pfxID"]+":"+event->map["peer"],":W:"+to_myencoding(event->timestamp));
+                        else
+                            pipe.lpush("PRE:"+event->map["pfxID"]+":"+event->map["peer"],{":W:"+to_myencoding(event->timestamp)});
                         pipe.sadd("INACTIVEROUTINGENTRIES",event->map["pfxID"]+":"+event->map["peer"]);
                         pipe.srem("ROUTINGENTRIES",event->map["pfxID"]+":"+event->map["peer"]);
                         event->map.clear();
@@ -448,10 +516,54 @@ void BGPRedis::run(){
                         delete event;
                         break;
                     }
+                    case BATCHUPD:{
+                        BGPBatchEvent *batch=(BGPBatchEvent *)event;
+                        for (size_t i=0; i<batch->ases.size(); i+=BATCHFIELDS){
+                            auto last=batch->ases.begin()+std::min(batch->ases.size(), i+BATCHFIELDS);
+                            pipe.hset("ASN", batch->ases.begin()+i, last);
+                        }
+                        for (size_t i=0; i<batch->links.size(); i+=BATCHFIELDS){
+                            auto last=batch->links.begin()+std::min(batch->links.size(), i+BATCHFIELDS);
+                            pipe.hset("LINKS", batch->links.begin()+i, last);
+                        }
+                        for (size_t i=0; i<batch->paths.size(); i+=BATCHFIELDS){
+                            auto last=batch->paths.begin()+std::min(batch->paths.size(), i+BATCHFIELDS);
+                            pipe.hset("PATHS", batch->paths.begin()+i, last);
+                        }
+                        for (size_t i=0; i<batch->activePaths.size(); i+=BATCHFIELDS){
+                            auto last=batch->activePaths.begin()+std::min(batch->activePaths.size(), i+BATCHFIELDS);
+                            pipe.sadd("APATHS", batch->activePaths.begin()+i, last);
+                        }
+                        for (size_t i=0; i<batch->inactivePaths.size(); i+=BATCHFIELDS){
+                            auto last=batch->inactivePaths.begin()+std::min(batch->inactivePaths.size(), i+BATCHFIELDS);
+                            pipe.srem("APATHS", batch->inactivePaths.begin()+i, last);
+                        }
+                        exec(pipe);
+                        delete batch;
+                        break;
+                    }
+                    case HIJACKA:{
+                        pipe.hset("HIJACKS",event->map["pfxID"]+":"+event->map["origin"]+":"+event->map["TYP"],
+                                  event->map["victim"]+":"+event->map["parentID"]+":"+to_myencoding(event->timestamp));
+                        event->map.clear();
+                        delete event;
+                        break;
+                    }
+                    case HIJACKW:{
+                        pipe.hdel("HIJACKS",event->map["pfxID"]+":"+event->map["origin"]+":"+event->map["TYP"]);
+                        event->map.clear();
+                        delete event;
+                        break;
+                    }
                     case PTHUPD:{
                         string pathHash=event->map["pathHash"];
                         string str=event->map["STR"];
                         pipe.hset("PATHS",pathHash,str );
+                        writtenPaths.push_back(from_myencoding(pathHash));
+                        if (event->map["ACT"] == "T")
+                            pipe.sadd("APATHS", pathHash);
+                        else if (event->map["ACT"] == "F")
+                            pipe.srem("APATHS", pathHash);
                         event->map.clear();
                         delete event;
                         break;
@@ -463,7 +575,7 @@ void BGPRedis::run(){
                         break;
                 }
                 if (cnt%100==0){
-                    pipe.exec();
+                    exec(pipe);
                 }
             } else {
                 event->map.clear();
@@ -490,6 +602,30 @@ void BGPRedis::run(){
     return;
 }
 
+// sampled events queued since the last flush are on Redis once it returns
+// evicted paths written by the batch are read from Redis again once it returns
+void BGPRedis::exec(Pipeline &pipe){
+    if (!tracer){
+        pipe.exec();
+        pathsWritten();
+        return;
+    }
+    uint64_t start=PipelineTracer::now();
+    pipe.exec();
+    uint64_t end=PipelineTracer::now();
+    pathsWritten();
+    tracer->record(STAGEFLUSH, start, end);
+    for (auto t:traced)
+        tracer->record(STAGEREDIS, t, end);
+    traced.clear();
+}
+
+void BGPRedis::pathsWritten(){
+    for (auto hash:writtenPaths)
+        cache->pathWritten(hash);
+    writtenPaths.clear();
+}
+
 void BGPRedis::setSavingMode(){
     savingMode = true;
 }
@@ -19,6 +19,8 @@
 #include <string>
 #include <stdio.h>
 #include <thread>
+#include <functional>
+#include <vector>
 #include <sw/redis++/redis++.h>
 #include "BGPGeopolitics.h"
 //#include "BGPTables.h"
@@ -29,6 +31,8 @@ using namespace sw::redis;
 
 class BGPEvent;
 class RIBTable;
+class BGPEventSink;
+class BGPEventLog;
 
 class BGPRedis {
 public:
@@ -37,11 +41,19 @@ public:
     void run();
     void setSavingMode();
     void resetSavingMode();
+    // when set, routing history goes to the sink instead of the PRE:/ASR: lists
+    BGPEventSink *historySink=NULL;
 private:
     unsigned int  cnt=0;
+    // queue time of the sampled events not flushed yet
+    vector<uint64_t> traced;
+    // hashes of the PTHUPD in the pipeline, released from BGPCache::evictedPaths once executed
+    vector<unsigned int> writtenPaths;
     BlockingCollection<BGPEvent *> *queue;
     Redis* _redis;
     bool savingMode=false;
+    void exec(Pipeline &pipe);
+    void pathsWritten();
 };
 
 
@@ -56,17 +68,25 @@ public:
     void add(BGPEvent *event);
     void setSavingMode();
     void resetSavingMode();
-    void getPrefixes();
-    void getASes();
-    void getPaths();
-    void getLinks();
-    void getRoutingTable();
-    void populate();
+    bool getPrefixes();
+    bool getASes();
+    bool getPaths();
+    bool getLinks();
+    bool getRoutingTable();
+    // false if Redis could not be read completely
+    bool populate();
     pair<long,long> getPathsStat();
     pair<long,long> getRoutingStat();
     int getNumShards();
+    // opt in, Redis then keeps only the last state of each route in ROUTES
+    void useEventLog(string dir, unsigned int segmentDuration, unsigned int flushEvery=60);
+    bool hasHistorySink();
+    // event log of the shard, NULL if the history is not logged
+    BGPEventLog *eventLog(int shard);
 private:
     Redis *bgpRedisConnect(string host, int port, int dbase);
+    template <typename Record>
+    bool scanShards(string key, std::function<void(vector<Record> &)> process, string what);
     int numShards, basePort, dbase;
     string host;
     vector<BlockingCollection<BGPEvent *> *> queues;
@@ -12,6 +12,17 @@
 #include <chrono>
 #include <tbb/parallel_for.h>
 #include "bgpstream_utils_patricia.h"
+#include "BGPCheckpoint.h"
+#include "BGPSource.h"
+#include "BGPHijack.h"
+#include "BGPOutage.h"
+#include "BGPStability.h"
+#include "BGPPeerStats.h"
+#include "BGPStats.h"
+#include "BGPTrace.h"
+#include "BGPQueues.h"
+#include "BGPMetrics.h"
+#include "BGPCacheSizer.h"
 #ifdef __linux
     #include <sys/prctl.h>
 #endif
@@ -28,8 +39,25 @@ class Stats {
 public:
     long numBGPmsgAll = 0, numBGPlastsec = 0, numUpdates = 0, numWithdraw = 0, numRIB = 0, numPathall = 0, numNewPathlastSec = 0,
         numPrefixall = 0, numPrefixlastsec = 0, numCollector = 0, streamQueuesize = 0, details = 0, numActivepaths = 0,
-    numNewactivepaths = 0, numAS =0, numLink = 0, processTime =0, numInactivePath=0, numRoutingEntriesAll=0, numRoutingEntriesActive=0;
+    numNewactivepaths = 0, numAS =0, numLink = 0, processTime =0, numInactivePath=0, numRoutingEntriesAll=0, numRoutingEntriesActive=0,
+    numAddress24=0, numAddress48=0, numPeers=0, numFullFeedPeers=0;
+    // path changes and the PATHS writes they were coalesced into, cumulative
+    long pathChanges=0, pathWrites=0, pathChangeslastsec=0, pathWriteslastsec=0;
     double strPathCacheMiss=0.0, idPathCacheMiss=0.0, routingCacheMiss=0.0;
+    // cumulative cache counters, the miss ratios are over the interval
+    CacheCounters strPathCache, idPathCache, routingCache;
+    // accounting and resizing of the caches, from cache->sizer
+    json caches;
+    // distinct counts and heavy hitters of the interval, from cache->sketches
+    json sketch;
+    // bytes per subsystem, from cache->memory
+    json memory;
+    // stage latencies of the interval, from tracer
+    json latency;
+    // per queue depth, waits and lock times, from queueRegistry
+    json queues;
+    // full feeds, resets and unusable peers of the last interval, from cache->peerStats
+    json peers;
     
     unsigned int time;
     double delay = 0.0;
@@ -59,6 +87,31 @@ public:
         numInactivePath = stats.numInactivePath;
         numRoutingEntriesActive=stats.numRoutingEntriesActive;
         numRoutingEntriesAll=stats.numRoutingEntriesAll;
+        numAddress24=stats.numAddress24;
+        numAddress48=stats.numAddress48;
+        numPeers=stats.numPeers;
+        numFullFeedPeers=stats.numFullFeedPeers;
+        pathChanges=stats.pathChanges;
+        pathWrites=stats.pathWrites;
+        pathChangeslastsec=stats.pathChangeslastsec;
+        pathWriteslastsec=stats.pathWriteslastsec;
+        sketch=stats.sketch;
+        memory=stats.memory;
+        latency=stats.latency;
+        queues=stats.queues;
+        peers=stats.peers;
+        strPathCache=stats.strPathCache;
+        idPathCache=stats.idPathCache;
+        routingCache=stats.routingCache;
+        strPathCacheMiss=stats.strPathCacheMiss;
+        idPathCacheMiss=stats.idPathCacheMiss;
+        routingCacheMiss=stats.routingCacheMiss;
+        caches=stats.caches;
+    }
+
+    static double missRatio(CacheCounters &now, CacheCounters &last){
+        size_t lookups=now.lookups-last.lookups;
+        return lookups ? (now.misses-last.misses)*1.0/lookups : 0.0;
     }
 
     void update(BGPMessage* bgpMessage){
@@ -82,31 +135,75 @@ public:
     void makeReport(Stats laststats, unsigned int inTime){
         duration<double, std::milli> processDuration;
         time = inTime;
-        Redis *_redis = cache->bgpRedis->getRedis(max(1, cache->bgpRedis->getNumShards()-1));
-        auto p=_redis->getPathsStat();
-        numPathall = p.first;
-        numActivepaths = p.second;
-        numInactivePath = numPathall-numInactivePath;
-        p=_redis->getRoutingStat();
-        numRoutingEntriesActive=p.second;
-        numRoutingEntriesAll=p.first+p.second;
+        // in process counters and sketches, Redis only sees its own shard
+        if (cache->sketches){
+            sketch = json::object();
+            cache->sketches->rotate(sketch);
+            numPathall = cache->sketches->totalPaths();
+            numRoutingEntriesAll = cache->sketches->totalRoutes();
+        }
+        if (cache->memory){
+            memory = json::object();
+            cache->memory->report(memory);
+        }
+        if (tracer){
+            latency = json::object();
+            tracer->report(latency);
+        }
+        if (queueRegistry){
+            queues = json::object();
+            queueRegistry->report(queues);
+        }
+        numActivepaths = cache->numActivePath;
+        numInactivePath = max(0L, numPathall-numActivepaths);
+        numRoutingEntriesActive = cache->numActiveRoutes;
+        vector<Peer *> fullFeeds;
+        cache->peers.fullFeeds(fullFeeds);
+        numPeers = cache->peers.size();
+        numFullFeedPeers = fullFeeds.size();
+        if (cache->peerStats){
+            peers = json::object();
+            cache->peerStats->summary(peers);
+        }
+        pathChanges = cache->pathChanges;
+        pathWrites = cache->pathWrites;
         numAS= num_vertices(g->g);
         numLink = num_edges(g->g);
         numPrefixall = table->ribTrie->prefixNum();
+        numAddress24 = table->ribTrie->address24Num();
+        numAddress48 = table->ribTrie->address48Num();
         numBGPlastsec = numBGPmsgAll - laststats.numBGPmsgAll;
         numNewPathlastSec = numPathall - laststats.numPathall;
         numPrefixlastsec = numPrefixall - laststats.numPrefixall;
         numNewactivepaths = numActivepaths -  laststats.numActivepaths;
+        pathChangeslastsec = pathChanges - laststats.pathChanges;
+        pathWriteslastsec = pathWrites - laststats.pathWrites;
         end = high_resolution_clock::now();
         processDuration=(end-start);
         processTime= processDuration.count();
         delay=processTime*1.0 /numBGPlastsec*1000; //in usec
         start= end;
-        strPathCacheMiss=cache->pathsMap.strCacheMissed()*1.0/
+        strPathCache = cache->pathsMap.strCounters();
+        idPathCache = cache->pathsMap.idCounters();
+        routingCache = cache->routingentries.counters();
+        strPathCacheMiss = missRatio(strPathCache, laststats.strPathCache);
+        idPathCacheMiss = missRatio(idPathCache, laststats.idPathCache);
+        routingCacheMiss = missRatio(routingCache, laststats.routingCache);
+        if (cache->sizer){
+            caches = json::object();
+            cache->sizer->update(caches);
+        }
     }
 
     string toJson(string &str){
-        json j,j1;
+        json j1;
+        j1[to_string(time)]=report();
+        str = j1.dump();
+        return str;
+    }
+
+    json report(){
+        json j;
         j["processDelay"] = delay;
         j["processTime"] = processTime;
         j["numBGPmsgAll"] = numBGPmsgAll;
@@ -117,16 +214,37 @@ public:
         j["numPathall"]=numPathall;
 //        j["numNewPathlastSec"]=numNewPathlastSec;
         j["numPrefixall"]=numPrefixall;
+        j["numAddress24"]=numAddress24;
+        j["numAddress48"]=numAddress48;
 //        j["numPrefixlastsec"]=numPrefixlastsec;
         j["numCollector"]=numCollector;
+        j["numPeers"]=numPeers;
+        j["numFullFeedPeers"]=numFullFeedPeers;
         j["numActivepaths"]=numActivepaths;
         j["numInactivepaths"]= numInactivePath;
 //        j["numNewactivepaths"]=numNewactivepaths;
         j["numAS"]=numAS;
         j["numLink"]=numLink;
-        j1[to_string(time)]=j;
-        str = j1.dump();
-        return str;
+        j["numRoutingEntriesAll"]=numRoutingEntriesAll;
+        j["numRoutingEntriesActive"]=numRoutingEntriesActive;
+        j["pathChanges"]=pathChangeslastsec;
+        j["pathWrites"]=pathWriteslastsec;
+        j["strPathCacheMiss"]=strPathCacheMiss;
+        j["idPathCacheMiss"]=idPathCacheMiss;
+        j["routingCacheMiss"]=routingCacheMiss;
+        if (!sketch.is_null())
+            j["sketch"]=sketch;
+        if (!memory.is_null())
+            j["memory"]=memory;
+        if (!latency.is_null())
+            j["latency"]=latency;
+        if (!queues.is_null())
+            j["queues"]=queues;
+        if (!caches.is_null())
+            j["caches"]=caches;
+        if (!peers.is_null())
+            j["peers"]=peers;
+        return j;
     }
 
     void printStr(){
@@ -138,6 +256,8 @@ public:
 
 class ScheduleSaver{
 public:
+    // the messages read are given back here
+    BGPMessagePool *pool=NULL;
     ScheduleSaver(int start, int dumpDuration, BlockingCollection<BGPMessage *> &infifo,
             RIBTable *bgpTable, BlockingCollection<GraphToSave *> &graphsToSave, string p): time(start), dumpDuration(dumpDuration),
             infifo(infifo), lastStats(start), stats(start), table(bgpTable), dumpath(p), graphsToSave(graphsToSave){
@@ -146,6 +266,7 @@ public:
         string dumpath=p;
         path pp=path(dumpath);
         stats.table = table;
+        cache->startIntervals(start+dumpDuration-1, dumpDuration);
         if (!exists(pp) || !is_directory(pp)) {
             cout<<pp<<endl;
             create_directory(pp);
@@ -155,9 +276,23 @@ public:
     
 
     void saveGraph(BGPGraph* bgpg, unsigned int time, unsigned int dumpDuration){
-        cache->makeGraph(bgpg, time, dumpDuration);
+        table->save(bgpg, time, dumpDuration);
+        if (cache->analytics)
+            cache->analytics->update(time, dumpDuration);
+        if (cache->hijacks)
+            cache->hijacks->update(time+dumpDuration-1);
+        if (cache->outages)
+            cache->outages->update(time, dumpDuration);
+        if (cache->stability)
+            cache->stability->update(time, dumpDuration);
+        if (cache->peerStats)
+            cache->peerStats->update(time, dumpDuration);
         GraphToSave *gp =new GraphToSave(dumpath+"/graphdumps"+to_string(time)+"."+to_string(time+dumpDuration)+".graphml",bgpg->copy());
         graphsToSave.add(gp);
+        if (cache->countryGraph){
+            gp =new GraphToSave(dumpath+"/countrydumps"+to_string(time)+"."+to_string(time+dumpDuration)+".graphml",cache->countryGraph->makeGraph(time));
+            graphsToSave.add(gp);
+        }
     }
     
 
@@ -188,6 +323,11 @@ public:
                break;
             } else {
                 stats.update(bgpmessage);
+                if (tracer){
+                    uint64_t done=bgpmessage->traceDone.exchange(0);
+                    if (done)
+                        tracer->record(STAGESAVER, done, PipelineTracer::now());
+                }
             }
             if (bgpmessage->timestamp>time+dumpDuration-1){
                 BGPEvent *event;
@@ -196,15 +336,20 @@ public:
                 cache->bgpRedis->add(event);
                 previoustime=bgpmessage->timestamp;
                 saveGraph(bgpg, time, dumpDuration);
-                table->windowtime=time+dumpDuration;
                 table->duration=dumpDuration;
                 stats.g=bgpg;
                 stats.makeReport(lastStats, previoustime);
                 perfFile<<stats.toJson(str)<<","<<endl;
+                if (metricsServer){
+                    json report=stats.report();
+                    metricsServer->publish(time+dumpDuration-1, report);
+                }
                 lastStats.fill(stats);
                 cout<<"save !!!!!!!!!!!!!!!!!!!!" + to_string(time) + " to " + to_string(time + dumpDuration)<<endl;
                 time=((int)bgpmessage->timestamp/dumpDuration)*dumpDuration;
             }
+            if (pool && (bgpmessage->category != STOP))
+                pool->returnBGPMessage(bgpmessage);
             count++;
 //            if (count%10000 ==0){
 //                cout<<"Stats:";
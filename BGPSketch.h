@@ -0,0 +1,353 @@
+//
+//  BGPSketch.h
+//  BGPGeopol
+//
+//  Bounded memory stream summaries for the per-interval statistics.
+//
+//  SpaceSaving keeps the heaviest keys of a weighted stream in capacity
+//  counters; a new key takes the place of the lightest one and inherits its
+//  count as overestimation error. ShardedSpaceSaving spreads updates over
+//  independently locked summaries merged at report time.
+//
+//  DecayedScore is an exponentially decaying counter guarded by a spinlock,
+//  small enough to be embedded in paths and prefixes.
+//
+//  HyperLogLog and CountMinSketch are lock-free: registers and counters are
+//  atomics, so the workers update them without coordination. HeavyHitters
+//  adds a locked candidate set per shard, entered only by keys heavier than
+//  its lightest candidate. They are cleared by the saver while workers keep
+//  adding, an update racing with the clear may land in either interval.
+//
+
+#ifndef BGPGEOPOLITICS_BGPSKETCH_H
+#define BGPGEOPOLITICS_BGPSKETCH_H
+
+#include <map>
+#include <cmath>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+#include <limits>
+
+using namespace std;
+
+#define SKETCHSHARDS 16
+
+template <typename Key> class SpaceSaving{
+public:
+    SpaceSaving(size_t capacity=1000): capacity(capacity){}
+
+    void add(const Key &key, long weight){
+        auto it=counters.find(key);
+        if (it != counters.end()){
+            long count=it->second.pos->first+weight;
+            order.erase(it->second.pos);
+            it->second.pos = order.insert(make_pair(count, key));
+            return;
+        }
+        long error=0;
+        if (counters.size()>=capacity){
+            auto lightest=order.begin();
+            error = lightest->first;
+            counters.erase(lightest->second);
+            order.erase(lightest);
+        }
+        Counter counter;
+        counter.error = error;
+        counter.pos = order.insert(make_pair(error+weight, key));
+        counters.insert(make_pair(key, counter));
+    }
+
+    // heaviest k keys with their estimated weight, heaviest first
+    void top(size_t k, vector<pair<Key, long>> &out){
+        for (auto it=order.rbegin(); (it!=order.rend()) && (out.size()<k); it++)
+            out.push_back(make_pair(it->second, it->first));
+    }
+
+    void merge(SpaceSaving<Key> &other){
+        for (auto &p:other.order)
+            add(p.second, p.first);
+    }
+
+    size_t size(){
+        return counters.size();
+    }
+
+    void clear(){
+        counters.clear();
+        order.clear();
+    }
+
+private:
+    class Counter{
+    public:
+        long error;
+        typename std::multimap<long, Key>::iterator pos;
+    };
+    size_t capacity;
+    std::unordered_map<Key, Counter> counters;
+    std::multimap<long, Key> order;
+};
+
+template <typename Key> class ShardedSpaceSaving{
+public:
+    ShardedSpaceSaving(size_t capacity=1000){
+        for (int i=0; i<SKETCHSHARDS; i++)
+            shards[i].sketch = SpaceSaving<Key>(capacity);
+    }
+
+    void add(const Key &key, long weight){
+        Shard &shard=shards[std::hash<Key>{}(key) % SKETCHSHARDS];
+        std::lock_guard<std::mutex> lock(shard.mutex_);
+        shard.sketch.add(key, weight);
+    }
+
+    // merges the shards into out and clears them, called once per interval
+    void drain(SpaceSaving<Key> &out){
+        for (int i=0; i<SKETCHSHARDS; i++){
+            std::lock_guard<std::mutex> lock(shards[i].mutex_);
+            out.merge(shards[i].sketch);
+            shards[i].sketch.clear();
+        }
+    }
+
+private:
+    class Shard{
+    public:
+        std::mutex mutex_;
+        SpaceSaving<Key> sketch;
+    };
+    Shard shards[SKETCHSHARDS];
+};
+
+class DecayedScore{
+public:
+    DecayedScore(){}
+    DecayedScore(const DecayedScore &other): value(other.value), time(other.time){}
+    // decays to time, adds penalty and returns the new score
+    double add(double penalty, unsigned int time, double halfLife){
+        while (lock.test_and_set(std::memory_order_acquire));
+        decay(time, halfLife);
+        value += penalty;
+        double v=value;
+        lock.clear(std::memory_order_release);
+        return v;
+    }
+
+    double get(unsigned int time, double halfLife){
+        while (lock.test_and_set(std::memory_order_acquire));
+        decay(time, halfLife);
+        double v=value;
+        lock.clear(std::memory_order_release);
+        return v;
+    }
+private:
+    std::atomic_flag lock=ATOMIC_FLAG_INIT;
+    double value=0.0;
+    unsigned int time=0;
+
+    // workers are not strictly ordered in time, older updates do not decay
+    void decay(unsigned int now, double halfLife){
+        if (now>time){
+            value *= exp2(-(double)(now-time)/halfLife);
+            time = now;
+        }
+    }
+};
+
+// std::hash is the identity on integers, the sketches need well mixed bits
+inline uint64_t sketchHash(uint64_t x){
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x^(x>>30))*0xbf58476d1ce4e5b9ULL;
+    x = (x^(x>>27))*0x94d049bb133111ebULL;
+    return x^(x>>31);
+}
+
+class HyperLogLog{
+public:
+    HyperLogLog(int precision=14): precision(precision), m(1<<precision){
+        registers = new std::atomic<uint8_t>[m];
+        clear();
+    }
+    ~HyperLogLog(){
+        delete[] registers;
+    }
+    HyperLogLog(const HyperLogLog &)=delete;
+    HyperLogLog &operator=(const HyperLogLog &)=delete;
+
+    template <typename Key> void add(const Key &key){
+        addHash(sketchHash(std::hash<Key>{}(key)));
+    }
+
+    void addHash(uint64_t h){
+        uint32_t idx=h>>(64-precision);
+        // the guard bit bounds the rank to 64-precision+1
+        uint64_t w=(h<<precision) | (1ULL<<(precision-1));
+        uint8_t rank=__builtin_clzll(w)+1;
+        uint8_t current=registers[idx].load(std::memory_order_relaxed);
+        while ((rank>current) && !registers[idx].compare_exchange_weak(current, rank, std::memory_order_relaxed));
+    }
+
+    double estimate(){
+        double sum=0.0;
+        int zeros=0;
+        for (int i=0; i<m; i++){
+            uint8_t r=registers[i].load(std::memory_order_relaxed);
+            sum += ldexp(1.0, -r);
+            if (r == 0)
+                zeros++;
+        }
+        double alpha=0.7213/(1.0+1.079/m);
+        double e=alpha*m*m/sum;
+        // linear counting while many registers are empty
+        if ((e<=2.5*m) && (zeros>0))
+            e = m*log((double)m/zeros);
+        return e;
+    }
+
+    void merge(HyperLogLog &other){
+        for (int i=0; i<m; i++){
+            uint8_t rank=other.registers[i].load(std::memory_order_relaxed);
+            uint8_t current=registers[i].load(std::memory_order_relaxed);
+            while ((rank>current) && !registers[i].compare_exchange_weak(current, rank, std::memory_order_relaxed));
+        }
+    }
+
+    void clear(){
+        for (int i=0; i<m; i++)
+            registers[i].store(0, std::memory_order_relaxed);
+    }
+
+private:
+    int precision;
+    int m;
+    std::atomic<uint8_t> *registers;
+};
+
+class CountMinSketch{
+public:
+    CountMinSketch(int width=4096, int depth=4): width(width), depth(depth){
+        counters = new std::atomic<long>[width*depth];
+        clear();
+    }
+    ~CountMinSketch(){
+        delete[] counters;
+    }
+    CountMinSketch(const CountMinSketch &)=delete;
+    CountMinSketch &operator=(const CountMinSketch &)=delete;
+
+    // returns the estimate after the update, first gets the value of the first row
+    long add(uint64_t h, long weight, long *first=NULL){
+        long estimate=std::numeric_limits<long>::max();
+        for (int d=0; d<depth; d++){
+            long v=counters[d*width+slot(h, d)].fetch_add(weight, std::memory_order_relaxed)+weight;
+            if ((d == 0) && first)
+                *first = v;
+            estimate = min(estimate, v);
+        }
+        return estimate;
+    }
+
+    long estimate(uint64_t h){
+        long estimate=std::numeric_limits<long>::max();
+        for (int d=0; d<depth; d++)
+            estimate = min(estimate, counters[d*width+slot(h, d)].load(std::memory_order_relaxed));
+        return estimate;
+    }
+
+    void clear(){
+        for (int i=0; i<width*depth; i++)
+            counters[i].store(0, std::memory_order_relaxed);
+    }
+
+private:
+    int width;
+    int depth;
+    std::atomic<long> *counters;
+
+    int slot(uint64_t h, int d){
+        return sketchHash(h+d*0x9e3779b97f4a7c15ULL) % width;
+    }
+};
+
+// Count-Min counts every key; each shard keeps a bounded set of candidates,
+// the heaviest keys of the shard by their estimate. A key whose estimate
+// passes the lightest candidate takes its place once the set is full. The
+// lightest estimate is published, so light keys, nearly all of them, are
+// turned away without the lock. A shard holds capacity/SKETCHSHARDS keys,
+// which should not be below the k asked from top.
+template <typename Key> class HeavyHitters{
+public:
+    HeavyHitters(size_t capacity=512, int width=4096, int depth=4): counts(width, depth){
+        for (int i=0; i<SKETCHSHARDS; i++)
+            shards[i].capacity = max((size_t)1, capacity/SKETCHSHARDS);
+    }
+
+    void add(const Key &key){
+        uint64_t h=sketchHash(std::hash<Key>{}(key));
+        long estimate=counts.add(h, 1);
+        Shard &shard=shards[h % SKETCHSHARDS];
+        if (estimate <= shard.threshold.load(std::memory_order_relaxed))
+            return;
+        std::lock_guard<std::mutex> lock(shard.mutex_);
+        shard.offer(key, estimate);
+    }
+
+    // heaviest k candidates with their Count-Min estimate, then clears the interval
+    void top(size_t k, vector<pair<Key, long>> &out){
+        for (int i=0; i<SKETCHSHARDS; i++){
+            std::lock_guard<std::mutex> lock(shards[i].mutex_);
+            for (auto &p:shards[i].order)
+                out.push_back(make_pair(p.second, counts.estimate(sketchHash(std::hash<Key>{}(p.second)))));
+            shards[i].clear();
+        }
+        std::sort(out.begin(), out.end(), [](const pair<Key, long> &a, const pair<Key, long> &b){
+            return a.second>b.second;
+        });
+        if (out.size()>k)
+            out.resize(k);
+        counts.clear();
+    }
+
+private:
+    class Shard{
+    public:
+        std::mutex mutex_;
+        size_t capacity;
+        // estimate of the lightest candidate once the set is full, 0 before
+        std::atomic<long> threshold={0};
+        std::unordered_map<Key, typename std::multimap<long, Key>::iterator> candidates;
+        std::multimap<long, Key> order;
+
+        void offer(const Key &key, long estimate){
+            auto it=candidates.find(key);
+            if (it != candidates.end()){
+                order.erase(it->second);
+                it->second = order.insert(make_pair(estimate, key));
+            } else if (candidates.size()<capacity){
+                candidates[key] = order.insert(make_pair(estimate, key));
+            } else if (estimate>order.begin()->first){
+                candidates.erase(order.begin()->second);
+                order.erase(order.begin());
+                candidates[key] = order.insert(make_pair(estimate, key));
+            } else
+                return;
+            if (candidates.size()>=capacity)
+                threshold.store(order.begin()->first, std::memory_order_relaxed);
+        }
+
+        void clear(){
+            candidates.clear();
+            order.clear();
+            threshold.store(0, std::memory_order_relaxed);
+        }
+    };
+    CountMinSketch counts;
+    Shard shards[SKETCHSHARDS];
+};
+
+#endif //BGPGEOPOLITICS_BGPSKETCH_H
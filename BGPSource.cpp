@@ -9,6 +9,8 @@
 #include <stdio.h>
 #include "BGPSource.h"
 #include "BGPTables.h"
+#include "BGPTrace.h"
+#include "BGPPeerStats.h"
 #include <chrono>
 #ifdef __linux
     #include <sys/prctl.h>
@@ -25,6 +27,10 @@ BGPMessagePool::BGPMessagePool(int capacity): capacity(capacity), bgpMessages(ca
 BGPMessage* BGPMessagePool::getBGPMessage(long order, bgpstream_elem_t *elem, unsigned int time, std::string collector){
     BGPMessage *bgpMessage;
     bgpMessages.take(bgpMessage);
+    bgpMessage->traceDone = 0;
+    bgpMessage->traced = tracer && tracer->sample();
+    if (bgpMessage->traced)
+        bgpMessage->traceFill = PipelineTracer::now();
     if (bgpMessage->fill(order, elem, time, collector)){
         return bgpMessage;
     } else {
@@ -126,6 +132,8 @@ int BGPSource::run() {
                     }
                     bgpMessage = bgpMessagePool->getBGPMessage(order++, elem, record->time_sec, collector);
                     if (bgpMessage != NULL){
+                        if (bgpMessage->traced)
+                            bgpMessage->traceEnqueue = PipelineTracer::now();
                         fifoQueue.add(bgpMessage);
                     }
                 }
@@ -172,6 +180,13 @@ int BGPSource::run() {
                             proceed=true;
                         }
                     }
+                } else if ((elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) && cache->peerStats &&
+                           (elem->old_state == BGPSTREAM_ELEM_PEERSTATE_ESTABLISHED) &&
+                           (elem->new_state != BGPSTREAM_ELEM_PEERSTATE_ESTABLISHED)) {
+                    // the session dropped, its routes will be replayed as duplicates
+                    auto it=cache->collectors.find(collector);
+                    if (it != cache->collectors.end())
+                        cache->peerStats->sessionReset(cache->peers.get(it->second, elem->peer_ip, elem->peer_asn));
                 }
                 if (proceed) {
                     count++;
@@ -184,6 +199,8 @@ int BGPSource::run() {
                     }
                     bgpMessage = bgpMessagePool->getBGPMessage(order++, elem, time, collector);
                     if (bgpMessage != NULL){
+                        if (bgpMessage->traced)
+                            bgpMessage->traceEnqueue = PipelineTracer::now();
                         fifoQueue.add(bgpMessage);
                     }
                 }
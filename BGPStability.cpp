@@ -0,0 +1,120 @@
+//
+//  BGPStability.cpp
+//  BGPGeopol
+//
+
+#include <fstream>
+#include "BGPStability.h"
+#include "BGPTables.h"
+
+extern BGPCache *cache;
+extern RIBTable *bgpTable;
+
+void RouteStability::withdrawn(RIBElement *element, SPrefixPath path, unsigned int peer, unsigned int time){
+    penalize(element, path, peer, withdrawPenalty, time);
+}
+
+// the previous path lost the route, the prefix and the peer see an attribute change
+void RouteStability::changed(RIBElement *element, SPrefixPath path, SPrefixPath previous, unsigned int peer, unsigned int time){
+    penalize(element, NULL, peer, changePenalty, time);
+    penalizePath(previous, withdrawPenalty, time);
+}
+
+void RouteStability::reannounced(RIBElement *element, SPrefixPath path, unsigned int peer, unsigned int time){
+    penalize(element, path, peer, reannouncePenalty, time);
+}
+
+void RouteStability::penalize(RIBElement *element, SPrefixPath path, unsigned int peer, double penalty, unsigned int time){
+    if (penalty<=0)
+        return;
+    double score=element->instability.add(penalty, time, halfLife);
+    if ((score>=suppressLimit) && (score-penalty<suppressLimit))
+        suppressedPrefixes++;
+    prefixSketch.add(element->pfxStr, (long)penalty);
+    penalizePath(path, penalty, time);
+    {
+        concurrent_hash_map<unsigned int, DecayedScore>::accessor accessor;
+        peerScores.insert(accessor, peer);
+        score = accessor->second.add(penalty, time, halfLife);
+    }
+    if ((score>=suppressLimit) && (score-penalty<suppressLimit))
+        suppressedPeers++;
+    peerSketch.add(peer, (long)penalty);
+}
+
+void RouteStability::penalizePath(SPrefixPath path, double penalty, unsigned int time){
+    if (!path || (penalty<=0))
+        return;
+    double score=path->instability.add(penalty, time, halfLife);
+    if ((score>=suppressLimit) && (score-penalty<suppressLimit))
+        suppressedPaths++;
+    pathSketch.add(path->hash, (long)penalty);
+}
+
+double RouteStability::peerScore(unsigned int peer, unsigned int time){
+    concurrent_hash_map<unsigned int, DecayedScore>::accessor accessor;
+    if (peerScores.find(accessor, peer))
+        return accessor->second.get(time, halfLife);
+    return 0.0;
+}
+
+// the sketches hold the penalty of the interval, the scores are decayed to its end
+void RouteStability::update(unsigned int time, unsigned int dumpDuration){
+    unsigned int now=time+dumpDuration-1;
+    SpaceSaving<string> prefixes;
+    SpaceSaving<unsigned int> paths;
+    SpaceSaving<unsigned int> peers;
+    vector<pair<string, long>> topPrefixes;
+    vector<pair<unsigned int, long>> topPaths, topPeers;
+    json j;
+
+    prefixSketch.drain(prefixes);
+    pathSketch.drain(paths);
+    peerSketch.drain(peers);
+    prefixes.top(topK, topPrefixes);
+    paths.top(topK, topPaths);
+    peers.top(topK, topPeers);
+
+    j["prefixes"] = json::array();
+    for (auto &p:topPrefixes){
+        bgpstream_pfx_t pfx;
+        from_myencodingPref(p.first, &pfx);
+        auto e=bgpTable->ribTrie->search(&pfx);
+        if (!e.first || (e.second == NULL))
+            continue;
+        RIBElement *element=(RIBElement *)e.second;
+        json r;
+        r["prefix"] = element->str();
+        r["penalty"] = p.second;
+        r["score"] = element->instability.get(now, halfLife);
+        j["prefixes"].push_back(r);
+    }
+    j["paths"] = json::array();
+    for (auto &p:topPaths){
+        auto path=cache->pathsMap.find(p.first);
+        if (!path.first || !path.second)
+            continue;
+        json r;
+        r["path"] = path.second->str();
+        r["penalty"] = p.second;
+        r["score"] = path.second->instability.get(now, halfLife);
+        r["flaps"] = path.second->Flap;
+        r["withdrawals"] = path.second->Withdraw;
+        j["paths"].push_back(r);
+    }
+    j["peers"] = json::array();
+    for (auto &p:topPeers){
+        json r;
+        r["asn"] = p.first;
+        r["penalty"] = p.second;
+        r["score"] = peerScore(p.first, now);
+        j["peers"].push_back(r);
+    }
+    j["suppressed"]["prefixes"] = suppressedPrefixes.exchange(0);
+    j["suppressed"]["paths"] = suppressedPaths.exchange(0);
+    j["suppressed"]["peers"] = suppressedPeers.exchange(0);
+
+    std::ofstream out(dumpath+"/stability"+to_string(time)+"."+to_string(time+dumpDuration)+".json");
+    out<<j.dump()<<endl;
+    cout<<"Stability: "<<prefixes.size()<<" prefixes, "<<paths.size()<<" paths, "<<peers.size()<<" peers penalized"<<endl;
+}
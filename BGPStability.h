@@ -0,0 +1,62 @@
+//
+//  BGPStability.h
+//  BGPGeopol
+//
+//  Route flap damping statistics in the RFC 2439 style. Withdrawals, path
+//  changes and re-announcements add a penalty to the path, the prefix and
+//  the peer; penalties decay exponentially with halfLife. Scores are kept
+//  on PrefixPath and RIBElement and updated in place by the workers.
+//
+//  The penalty added during an interval is also fed to SpaceSaving sketches
+//  and the saver reports the most unstable prefixes, paths and peers in
+//  stability<t>.<t+d>.json.
+//
+
+#ifndef BGPGEOPOLITICS_BGPSTABILITY_H
+#define BGPGEOPOLITICS_BGPSTABILITY_H
+
+#include <atomic>
+#include <string>
+#include "tbb/concurrent_hash_map.h"
+#include "cache.h"
+
+using namespace std;
+using namespace tbb;
+
+class RIBElement;
+
+class RouteStability{
+public:
+    double halfLife=900;
+    double withdrawPenalty=1000;
+    double changePenalty=500;
+    double reannouncePenalty=0;
+    // score above which a route would be suppressed
+    double suppressLimit=2000;
+    // entries reported per kind and interval
+    size_t topK=20;
+
+    RouteStability(string dumpath): dumpath(dumpath){}
+    // hot path, called from RIBElement::addPath/erasePath; paths may be NULL when not in memory
+    void withdrawn(RIBElement *element, SPrefixPath path, unsigned int peer, unsigned int time);
+    void changed(RIBElement *element, SPrefixPath path, SPrefixPath previous, unsigned int peer, unsigned int time);
+    void reannounced(RIBElement *element, SPrefixPath path, unsigned int peer, unsigned int time);
+    // called once per interval by the saver
+    void update(unsigned int time, unsigned int dumpDuration);
+
+private:
+    string dumpath;
+    concurrent_hash_map<unsigned int, DecayedScore> peerScores;
+    ShardedSpaceSaving<string> prefixSketch;
+    ShardedSpaceSaving<unsigned int> pathSketch;
+    ShardedSpaceSaving<unsigned int> peerSketch;
+    std::atomic<long> suppressedPrefixes={0};
+    std::atomic<long> suppressedPaths={0};
+    std::atomic<long> suppressedPeers={0};
+
+    void penalize(RIBElement *element, SPrefixPath path, unsigned int peer, double penalty, unsigned int time);
+    void penalizePath(SPrefixPath path, double penalty, unsigned int time);
+    double peerScore(unsigned int peer, unsigned int time);
+};
+
+#endif //BGPGEOPOLITICS_BGPSTABILITY_H
@@ -0,0 +1,65 @@
+//
+//  BGPStats.cpp
+//  BGPGeopol
+//
+
+#include "BGPStats.h"
+#include "BGPTables.h"
+#include "BGPSource.h"
+
+void StatSketches::update(BGPMessage *bgpMessage, RIBElement *element, SPrefixPath path){
+    unsigned int peer=bgpMessage->peer->getAsn();
+    uint64_t pfxHash=sketchHash(std::hash<string>{}(element->getPfxID()));
+    prefixes.addHash(pfxHash);
+    peers.add(peer);
+    allRoutes.addHash(sketchHash(pfxHash^peer));
+    if (path)
+        paths.add(path->hash);
+    if (bgpMessage->type == BGPSTREAM_ELEM_TYPE_RIB)
+        return;
+    noisyPrefixes.add(element->getPfxID());
+    noisyPeers.add(peer);
+    if (path)
+        noisyOrigins.add(path->getDest());
+}
+
+void StatSketches::rotate(json &j){
+    vector<pair<string, long>> topPrefixes;
+    vector<pair<unsigned int, long>> topPeers, topOrigins;
+
+    j["distinctPrefixes"] = (long)prefixes.estimate();
+    j["distinctPaths"] = (long)paths.estimate();
+    j["distinctPeers"] = (long)peers.estimate();
+    allPrefixes.merge(prefixes);
+    allPaths.merge(paths);
+    allPeers.merge(peers);
+    prefixes.clear();
+    paths.clear();
+    peers.clear();
+
+    noisyPrefixes.top(topK, topPrefixes);
+    noisyPeers.top(topK, topPeers);
+    noisyOrigins.top(topK, topOrigins);
+    j["noisyPrefixes"] = json::array();
+    for (auto &p:topPrefixes){
+        bgpstream_pfx_t pfx;
+        char buffer[50];
+        from_myencodingPref(p.first, &pfx);
+        bgpstream_pfx_snprintf(buffer, 50, &pfx);
+        j["noisyPrefixes"].push_back({string(buffer), p.second});
+    }
+    j["noisyPeers"] = json::array();
+    for (auto &p:topPeers)
+        j["noisyPeers"].push_back({p.first, p.second});
+    j["noisyOrigins"] = json::array();
+    for (auto &p:topOrigins)
+        j["noisyOrigins"].push_back({p.first, p.second});
+}
+
+long StatSketches::totalPaths(){
+    return (long)allPaths.estimate();
+}
+
+long StatSketches::totalRoutes(){
+    return (long)allRoutes.estimate();
+}
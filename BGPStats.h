@@ -0,0 +1,45 @@
+//
+//  BGPStats.h
+//  BGPGeopol
+//
+//  Per-interval traffic statistics kept in sketches. RIBTable::update feeds
+//  every message; distinct prefixes, paths and peers of the interval are
+//  counted in HyperLogLogs merged into running totals at interval end, and
+//  the noisiest prefixes, peers and origins come from HeavyHitters. The
+//  report costs the size of the sketches, not of the RIB.
+//
+
+#ifndef BGPGEOPOLITICS_BGPSTATS_H
+#define BGPGEOPOLITICS_BGPSTATS_H
+
+#include <atomic>
+#include <string>
+#include "BGPSketch.h"
+#include "cache.h"
+
+using namespace std;
+
+class RIBElement;
+
+class StatSketches{
+public:
+    // entries reported per heavy hitter kind
+    size_t topK=20;
+
+    StatSketches(){}
+    // hot path, path is NULL for withdrawals
+    void update(BGPMessage *bgpMessage, RIBElement *element, SPrefixPath path);
+    // closes the interval, fills the distinct counts and the heavy hitters
+    void rotate(json &j);
+    long totalPaths();
+    long totalRoutes();
+
+private:
+    HyperLogLog prefixes, paths, peers;
+    HyperLogLog allPrefixes, allPaths, allPeers, allRoutes;
+    HeavyHitters<string> noisyPrefixes;
+    HeavyHitters<unsigned int> noisyPeers;
+    HeavyHitters<unsigned int> noisyOrigins;
+};
+
+#endif //BGPGEOPOLITICS_BGPSTATS_H
@@ -7,6 +7,13 @@
 #include "BGPGeopolitics.h"
 #include "BGPSource.h"
 #include "cache.h"
+#include "BGPAnalytics.h"
+#include "BGPHijack.h"
+#include "BGPOutage.h"
+#include "BGPStability.h"
+#include "BGPPeerStats.h"
+#include "BGPStats.h"
+#include "BGPTrace.h"
 #include "tbb/tbb.h"
 #include <boost/algorithm/string.hpp>
 #ifdef __linux
@@ -75,7 +82,7 @@ struct pathComp {
 
 
 RIBTable::RIBTable(unsigned int time, unsigned int duration): basetime(time), windowtime(time), duration(duration){
-    ribTrie = new Trie();
+    ribTrie = new Trie(MEMRIBTRIE);
 }
 
 BGPMessage *RIBTable::update(BGPMessage *bgpMessage){
@@ -83,7 +90,7 @@ BGPMessage *RIBTable::update(BGPMessage *bgpMessage){
     Peer* peer;
     SAS dest;
     bool globalOutage=false;
-    char collectorId =cache->collectors.find(bgpMessage->collector)->second;
+    unsigned short int collectorId =cache->collectors.find(bgpMessage->collector)->second;
     SPrefixPath path;
     unsigned int time, pathHash;
     BGPEvent *event;
@@ -91,10 +98,10 @@ BGPMessage *RIBTable::update(BGPMessage *bgpMessage){
     Category cat;
     
     peer=bgpMessage->peer;
-    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+    time = bgpMessage->timestamp;
+    EpochGuard guard(time);
     pfx=  (bgpstream_pfx_t *)&bgpMessage->pfx;
     peer = bgpMessage->peer;
-    time = bgpMessage->timestamp;
     RIBElement *ribElement = (RIBElement *)bgpMessage->trieElement;
     switch(bgpMessage->type) {
         case BGPSTREAM_ELEM_TYPE_RIB:{
@@ -107,10 +114,7 @@ BGPMessage *RIBTable::update(BGPMessage *bgpMessage){
                 event->hash=bgpMessage->prefixPath->getPeer();
                 cache->bgpRedis->add(event);
                 cache->pathsBF.insert(bgpMessage->prefixPath->str());
-                event = new BGPEvent(time, PATHACT);
-                bgpMessage->prefixPath->toRedis(event->map);
-                event->hash=bgpMessage->prefixPath->getPeer();
-                cache->bgpRedis->add(event);
+                cache->touchPath(bgpMessage->prefixPath);
             }
             path = bgpMessage->prefixPath;
             event= new BGPEvent(time,PATHA);
@@ -141,9 +145,10 @@ BGPMessage *RIBTable::update(BGPMessage *bgpMessage){
             } else {
                 path = bgpMessage->prefixPath;
                 path->announcementNum++;
+                cache->touchPath(path);
             }
             pathHash =path->hash;
-            cat= ribElement->addPath(path, pathHash, time);
+            cat= ribElement->addPath(path, pathHash, time, peer);
             switch(cat){
                 case AADup:{
                     bgpMessage->category = AADup;
@@ -170,7 +175,7 @@ BGPMessage *RIBTable::update(BGPMessage *bgpMessage){
             break;
         }
         case BGPSTREAM_ELEM_TYPE_WITHDRAWAL: {
-            auto ret = ribElement->erasePath(collectorId,peer->getAsn(), time);
+            auto ret = ribElement->erasePath(collectorId,peer->getAsn(), time, peer);
             globalOutage = ret.first;
             switch(ret.second){
                 case WWDup: {
@@ -206,53 +211,42 @@ BGPMessage *RIBTable::update(BGPMessage *bgpMessage){
             break;
         }
     }
+    if (cache->sketches)
+        cache->sketches->update(bgpMessage, ribElement, path);
+    if (cache->peerStats)
+        cache->peerStats->update(bgpMessage);
     return bgpMessage;
     //updateEventTable(bgpMessage);
 }
 
 
 
+// no table lock: the workers are only held while the cut of the interval is taken
 void RIBTable::save(BGPGraph* g, unsigned int time, unsigned int dumpDuration){
-    boost::unique_lock<boost::shared_mutex> lock(mutex_);
-    vector<pair<unsigned int, Link *>> linkVect;
-//    cout<<"FULL FEED PEERS"<<endl;
-//    for(auto p:cache->peersMap){
-//        if (p.second->isFullFeed){
-//            cout<<p.second->asNum<<endl;
-//        }
-//    }
-    windowtime +=duration;
+    windowtime = time+dumpDuration;
     cache->makeGraph(g, time, dumpDuration);
 }
 
 long RIBTable::size_of(){
-    long size=4+4*8;
-    return size;
+    return memCounters[MEMRIBTRIE];
 }
 
 
 
 BGPTable::BGPTable(unsigned int time, unsigned int duration): basetime(time), windowtime(time), duration(duration){
-    routingTrie = new Trie();
+    routingTrie = new Trie(MEMRIBTRIE);
 }
 
 
 
 void BGPTable::save(BGPGraph* g, unsigned int time, unsigned int dumpDuration){
     boost::shared_lock<boost::shared_mutex> lock(mutex_);
-//    cout<<"FULL FEED PEERS"<<endl;
-//    for(auto p:cache->peersMap){
-//        if (p.second->isFullFeed){
-//            cout<<p.second->asNum<<endl;
-//        }
-//    }
     windowtime +=duration;
     cache->makeGraph(g, time, dumpDuration);
 }
 
 long BGPTable::size_of(){
-    long size=4+4*8;
-    return size;
+    return routingTrie->size_of();
 }
 
 void TableFlagger::run(){
@@ -270,6 +264,8 @@ void TableFlagger::run(){
             break;
         } else {
             if (bgpMessage->category != STOP)  {
+                if (bgpMessage->traced)
+                    bgpMessage->traceDequeue = PipelineTracer::now();
                 pfx = (bgpstream_pfx_t *)&(bgpMessage->pfx);
                 ret =bgpTable->ribTrie->checkinsert(pfx);
                 if (ret.first){
@@ -284,7 +280,14 @@ void TableFlagger::run(){
                 }
                 bgpMessage->trieElement = trieElement;
                 bgpMessage = bgpTable->update(bgpMessage);
-                bgpSource->bgpMessagePool->returnBGPMessage(bgpMessage);
+                if (bgpMessage->traced){
+                    uint64_t done=PipelineTracer::now();
+                    tracer->record(STAGESOURCE, bgpMessage->traceFill, bgpMessage->traceEnqueue);
+                    tracer->record(STAGEQUEUE, bgpMessage->traceEnqueue, bgpMessage->traceDequeue);
+                    tracer->record(STAGETABLE, bgpMessage->traceDequeue, done);
+                    bgpMessage->traceDone = done;
+                }
+                // back to the pool once the saver has read it
                 outfifo.add(bgpMessage);
             } else {
                 infifo.add(bgpMessage);
@@ -308,8 +311,13 @@ RIBElement::RIBElement(bgpstream_pfx_t *inpfx) {
 }
 
 SPrefixPath RIBElement::getPath(unsigned int hash, unsigned int peer, unsigned int timestamp) {
+    SPrefixPath evicted=cache->evictedPath(hash);
+    if (evicted)
+        return cache->pathsMap.insert(hash, evicted, timestamp).second;
     Redis *_redis=cache->bgpRedis->getRedis(peer);
+    auto start=std::chrono::steady_clock::now();
     auto str = _redis->hget("PATHS", to_myencoding(hash));
+    cache->pathsMap.idFetched(std::chrono::steady_clock::now()-start);
     if (str) {
         std::unordered_map<string, string> pathMap;
         SPrefixPath path = std::make_shared<PrefixPath>(*str);
@@ -322,21 +330,53 @@ SPrefixPath RIBElement::getPath(unsigned int hash, unsigned int peer, unsigned i
 }
 
 
-bool RIBElement::getRoutingEntry(bgpstream_pfx_t *pfx,unsigned int peer){
+string RIBElement::routeKey(unsigned int peer, Peer *session){
+    return pfxStr+":"+to_myencoding(peer)+":"+to_myencoding(session->id);
+}
+
+// the route of a session is kept in routes once it was seen, only a route never updated
+// since the start is read from Redis. Redis keeps one route per peer AS, it is restored
+// into the first session of the AS updating the prefix
+bool RIBElement::getRoutingEntry(bgpstream_pfx_t *pfx,unsigned int peer, Peer *session){
     string pfxStr=to_myencodingPref(pfx);
     string peerStr= to_myencoding(peer);
     string str=pfxStr+":"+peerStr;
-    if(cache->routingBF.contains(str)){
+    unsigned int last=0;
+    bool known, claimed=false;
+    {
+        std::lock_guard<SpinLock> lock(lock_);
+        known=routes.get(session->id, last);
+        for (auto &route:routes.all()){
+            Peer *other=known ? NULL : cache->peers.at(route.id);
+            claimed |= (other != NULL) && (other->getAsn() == peer);
+        }
+    }
+    if (known){
+        if ((last == 0) || (last & WITHDRAWNROUTE))
+            return false;
+        cache->routingentries.insert(routeKey(peer, session), last);
+        return true;
+    }
+    if (!claimed && cache->routingBF.contains(str)){
         vector<string> vec, results(3);
+        auto start=std::chrono::steady_clock::now();
         unsigned int hash=std::hash<std::string>{}(str);
         Redis *_redis=cache->bgpRedis->getRedis(hash);
-        _redis->lrange("PRE:"+str,-1,-1, std::back_inserter(vec));
+        if (cache->bgpRedis->hasHistorySink()){
+            // history is in the event log, Redis only keeps the last state
+            auto last=_redis->hget("ROUTES", str);
+            if (last)
+                vec.push_back(*last);
+            else
+                // route last changed before the event log was turned on
+                _redis->lrange("PRE:"+str,0,0, std::back_inserter(vec));
+        } else
+            _redis->lrange("PRE:"+str,-1,-1, std::back_inserter(vec));
+        cache->routingentries.fetched(std::chrono::steady_clock::now()-start);
         if (vec.size()>0){
-            cache->routingentries.cacheMissed();
             boost::split(results, vec[0], [](char c){return c == ':';});
             if (results[1]=="A"){
-                auto p=cache->routingentries.insert(str,from_myencoding(results[0]));
-                cache->routingBF.insert(str);
+                auto p=cache->routingentries.insert(routeKey(peer, session),from_myencoding(results[0]));
                 return true;
             }
             return false;
@@ -347,26 +387,37 @@ bool RIBElement::getRoutingEntry(bgpstream_pfx_t *pfx,unsigned int peer){
 
 
 
-Category RIBElement::addPath(SPrefixPath prefixPath, unsigned int pathHash, unsigned int time){
+// the collector bitmap holds 64 collectors, a larger index is reported once
+static std::atomic<bool> collectorOverflow={false};
+
+// origins are checked once the route of the peer is replaced, its previous
+// origin is not taken for a second origin of the prefix
+Category RIBElement::addPath(SPrefixPath prefixPath, unsigned int pathHash, unsigned int time, Peer *session){
+    unsigned short int collector=prefixPath->collector;
+
+    if (collector<64)
+        collectorBits.fetch_or((uint64_t)1<<collector, std::memory_order_relaxed);
+    else if (!collectorOverflow.exchange(true, std::memory_order_relaxed))
+        cerr<<"Collector index "<<collector<<" does not fit the visibility bitmap, visibility is undercounted"<<endl;
+    Category category=replaceRoute(prefixPath, pathHash, time, session);
+    if (addAS(prefixPath->getDest())){
+        checkHijack(prefixPath, time);
+        cache->asCache[prefixPath->getDest()]->update(&pfx,time);
+    } else if (hijack){
+        // prefix already in conflict, every origin is checked
+        checkHijack(prefixPath, time);
+    }
+    return category;
+}
+
+Category RIBElement::replaceRoute(SPrefixPath prefixPath, unsigned int pathHash, unsigned int time, Peer *session){
     BGPEvent *event;
     unsigned int previousHash;
 //    boost::upgrade_lock<boost::shared_mutex> lock(mutex_);
     ThreadSafeScalableCache<string,unsigned int>::Accessor accessor;
-    
-    char collector=prefixPath->collector;
     unsigned int peer=prefixPath->getPeer();
-    
-    if (collectorsSet.insert(collector)){
-        //new collector
-        visibleCollectorsNum++;
-    }
-    OutageCollectors.erase(collector);
-    if (addAS(prefixPath->getDest())){
-//        checkHijack(prefixPath->dest);
-//TODO checkHijack
-        cache->asCache[prefixPath->getDest()]->update(&pfx,time);
-    }
-    string str=pfxStr+":"+to_myencoding(peer);
+
+    string str=routeKey(peer, session);
     if (cache->routingentries.find(accessor,str)){
         // the routing entry is in the cache
         // the peer has already a path!
@@ -375,7 +426,6 @@ Category RIBElement::addPath(SPrefixPath prefixPath, unsigned int pathHash, unsi
         if (previousHash !=0){
             auto p=cache->pathsMap.find(previousHash);
             if (p.first){
-                cache->pathsMap.idCacheMissed();
                 previous=p.second;
     //            if (p.second->getDest()==prefixPath->getDest()){
     //                previous=p.second;
@@ -392,13 +442,21 @@ Category RIBElement::addPath(SPrefixPath prefixPath, unsigned int pathHash, unsi
                     //addition of the new
                     previous->AADiff++;
                     *accessor=pathHash;
-                    if (prefixPath->addPrefix(time)) {
-                        BGPEvent *event = new BGPEvent(time, PATHACT);
-                        prefixPath->toRedis(event->map);
-                        event->hash=prefixPath->getPeer();
-                        cache->bgpRedis->add(event);
-                        cache->numActivePath++;
+                    setRoute(session->id, pathHash, session);
+                    if (previous->getDest() != prefixPath->getDest())
+                        originLeft(previous->getDest());
+                    if (previous->erasePrefix(time))
+                        cache->numActivePath--;
+                    cache->touchPath(previous);
+                    if (cache->stability)
+                        cache->stability->changed(this, prefixPath, previous, peer, time);
+                    if (cache->analytics){
+                        cache->analytics->routeDelta(previousHash, -1);
+                        cache->analytics->routeDelta(pathHash, 1);
                     }
+                    if (prefixPath->addPrefix(time))
+                        cache->numActivePath++;
+                    cache->touchPath(prefixPath);
                     event = new BGPEvent(time, PATHA);
                     event->map["T"]=to_string(time);
                     event->map["pathIDA"] = to_myencodingPath(prefixPath->shortPath, prefixPath->shortPathLength);
@@ -410,38 +468,53 @@ Category RIBElement::addPath(SPrefixPath prefixPath, unsigned int pathHash, unsi
                     return AADiff;
                 } else {
                     prefixPath->AADup++;
+                    cache->touchPath(prefixPath);
                     return AADup;
                 }
             }
         } else {
             //New visible peer
             visiblePeerNum++;
+            cache->numActiveRoutes++;
+            checkGlobalReturn(prefixPath->getDest(), time);
+            if (pathReannounced(prefixPath, pathHash, time, session)){
+                if (prefixPath->addPrefix(time))
+                    cache->numActivePath++;
+                cache->touchPath(prefixPath);
+                event = new BGPEvent(time, PATHA);
+                event->map["T"]=to_string(time);
+                event->map["pathIDA"] = prefixPath->str();
+                event->map["peer"] = to_myencoding(prefixPath->getPeer());
+                event->map["pfxID"] = to_myencodingPref(&pfx);
+                event->map["pathHash"]=to_myencoding(pathHash);
+                event->hash= std::hash<std::string>{}(event->map["pfxID"]+":"+ event->map["peer"]);
+                cache->bgpRedis->add(event);
+            }
+        }
+        if (cache->analytics){
+            cache->analytics->routeDelta(previousHash, -1);
+            cache->analytics->routeDelta(pathHash, 1);
         }
         *accessor=pathHash;
+        setRoute(session->id, pathHash, session);
         return None;
     } else {
         // CheckRedis
-        if (!getRoutingEntry(&pfx, peer)){
+        if (!getRoutingEntry(&pfx, peer, session)){
             //New visible peer
             visiblePeerNum++;
+            cache->numActiveRoutes++;
+            checkGlobalReturn(prefixPath->getDest(), time);
+            pathReannounced(prefixPath, pathHash, time, session);
             auto p=cache->routingentries.insert(str,pathHash);
-            cache->routingBF.insert(str);
+            cache->routingBF.insert(pfxStr+":"+to_myencoding(peer));
             if (p.first) {
-                if (prefixPath->addPrefix(time)) {
-                    BGPEvent *event = new BGPEvent(time, PATHACT);
-                    prefixPath->toRedis(event->map);
-                    event->hash=prefixPath->getPeer();
-                    cache->bgpRedis->add(event);
+                setRoute(session->id, pathHash, session);
+                if (cache->analytics)
+                    cache->analytics->routeDelta(pathHash, 1);
+                if (prefixPath->addPrefix(time))
                     cache->numActivePath++;
-                }
-                if (!cache->peersMap.find(peer).first){
-                    Peer *peerP = new Peer(peer);
-                    auto res=cache->peersMap.insert(make_pair(peer,peerP));
-                    if (!res.first){
-                        delete peerP;
-                    }
-                }
-                cache->peersMap[peer]->addPref();
+                cache->touchPath(prefixPath);
                 event = new BGPEvent(time, PATHA);
                 event->map["T"]=to_string(time);
                 event->map["pathIDA"] = prefixPath->str();
@@ -456,40 +529,45 @@ Category RIBElement::addPath(SPrefixPath prefixPath, unsigned int pathHash, unsi
         }
         cache->routingentries.find(accessor,str);
         previousHash=*accessor;
+        setRoute(session->id, previousHash, session);
     }
     return None;
 }
 
-pair<bool, Category> RIBElement::erasePath(char collector, unsigned int peer, unsigned int time){
+pair<bool, Category> RIBElement::erasePath(unsigned short int collector, unsigned int peer, unsigned int time, Peer *session){
 
     ThreadSafeScalableCache<string,unsigned int>::Accessor accessor;
     // We have to remove all paths in the peer
-    string str=pfxStr+":"+to_myencoding(peer);
+    string str=routeKey(peer, session);
     if(cache->routingentries.find(accessor,str)){
         if (*accessor ==0){
             //already withdrawn
             return make_pair(false, WWDup);
         }
         cTime = time;
+        if (cache->analytics)
+            cache->analytics->routeDelta(*accessor, -1);
+        pathWithdrawn(*accessor, peer, time, session);
         *accessor=0;
-        visiblePeerNum--;
-        if (checkGlobalOutage(time)) {
-            globalOutage= true;
+        cache->numActiveRoutes--;
+        if (checkGlobalOutage(--visiblePeerNum, time)) {
             return make_pair(true, Withdrawn);
         } else {
             return make_pair(false, Withdrawn);
         }
     } else {
-        if (!getRoutingEntry(&pfx, peer)){
+        if (!getRoutingEntry(&pfx, peer, session)){
             //Not exist or already withdrawn
             return make_pair(false, WWDup);
         } else {
             cTime = time;
             cache->routingentries.find(accessor,str);
+            if (cache->analytics)
+                cache->analytics->routeDelta(*accessor, -1);
+            pathWithdrawn(*accessor, peer, time, session);
             *accessor =0;
-            visiblePeerNum--;
-            if (checkGlobalOutage(time)) {
-                globalOutage= true;
+            cache->numActiveRoutes--;
+            if (checkGlobalOutage(--visiblePeerNum, time)) {
                 return make_pair(true, Withdrawn);
             } else {
                 return make_pair(false, Withdrawn);
@@ -499,19 +577,129 @@ pair<bool, Category> RIBElement::erasePath(char collector, unsigned int peer, un
     return make_pair(false,WWDup);
 }
 
-bool RIBElement::checkGlobalOutage(unsigned int time){
-    if (visibleCollectorsNum==0){
-        for(auto as:asSet)
-            cache->asCache[as]->withdraw(&pfx, time);
+// the prefix is down once the last counted peer withdraws, its origins lose it;
+// below zero the route was never counted (restored state), nothing is declared
+bool RIBElement::checkGlobalOutage(int visible, unsigned int time){
+    if (visible<0){
+        visiblePeerNum.fetch_add(1);
+        return false;
+    }
+    if (visible == 0){
+        vector<unsigned int> ases;
+        globalOutage = true;
+        getOrigins(ases);
+        for(auto as:ases){
+            auto p=cache->asCache.find(as);
+            if (p.first && p.second && p.second->withdraw(&pfx, time) && cache->outages)
+                cache->outages->prefixDown(as, pfxStr, afiIndex(pfx), pfxSpace(&pfx), time);
+        }
+        // the origins announcing it again are new, they are checked and get the prefix back
+        {
+            std::lock_guard<SpinLock> lock(lock_);
+            long before=origins.heapBytes();
+            origins.clear();
+            memAdd(MEMRIBTRIE, origins.heapBytes()-before);
+        }
         return true;
     } else{
         return false;
     }
 }
 
+void RIBElement::checkGlobalReturn(unsigned int origin, unsigned int time){
+    if (globalOutage.exchange(false) && cache->outages)
+        cache->outages->prefixUp(origin, pfxStr, time);
+}
+
+// the last path of the peer is kept behind WITHDRAWNROUTE to detect flaps
+void RIBElement::pathWithdrawn(unsigned int pathHash, unsigned int peer, unsigned int time, Peer *session){
+    SPrefixPath path=NULL;
+    setRoute(session->id, pathHash | WITHDRAWNROUTE, session);
+    auto p=cache->pathsMap.find(pathHash);
+    if (p.first && p.second){
+        path = p.second;
+        path->Withdraw++;
+        if (path->erasePrefix(time))
+            cache->numActivePath--;
+        cache->touchPath(path);
+        originLeft(path->getDest());
+    }
+    if (cache->stability)
+        cache->stability->withdrawn(this, path, peer, time);
+}
+
+// a peer announcing again after a withdrawal is a flap, WADup when the path is the same
+bool RIBElement::pathReannounced(SPrefixPath prefixPath, unsigned int pathHash, unsigned int time, Peer *session){
+    unsigned int last;
+    {
+        std::lock_guard<SpinLock> lock(lock_);
+        if (!routes.get(session->id, last))
+            return false;
+    }
+    if (!(last & WITHDRAWNROUTE))
+        return false;
+    prefixPath->Flap++;
+    if ((last & ~WITHDRAWNROUTE) == pathHash)
+        prefixPath->WADup++;
+    cache->touchPath(prefixPath);
+    if (cache->stability)
+        cache->stability->reannounced(this, prefixPath, session->getAsn(), time);
+    return true;
+}
+
 bool RIBElement::addAS(unsigned int asn){
-//    boost::unique_lock<boost::shared_mutex> lock(mutex_);
-    return asSet.insert(asn);
+    std::lock_guard<SpinLock> lock(lock_);
+    long before=origins.heapBytes();
+    bool added=origins.insert(asn);
+    memAdd(MEMRIBTRIE, origins.heapBytes()-before);
+    return added;
+}
+
+bool RIBElement::removeAS(unsigned int asn){
+    std::lock_guard<SpinLock> lock(lock_);
+    long before=origins.heapBytes();
+    bool removed=origins.erase(asn);
+    memAdd(MEMRIBTRIE, origins.heapBytes()-before);
+    return removed;
+}
+
+// a single origin stays while the prefix is visible, it is cleared by the outage; a route
+// whose path is not in memory may still use origin, which is then kept
+void RIBElement::originLeft(unsigned int origin){
+    vector<unsigned int> hashes;
+    {
+        std::lock_guard<SpinLock> lock(lock_);
+        if (origins.size()<2)
+            return;
+        for (auto &route:routes.all()){
+            if ((route.hash != 0) && !(route.hash & WITHDRAWNROUTE))
+                hashes.push_back(route.hash);
+        }
+    }
+    for (auto hash:hashes){
+        auto p=cache->pathsMap.find(hash);
+        if (!p.first || !p.second || (p.second->getDest() == origin))
+            return;
+    }
+    removeAS(origin);
+}
+
+// the session's route count follows the active routes of the element: a route restored
+// from Redis is counted when first updated, and only a counted route is uncounted
+void RIBElement::setRoute(unsigned int id, unsigned int hash, Peer *session){
+    unsigned int last=0;
+    bool wasActive, active=(hash != 0) && !(hash & WITHDRAWNROUTE);
+    {
+        std::lock_guard<SpinLock> lock(lock_);
+        wasActive = routes.get(id, last) && (last != 0) && !(last & WITHDRAWNROUTE);
+        routes.set(id, hash);
+    }
+    if ((session == NULL) || (active == wasActive))
+        return;
+    if (active)
+        session->addPref(afiIndex(pfx));
+    else
+        session->removePref(afiIndex(pfx));
 }
 
 string RIBElement::str(){
@@ -522,9 +710,150 @@ string RIBElement::str(){
     return pfxStr;
 }
 
+bgpstream_pfx_t *RIBElement::getPfx(){
+    return &pfx;
+}
+
+string &RIBElement::getPfxID(){
+    return pfxStr;
+}
+
+bool RIBElement::checkHijack(SPrefixPath prefixPath, unsigned int time){
+    if (cache->hijacks && cache->hijacks->check(this, prefixPath, time))
+        hijack = true;
+    return hijack;
+}
+
+void RIBElement::setHijack(bool inConflict){
+    hijack = inConflict;
+}
+
+void RIBElement::getOrigins(vector<unsigned int> &ases){
+    std::lock_guard<SpinLock> lock(lock_);
+    origins.get(ases);
+}
+
+// an active routing entry read back from Redis, its peer is only known once it is updated again
+void RIBElement::restoreRoute(){
+    visiblePeerNum++;
+    cache->numActiveRoutes++;
+}
+
+int RIBElement::getVisiblePeerNum(){
+    return visiblePeerNum;
+}
+
+int RIBElement::getVisibleCollectorNum(){
+    return __builtin_popcountll(collectorBits.load(std::memory_order_relaxed));
+}
+
+void RIBElement::getRoutes(vector<pair<unsigned int, unsigned int>> &active){
+    std::lock_guard<SpinLock> lock(lock_);
+    for (auto &route:routes.all()){
+        if ((route.hash != 0) && !(route.hash & WITHDRAWNROUTE))
+            active.push_back(make_pair(route.id, route.hash));
+    }
+}
+
 long RIBElement::size_of(){
-    long sum=0;
-    return sum;
+    std::lock_guard<SpinLock> lock(lock_);
+    return sizeof(RIBElement)+routes.heapBytes()+origins.heapBytes();
+}
+
+OriginSet::~OriginSet(){
+    memAdd(MEMRIBTRIE, -heapBytes());
+    delete overflow;
+}
+
+bool OriginSet::insert(unsigned int asn){
+    for (int i=0; i<inlineNum; i++){
+        if (inlineOrigins[i] == asn)
+            return false;
+    }
+    if (inlineNum<2){
+        inlineOrigins[inlineNum++] = asn;
+        return true;
+    }
+    if (overflow == NULL)
+        overflow = new vector<unsigned int>();
+    else if (std::find(overflow->begin(), overflow->end(), asn) != overflow->end())
+        return false;
+    overflow->push_back(asn);
+    return true;
+}
+
+bool OriginSet::erase(unsigned int asn){
+    for (int i=0; i<inlineNum; i++){
+        if (inlineOrigins[i] != asn)
+            continue;
+        // an overflow origin moves inline
+        if (overflow && !overflow->empty()){
+            inlineOrigins[i] = overflow->back();
+            overflow->pop_back();
+        } else
+            inlineOrigins[i] = inlineOrigins[--inlineNum];
+        if (overflow && overflow->empty()){
+            delete overflow;
+            overflow = NULL;
+        }
+        return true;
+    }
+    if (overflow == NULL)
+        return false;
+    auto it=std::find(overflow->begin(), overflow->end(), asn);
+    if (it == overflow->end())
+        return false;
+    overflow->erase(it);
+    if (overflow->empty()){
+        delete overflow;
+        overflow = NULL;
+    }
+    return true;
+}
+
+void OriginSet::clear(){
+    inlineNum = 0;
+    delete overflow;
+    overflow = NULL;
+}
+
+int OriginSet::size() const{
+    return inlineNum+(overflow ? overflow->size() : 0);
+}
+
+void OriginSet::get(vector<unsigned int> &origins) const{
+    origins.insert(origins.end(), inlineOrigins, inlineOrigins+inlineNum);
+    if (overflow)
+        origins.insert(origins.end(), overflow->begin(), overflow->end());
+}
+
+long OriginSet::heapBytes() const{
+    return overflow ? sizeof(vector<unsigned int>)+overflow->capacity()*sizeof(unsigned int) : 0;
+}
+
+PeerRoutes::~PeerRoutes(){
+    memAdd(MEMRIBTRIE, -heapBytes());
+}
+
+void PeerRoutes::set(unsigned int id, unsigned int hash){
+    auto it=std::lower_bound(routes.begin(), routes.end(), id,
+                             [](const Route &route, unsigned int id){return route.id<id;});
+    if ((it != routes.end()) && (it->id == id)){
+        it->hash = hash;
+        return;
+    }
+    long before=heapBytes();
+    routes.insert(it, Route{id, hash});
+    memAdd(MEMRIBTRIE, heapBytes()-before);
+}
+
+bool PeerRoutes::get(unsigned int id, unsigned int &hash) const{
+    auto it=std::lower_bound(routes.begin(), routes.end(), id,
+                             [](const Route &route, unsigned int id){return route.id<id;});
+    if ((it == routes.end()) || (it->id != id))
+        return false;
+    hash = it->hash;
+    return true;
 }
 
 
@@ -555,18 +884,67 @@ bgpstream_patricia_walk_cb_result_t pathProcess(const bgpstream_patricia_tree_t
     }*/
 }
 
-Trie::Trie(){
+// a prefix costs its node and at most one glue node
+#define TRIENODEBYTES (2*sizeof(bgpstream_patricia_node_t))
+
+Trie::Trie(MemSubsystem account): account(account){
     /* Create a Patricia Tree */
     pt = bgpstream_patricia_tree_create(NULL);
 }
 
-bool Trie::insert(bgpstream_pfx_t *pfx, void *data){
+// address space added by node on top of what its real ancestors and
+// descendants already cover, 0 if a less specific prefix is present
+long Trie::coveredSpace(bgpstream_patricia_node_t *node){
+    bgpstream_patricia_node_t *n;
+    vector<bgpstream_patricia_node_t *> stack;
+    long space;
+    for (n=node->parent; n!=NULL; n=n->parent){
+        if (n->prefix.address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN)
+            return 0;
+    }
+    space=pfxSpace(&node->prefix);
+    if (space == 0)
+        return 0;
+    if (node->l)
+        stack.push_back(node->l);
+    if (node->r)
+        stack.push_back(node->r);
+    while (!stack.empty()){
+        n=stack.back();
+        stack.pop_back();
+        if (n->prefix.address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN){
+            space -= pfxSpace(&n->prefix);
+        } else {
+            if (n->l)
+                stack.push_back(n->l);
+            if (n->r)
+                stack.push_back(n->r);
+        }
+    }
+    return space;
+}
+
+void Trie::addCovered(bgpstream_pfx_t *pfx, long space){
+    if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4)
+        covered24 += space;
+    else
+        covered48 += space;
+}
+
+bool Trie::insert(bgpstream_pfx_t *pfx, void *data, long *space){
     boost::unique_lock<boost::shared_mutex> lock(mutex_);
-    long prevCount=prefixNum();
+    long prevCount=prefixNum(), delta=0;
     bgpstream_patricia_node_t *node = bgpstream_patricia_tree_insert(pt,pfx);
     long nextCount=prefixNum();
     bgpstream_patricia_tree_set_user(pt, node, data);
-    return (nextCount == prevCount);
+    if (nextCount != prevCount){
+        delta=coveredSpace(node);
+        addCovered(pfx, delta);
+        memAdd(account, TRIENODEBYTES);
+    }
+    if (space)
+        *space = delta;
+    return (nextCount != prevCount);
 }
 
 pair<bool, void*> Trie::search(bgpstream_pfx_t *pfx){
@@ -589,26 +967,95 @@ pair<bool, void*> Trie::checkinsert(bgpstream_pfx_t *pfx){
         boost::upgrade_to_unique_lock<boost::shared_mutex> writeLock(lock);
         bgpstream_patricia_node_t *node = bgpstream_patricia_tree_insert(pt,pfx);
         bgpstream_patricia_tree_set_user(pt, node, trieElement);
+        addCovered(pfx, coveredSpace(node));
+        memAdd(account, TRIENODEBYTES+sizeof(RIBElement));
         return make_pair(true,trieElement);
     }
     return make_pair(false,bgpstream_patricia_tree_get_user(node));
 }
 
-bool Trie::remove(bgpstream_pfx_t *pfx){
+bool Trie::remove(bgpstream_pfx_t *pfx, long *space){
     boost::unique_lock<boost::shared_mutex> lock(mutex_);
     bgpstream_patricia_node_t *node;
+    long delta=0;
     if ((node=bgpstream_patricia_tree_search_exact(pt, pfx))!=NULL){
+        delta=-coveredSpace(node);
+        addCovered(pfx, delta);
         bgpstream_patricia_tree_remove_node(pt, node);
+        memAdd(account, -(long)TRIENODEBYTES);
+        if (space)
+            *space = delta;
         return true;
-    } else
+    } else {
+        if (space)
+            *space = 0;
         return false;
+    }
 }
 
 long Trie::prefixNum(){
     return bgpstream_patricia_prefix_count(pt, BGPSTREAM_ADDR_VERSION_IPV4)+bgpstream_patricia_prefix_count(pt, BGPSTREAM_ADDR_VERSION_IPV6);
 }
-long Trie::prefix24Num(){
-    return bgpstream_patricia_tree_count_24subnets(pt)+bgpstream_patricia_tree_count_64subnets(pt);
+long Trie::address24Num(){
+    return covered24;
+}
+
+long Trie::address48Num(){
+    return covered48;
+}
+
+static bgpstream_patricia_walk_cb_result_t collectPrefix(const bgpstream_patricia_tree_t *pt,const bgpstream_patricia_node_t *node, void *data){
+    vector<bgpstream_pfx_t> *pfxs=(vector<bgpstream_pfx_t> *)data;
+    if (node->prefix.address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN)
+        pfxs->push_back(node->prefix);
+    return BGPSTREAM_PATRICIA_WALK_CONTINUE;
+}
+
+void Trie::prefixes(vector<bgpstream_pfx_t> &pfxs){
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+    bgpstream_patricia_tree_walk(pt, collectPrefix, &pfxs);
+}
+
+static inline bool pfxBit(const bgpstream_pfx_t *pfx, u_int bit){
+    return (pfx->address.addr[bit>>3] & (0x80>>(bit & 0x07))) != 0;
+}
+
+// walks down the branch of pfx, only glue nodes lack a real prefix
+void Trie::covering(bgpstream_pfx_t *pfx, vector<void *> &elements){
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+    bgpstream_patricia_node_t *node=(pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4) ? pt->head4 : pt->head6;
+    while ((node != NULL) && (node->bit<=pfx->mask_len)){
+        if ((node->prefix.address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN) && pfxContains(&node->prefix, pfx))
+            elements.push_back(node->user);
+        if (node->bit == pfx->mask_len)
+            break;
+        node = pfxBit(pfx, node->bit) ? node->r : node->l;
+    }
+}
+
+void Trie::covered(bgpstream_pfx_t *pfx, vector<void *> &elements, size_t limit){
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+    bgpstream_patricia_node_t *node=(pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4) ? pt->head4 : pt->head6;
+    vector<bgpstream_patricia_node_t *> stack;
+    while ((node != NULL) && (node->bit<pfx->mask_len))
+        node = pfxBit(pfx, node->bit) ? node->r : node->l;
+    if (node == NULL)
+        return;
+    // every prefix below node shares its first node->bit bits
+    stack.push_back(node);
+    while (!stack.empty() && (elements.size()<limit)){
+        node=stack.back();
+        stack.pop_back();
+        if (node->prefix.address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN){
+            if (!pfxContains(pfx, &node->prefix))
+                return;
+            elements.push_back(node->user);
+        }
+        if (node->r)
+            stack.push_back(node->r);
+        if (node->l)
+            stack.push_back(node->l);
+    }
 }
 
 void Trie::savePrefixes(SPrefixPath prefixPath){
@@ -619,13 +1066,14 @@ void Trie::savePrefixes(SPrefixPath prefixPath){
 
 void Trie::clear(){
     boost::unique_lock<boost::shared_mutex> lock(mutex_);
+    memAdd(account, -(long)(prefixNum()*TRIENODEBYTES));
     bgpstream_patricia_tree_clear(pt);
+    covered24 = 0;
+    covered48 = 0;
 }
 
 long Trie::size_of(){
-    long sum=0;
-    bgpstream_patricia_tree_walk(pt,pathProcess, &sum);
-    return sum;
+    return prefixNum()*TRIENODEBYTES;
 }
 
 TableFlagger::TableFlagger(PriorityBlockingCollection<BGPMessage *,  PriorityContainer<BGPMessage *, BGPMessageComparer>>
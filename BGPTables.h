@@ -10,6 +10,7 @@
 #include "BlockingQueue.h"
 #include "BGPEvent.h"
 #include "bgpstream_utils_patricia.h"
+#include "BGPMemory.h"
 //#include "cache.h"
 #include <sw/redis++/redis++.h>
 #include <map>
@@ -22,37 +23,133 @@ using namespace boost;
 
 extern BGPCache *cache;
 
+class EpochGuard{
+public:
+    unsigned int epoch;
+    // time of the update, it waits for the cut of the interval before it
+    EpochGuard(unsigned int time){
+        epoch = cache->enterEpoch(time);
+    }
+    ~EpochGuard(){
+        cache->exitEpoch(epoch);
+    }
+};
+
+
+
 
+// set on the routing entry of a peer that withdrew, the rest is its last path hash
+#define WITHDRAWNROUTE 0x80000000u
+
+// one byte lock for the small per prefix structures, held for a few loads and stores
+class SpinLock{
+public:
+    void lock(){
+        while (flag.test_and_set(std::memory_order_acquire));
+    }
+    void unlock(){
+        flag.clear(std::memory_order_release);
+    }
+private:
+    std::atomic_flag flag=ATOMIC_FLAG_INIT;
+};
 
+// origin ASes of a prefix, nearly always one: two inline, the others on the heap
+class OriginSet{
+public:
+    OriginSet(){}
+    OriginSet(const OriginSet &)=delete;
+    OriginSet &operator=(const OriginSet &)=delete;
+    ~OriginSet();
+    bool insert(unsigned int asn);
+    bool erase(unsigned int asn);
+    void clear();
+    int size() const;
+    void get(vector<unsigned int> &origins) const;
+    long heapBytes() const;
+private:
+    unsigned int inlineOrigins[2];
+    unsigned char inlineNum=0;
+    vector<unsigned int> *overflow=NULL;
+};
+
+// Peer::id -> path hash of a prefix, WITHDRAWNROUTE once withdrawn, kept sorted by id
+// in one array of 8 byte entries; growth is charged to MEMRIBTRIE. Sessions of one AS
+// on several collectors have their own route, the ASN is only used for the Redis keys
+class PeerRoutes{
+public:
+    struct Route{
+        unsigned int id;
+        unsigned int hash;
+    };
+    ~PeerRoutes();
+    void set(unsigned int id, unsigned int hash);
+    // false if the session never had a route
+    bool get(unsigned int id, unsigned int &hash) const;
+    const vector<Route> &all() const{
+        return routes;
+    }
+    long heapBytes() const{
+        return routes.capacity()*sizeof(Route);
+    }
+private:
+    vector<Route> routes;
+};
 
 class RIBElement{
 protected:
 //    boost::shared_mutex mutex_;
 private:
-//    MyThreadSafeMap<char, RIBCollectorElement*> collectors;
-    MyThreadSafeSet<char> collectorsSet;
-    concurrent_unordered_map<string, unsigned int> routingEntries;
-    MyThreadSafeSet<char> OutageCollectors;
-    MyThreadSafeSet<unsigned int> asSet;
+    // guards routes and origins, read by the lookup service and checkpoints
+    mutable SpinLock lock_;
+    // bit i set once collector i saw the prefix
+    std::atomic<uint64_t> collectorBits={0};
+    PeerRoutes routes;
+    OriginSet origins;
     unsigned int cTime;
-    bool globalOutage=true;
-    int visibleCollectorsNum=0;
-    int visiblePeerNum=0;
+    // withdrawn by every peer after being visible
+    std::atomic<bool> globalOutage={false};
+    std::atomic<int> visiblePeerNum={0};
     bgpstream_pfx_t pfx;
     string pfxStr;
-    bool hijack= false;
+    // in an open conflict, set by the workers and cleared by HijackDetector::update
+    std::atomic<bool> hijack={false};
+    // decayed flap penalty, see RouteStability
+    DecayedScore instability;
+    friend class BGPCheckpoint;
+    friend class RouteStability;
+    void checkGlobalReturn(unsigned int origin, unsigned int time);
+    Category replaceRoute(SPrefixPath prefixPath, unsigned int pathHash, unsigned int time, Peer *session);
+    // forgets origin once no active route in memory originates it
+    void originLeft(unsigned int origin);
+    // session, when given, counts the route when it becomes active or stops being
+    void setRoute(unsigned int id, unsigned int hash, Peer *session=NULL);
+    void pathWithdrawn(unsigned int pathHash, unsigned int peer, unsigned int time, Peer *session);
+    bool pathReannounced(SPrefixPath prefixPath, unsigned int pathHash, unsigned int time, Peer *session);
+    // routingentries key of the session, the Redis key pfxID:peer followed by the id
+    string routeKey(unsigned int peer, Peer *session);
 public:
     RIBElement(bgpstream_pfx_t *inpfx);
-    Category addPath(SPrefixPath prefixPath, unsigned int pathHash, unsigned int time);
-    pair<bool, Category> erasePath(char collector,  unsigned int peer, unsigned int time);
+    Category addPath(SPrefixPath prefixPath, unsigned int pathHash, unsigned int time, Peer *session);
+    pair<bool, Category> erasePath(unsigned short int collector,  unsigned int peer, unsigned int time, Peer *session);
     SPrefixPath getPath(unsigned int hash, unsigned int peer, unsigned int timestamp);
-    bool getRoutingEntry(bgpstream_pfx_t *pfx,unsigned int peer);
+    bool getRoutingEntry(bgpstream_pfx_t *pfx,unsigned int peer, Peer *session);
     bool addAS(unsigned int asn);
-    bool checkGlobalOutage(unsigned int time);
+    // visible is the peer count after the withdrawal
+    bool checkGlobalOutage(int visible, unsigned int time);
     bool removeAS(unsigned int asn);
-    bool checkHijack(unsigned int ans);
+    bool checkHijack(SPrefixPath prefixPath, unsigned int time);
+    void setHijack(bool inConflict);
     long size_of();
     string str();
+    bgpstream_pfx_t *getPfx();
+    string &getPfxID();
+    void getOrigins(vector<unsigned int> &origins);
+    void restoreRoute();
+    int getVisiblePeerNum();
+    int getVisibleCollectorNum();
+    // (Peer::id, path hash) of the active routes
+    void getRoutes(vector<pair<unsigned int, unsigned int>> &routes);
 };
 
 
@@ -60,17 +157,31 @@ class BGPTable;
 class Trie{
 private:
     mutable boost::shared_mutex mutex_;
+    // non overlapping address space covered by the trie, in /24 and /48 units
+    std::atomic<long> covered24={0};
+    std::atomic<long> covered48={0};
+    // subsystem charged for the nodes and, for the RIB, the elements
+    MemSubsystem account;
+    long coveredSpace(bgpstream_patricia_node_t *node);
+    void addCovered(bgpstream_pfx_t *pfx, long space);
 public:
     bgpstream_patricia_tree_t *pt;
-    Trie();
-    bool insert(bgpstream_pfx_t *pfx, void *data);
+    Trie(MemSubsystem account=MEMASTRIES);
+    // space, when given, receives the change of covered address space
+    bool insert(bgpstream_pfx_t *pfx, void *data, long *space=NULL);
     pair<bool, void*> search(bgpstream_pfx_t *pfx);
     pair<bool, void*> checkinsert(bgpstream_pfx_t *pfx);
-    bool remove(bgpstream_pfx_t *pfx);
+    bool remove(bgpstream_pfx_t *pfx, long *space=NULL);
     void save();
     long prefixNum();
-    long prefix24Num();
+    long address24Num();
+    long address48Num();
     void savePrefixes(SPrefixPath prefixPath);
+    void prefixes(vector<bgpstream_pfx_t> &pfxs);
+    // user data of the prefixes covering pfx, least specific first
+    void covering(bgpstream_pfx_t *pfx, vector<void *> &elements);
+    // user data of the prefixes covered by pfx, at most limit of them
+    void covered(bgpstream_pfx_t *pfx, vector<void *> &elements, size_t limit);
     void clear();
     long size_of();
 };
@@ -0,0 +1,134 @@
+//
+//  BGPTrace.cpp
+//  BGPGeopol
+//
+
+#include "BGPTrace.h"
+
+PipelineTracer *tracer=NULL;
+
+// values below 128 have their own bucket, then 64 buckets per power of two up to 2^40
+#define HDRLINEAR 128
+#define HDRSUB 64
+#define HDRMAXBITS 40
+
+static const char *stageNames[TRACESTAGES]={"source", "queue", "table", "saver", "redis", "flush"};
+
+HdrHistogram::HdrHistogram(){
+    counts = new std::atomic<uint64_t>[bucketNum()];
+    for (int i=0; i<bucketNum(); i++)
+        counts[i].store(0, std::memory_order_relaxed);
+}
+
+HdrHistogram::~HdrHistogram(){
+    delete[] counts;
+}
+
+int HdrHistogram::bucketNum(){
+    return HDRLINEAR+(HDRMAXBITS-7)*HDRSUB;
+}
+
+int HdrHistogram::bucketOf(uint64_t value){
+    if (value<HDRLINEAR)
+        return value;
+    int msb=63-__builtin_clzll(value);
+    if (msb>=HDRMAXBITS)
+        return bucketNum()-1;
+    int shift=msb-6;
+    return HDRLINEAR+(shift-1)*HDRSUB+(int)((value>>shift)-HDRSUB);
+}
+
+uint64_t HdrHistogram::bucketValue(int bucket){
+    if (bucket<HDRLINEAR)
+        return bucket;
+    int shift=(bucket-HDRLINEAR)/HDRSUB+1;
+    uint64_t sub=(bucket-HDRLINEAR)%HDRSUB+HDRSUB;
+    return ((sub+1)<<shift)-1;
+}
+
+void HdrHistogram::record(uint64_t value){
+    counts[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t HdrHistogram::drain(vector<uint64_t> &out){
+    out.assign(bucketNum(), 0);
+    for (int i=0; i<bucketNum(); i++)
+        out[i] = counts[i].exchange(0, std::memory_order_relaxed);
+    return sum.exchange(0, std::memory_order_relaxed);
+}
+
+uint64_t HdrHistogram::read(vector<uint64_t> &out){
+    out.resize(bucketNum(), 0);
+    for (int i=0; i<bucketNum(); i++)
+        out[i] += counts[i].load(std::memory_order_relaxed);
+    return sum.load(std::memory_order_relaxed);
+}
+
+void HdrHistogram::summary(vector<uint64_t> &counts, uint64_t sum, json &j){
+    const double quantiles[]={0.5, 0.9, 0.99, 0.999};
+    const char *names[]={"p50", "p90", "p99", "p999"};
+    uint64_t total=0, seen=0, max=0;
+    int q=0;
+    for (size_t i=0; i<counts.size(); i++){
+        total += counts[i];
+        if (counts[i])
+            max = bucketValue(i);
+    }
+    j["count"] = total;
+    if (total == 0)
+        return;
+    j["mean"] = (double)sum/total;
+    j["max"] = max;
+    for (size_t i=0; (i<counts.size()) && (q<4); i++){
+        seen += counts[i];
+        while ((q<4) && (seen>=quantiles[q]*total)){
+            j[names[q]] = bucketValue(i);
+            q++;
+        }
+    }
+}
+
+bool PipelineTracer::sample(){
+    return (sampleEvery != 0) && (counter.fetch_add(1, std::memory_order_relaxed) % sampleEvery == 0);
+}
+
+bool PipelineTracer::sampleEvent(){
+    return (sampleEvery != 0) && (eventCounter.fetch_add(1, std::memory_order_relaxed) % sampleEvery == 0);
+}
+
+uint64_t PipelineTracer::now(){
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void PipelineTracer::record(TraceStage stage, uint64_t start, uint64_t end){
+    if ((start == 0) || (end<start))
+        return;
+    stages[stage].record(end-start);
+}
+
+const char *PipelineTracer::name(TraceStage stage){
+    return stageNames[stage];
+}
+
+void PipelineTracer::report(json &j){
+    vector<uint64_t> counts;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i=0; i<TRACESTAGES; i++){
+        uint64_t sum=stages[i].drain(counts);
+        json s;
+        HdrHistogram::summary(counts, sum, s);
+        j[stageNames[i]] = s;
+        totals[i].resize(counts.size(), 0);
+        for (size_t b=0; b<counts.size(); b++)
+            totals[i][b] += counts[b];
+        totalSums[i] += sum;
+    }
+    j["sampleEvery"] = sampleEvery;
+}
+
+uint64_t PipelineTracer::cumulative(TraceStage stage, vector<uint64_t> &counts){
+    std::lock_guard<std::mutex> lock(mutex_);
+    counts = totals[stage];
+    return totalSums[stage]+stages[stage].read(counts);
+}
@@ -0,0 +1,82 @@
+//
+//  BGPTrace.h
+//  BGPGeopol
+//
+//  Sampled per-stage latency of the pipeline. One message in sampleEvery is
+//  stamped when the source takes it from the pool, before it is queued,
+//  when a TableFlagger takes it and once RIBTable::update is done; the
+//  saver closes the trace when it consumes the message. Redis events are
+//  sampled on their own, from ShardedBGPRedis::add to the pipeline flush.
+//
+//  Stage latencies go to lock-free HDR histograms (log buckets of 64 linear
+//  sub-buckets, about 1.5% precision) read and reset once per interval.
+//
+
+#ifndef BGPGEOPOLITICS_BGPTRACE_H
+#define BGPGEOPOLITICS_BGPTRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+enum TraceStage{STAGESOURCE=0, STAGEQUEUE=1, STAGETABLE=2, STAGESAVER=3, STAGEREDIS=4, STAGEFLUSH=5, TRACESTAGES=6};
+
+// microseconds
+class HdrHistogram{
+public:
+    HdrHistogram();
+    ~HdrHistogram();
+    HdrHistogram(const HdrHistogram &)=delete;
+    HdrHistogram &operator=(const HdrHistogram &)=delete;
+    void record(uint64_t value);
+    // moves the counts to out and resets them, returns the sum of the values
+    uint64_t drain(vector<uint64_t> &out);
+    // adds the counts to out without resetting them, returns the sum of the values
+    uint64_t read(vector<uint64_t> &out);
+    static int bucketNum();
+    static int bucketOf(uint64_t value);
+    // upper bound of the values counted in bucket
+    static uint64_t bucketValue(int bucket);
+    // percentiles, count, mean and max of drained counts
+    static void summary(vector<uint64_t> &counts, uint64_t sum, json &j);
+private:
+    std::atomic<uint64_t> *counts;
+    std::atomic<uint64_t> sum={0};
+};
+
+class PipelineTracer{
+public:
+    // 0 disables the tracing
+    unsigned int sampleEvery;
+
+    PipelineTracer(unsigned int sampleEvery=1024): sampleEvery(sampleEvery){}
+    bool sample();
+    // Redis events are sampled apart, they outnumber the messages
+    bool sampleEvent();
+    static uint64_t now();
+    void record(TraceStage stage, uint64_t start, uint64_t end);
+    // drains the histograms of the interval into j, one object per stage
+    void report(json &j);
+    // counts since the start, the interval not yet reported included
+    uint64_t cumulative(TraceStage stage, vector<uint64_t> &counts);
+    static const char *name(TraceStage stage);
+
+private:
+    std::atomic<uint64_t> counter={0};
+    std::atomic<uint64_t> eventCounter={0};
+    HdrHistogram stages[TRACESTAGES];
+    // drained counts, record() does not take the mutex
+    std::mutex mutex_;
+    vector<uint64_t> totals[TRACESTAGES];
+    uint64_t totalSums[TRACESTAGES]={0};
+};
+
+extern PipelineTracer *tracer;
+
+#endif //BGPGEOPOLITICS_BGPTRACE_H
@@ -30,6 +30,8 @@
 #include <chrono>
 #include <deque>
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
 
 //namespace code_machina {
 
@@ -543,6 +545,100 @@
                 InternalError = -8
     };
 
+    /// @struct QueueMetrics
+    /// Optional counters of a BlockingCollection, see instrument(). Times
+    /// are in nanoseconds. Lock wait and hold are timed on one operation in
+    /// lockSample, producer blocked and consumer idle time on every wait.
+    struct QueueMetrics {
+        static const unsigned int lockSample = 16;
+
+        size_t capacity = 0;
+        std::atomic<size_t> depth{0};
+        std::atomic<size_t> maxDepth{0};
+        std::atomic<uint64_t> adds{0};
+        std::atomic<uint64_t> takes{0};
+        std::atomic<uint64_t> fullWaits{0};
+        std::atomic<uint64_t> emptyWaits{0};
+        std::atomic<uint64_t> producerBlocked{0};
+        std::atomic<uint64_t> consumerIdle{0};
+        std::atomic<uint64_t> lockWait{0};
+        std::atomic<uint64_t> lockHold{0};
+        std::atomic<uint64_t> ops{0};
+
+        static uint64_t now() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        void setDepth(size_t size) {
+            depth.store(size, std::memory_order_relaxed);
+            size_t max = maxDepth.load(std::memory_order_relaxed);
+            while (size > max && !maxDepth.compare_exchange_weak(max, size,
+                    std::memory_order_relaxed));
+        }
+    };
+
+    /// @class QueueTimer
+    /// Times one operation of an instrumented BlockingCollection. Does
+    /// nothing when the collection has no QueueMetrics.
+    class QueueTimer {
+    public:
+        explicit QueueTimer(QueueMetrics *metrics)
+                : metrics_(metrics),
+                  sampled_(metrics != nullptr && metrics->ops.fetch_add(1,
+                          std::memory_order_relaxed) % QueueMetrics::lockSample == 0),
+                  start_(sampled_ ? QueueMetrics::now() : 0), acquired_(0) {
+        }
+
+        bool active() {
+            return metrics_ != nullptr;
+        }
+
+        /// Called once the lock is held.
+        void locked() {
+            if (sampled_) {
+                acquired_ = QueueMetrics::now();
+                metrics_->lockWait.fetch_add(acquired_ - start_,
+                                             std::memory_order_relaxed);
+            }
+        }
+
+        /// Called after a wait on a condition variable started at start,
+        /// the wait is not counted in the lock hold time.
+        void waited(uint64_t start, bool producer) {
+            uint64_t elapsed = QueueMetrics::now() - start;
+            if (producer) {
+                metrics_->producerBlocked.fetch_add(elapsed, std::memory_order_relaxed);
+                metrics_->fullWaits.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                metrics_->consumerIdle.fetch_add(elapsed, std::memory_order_relaxed);
+                metrics_->emptyWaits.fetch_add(1, std::memory_order_relaxed);
+            }
+            if (sampled_)
+                acquired_ += elapsed;
+        }
+
+        /// Called before the lock is released, size is the new depth.
+        void done(size_t size, size_t count, bool added) {
+            if (metrics_ == nullptr)
+                return;
+            if (added)
+                metrics_->adds.fetch_add(count, std::memory_order_relaxed);
+            else
+                metrics_->takes.fetch_add(count, std::memory_order_relaxed);
+            metrics_->setDepth(size);
+            if (sampled_)
+                metrics_->lockHold.fetch_add(QueueMetrics::now() - acquired_,
+                                             std::memory_order_relaxed);
+        }
+
+    private:
+        QueueMetrics *metrics_;
+        bool sampled_;
+        uint64_t start_;
+        uint64_t acquired_;
+    };
+
     template <typename T, typename ContainerType = QueueContainer<T>,
             typename ConditionVariableGenerator = StdConditionVariableGenerator>
     class BlockingCollection {
@@ -561,7 +657,8 @@
         explicit BlockingCollection(size_t capacity)
                 : state_(BlockingCollectionState::Activated),
                   bounded_capacity_(capacity),
-                  is_adding_completed_(false) {
+                  is_adding_completed_(false),
+                  metrics_(nullptr) {
             not_empty_condition_var_.bounded_capacity(capacity);
             not_full_condition_var_.bounded_capacity(capacity);
             container_.bounded_capacity(capacity);
@@ -574,6 +671,19 @@
         ~BlockingCollection() {
         }
 
+        /// Starts updating metrics on every add and take. The metrics
+        /// are not owned by the collection and must outlive it.
+        /// @param metrics The counters to update, nullptr stops the
+        /// instrumentation.
+        void instrument(QueueMetrics *metrics) {
+            std::lock_guard<LockType> guard(lock_);
+            if (metrics != nullptr) {
+                metrics->capacity = bounded_capacity_;
+                metrics->setDepth(container_.size());
+            }
+            metrics_ = metrics;
+        }
+
         /// Gets the bounded capacity of this BlockingCollection<T> instance.
         /// @return The bounded capacity of the collection.
         size_t bounded_capacity() {
@@ -896,9 +1006,11 @@
                 const std::chrono::duration<Rep, Period>& rel_time,
                 Args&&... args) {
             {
+                QueueTimer timer(metrics_);
                 std::unique_lock<LockType> guard(lock_);
+                timer.locked();
 
-                auto status = wait_not_full_condition(guard, rel_time);
+                auto status = wait_not_full_condition(guard, rel_time, &timer);
 
                 if (BlockingCollectionStatus::Ok != status)
                     return status;
@@ -907,6 +1019,7 @@
                     return BlockingCollectionStatus::InternalError;
 
                 signal(container_.size(), false);
+                timer.done(container_.size(), 1, true);
             }
             return BlockingCollectionStatus::Ok;
         }
@@ -941,9 +1054,11 @@
         template<class Rep, class Period> BlockingCollectionStatus
         try_take(T& item, const std::chrono::duration<Rep, Period>& rel_time) {
             {
+                QueueTimer timer(metrics_);
                 std::unique_lock<LockType> guard(lock_);
+                timer.locked();
 
-                auto status = wait_not_empty_condition(guard, rel_time);
+                auto status = wait_not_empty_condition(guard, rel_time, &timer);
 
                 if (BlockingCollectionStatus::Ok != status)
                     return status;
@@ -952,6 +1067,7 @@
                     return BlockingCollectionStatus::InternalError;
 
                 signal(container_.size(), true);
+                timer.done(container_.size(), 1, false);
             }
             return BlockingCollectionStatus::Ok;
         }
@@ -1011,9 +1127,11 @@
             {
                 added = 0;
 
+                QueueTimer timer(metrics_);
                 std::unique_lock<LockType> guard(lock_);
+                timer.locked();
 
-                auto status = wait_not_full_condition(guard, rel_time);
+                auto status = wait_not_full_condition(guard, rel_time, &timer);
 
                 if (BlockingCollectionStatus::Ok != status)
                     return status;
@@ -1028,6 +1146,7 @@
                 }
 
                 signal(container_.size(), false);
+                timer.done(container_.size(), added, true);
             }
             return BlockingCollectionStatus::Ok;
         }
@@ -1085,9 +1204,11 @@
                 if (count == 0)
                     return BlockingCollectionStatus::Ok;
 
+                QueueTimer timer(metrics_);
                 std::unique_lock<LockType> guard(lock_);
+                timer.locked();
 
-                auto status = wait_not_empty_condition(guard, rel_time);
+                auto status = wait_not_empty_condition(guard, rel_time, &timer);
 
                 if (BlockingCollectionStatus::Ok != status)
                     return status;
@@ -1103,6 +1224,7 @@
                 }
 
                 signal(container_.size(), true);
+                timer.done(container_.size(), taken, false);
             }
             return BlockingCollectionStatus::Ok;
         }
@@ -1255,12 +1377,14 @@
         /// by the current thread.
         /// @param rel_time An object of type std::chrono::duration representing
         /// the maximum time to spend waiting.
+        /// @param timer The timer of the operation, charged the blocked time.
         /// @return A BlockCollectionStatus code.
         /// @see BlockingCollectionStatus
         /// @see http://en.cppreference.com/w/cpp/chrono/duration
         template<class Rep, class Period> BlockingCollectionStatus
         wait_not_full_condition(std::unique_lock<LockType>& lock,
-                                const std::chrono::duration<Rep, Period>& rel_time) {
+                                const std::chrono::duration<Rep, Period>& rel_time,
+                                QueueTimer *timer = nullptr) {
             if (state_ == BlockingCollectionState::Deactivated)
                 return BlockingCollectionStatus::NotActivated;
 
@@ -1280,13 +1404,22 @@
                     break;
                 }
 
+                uint64_t wait_start = (timer != nullptr && timer->active()) ?
+                                      QueueMetrics::now() : 0;
+                bool timed_out = false;
+
                 if (rel_time.count() < 0) {
                     not_full_condition_var_.wait(lock);
                 } else {
-                    if (not_full_condition_var_.wait_for(lock, rel_time)) {
-                        status = BlockingCollectionStatus::TimedOut;
-                        break;
-                    }
+                    timed_out = not_full_condition_var_.wait_for(lock, rel_time);
+                }
+
+                if (wait_start != 0)
+                    timer->waited(wait_start, true);
+
+                if (timed_out) {
+                    status = BlockingCollectionStatus::TimedOut;
+                    break;
                 }
 
                 // Add/TryAdd methods and CompleteAdding should not
@@ -1320,12 +1453,14 @@
         /// by the current thread.
         /// @param rel_time An object of type std::chrono::duration representing
         /// the maximum time to spend waiting.
+        /// @param timer The timer of the operation, charged the idle time.
         /// @return A BlockCollectionStatus code.
         /// @see BlockingCollectionStatus
         /// @see http://en.cppreference.com/w/cpp/chrono/duration
         template<class Rep, class Period> BlockingCollectionStatus
         wait_not_empty_condition(std::unique_lock<LockType>& lock,
-                                 const std::chrono::duration<Rep, Period>& rel_time) {
+                                 const std::chrono::duration<Rep, Period>& rel_time,
+                                 QueueTimer *timer = nullptr) {
             if (state_ == BlockingCollectionState::Deactivated)
                 return BlockingCollectionStatus::NotActivated;
 
@@ -1345,13 +1480,22 @@
                     break;
                 }
 
+                uint64_t wait_start = (timer != nullptr && timer->active()) ?
+                                      QueueMetrics::now() : 0;
+                bool timed_out = false;
+
                 if (rel_time.count() < 0) {
                     not_empty_condition_var_.wait(lock);
                 } else {
-                    if (not_empty_condition_var_.wait_for(lock, rel_time)) {
-                        status = BlockingCollectionStatus::TimedOut;
-                        break;
-                    }
+                    timed_out = not_empty_condition_var_.wait_for(lock, rel_time);
+                }
+
+                if (wait_start != 0)
+                    timer->waited(wait_start, false);
+
+                if (timed_out) {
+                    status = BlockingCollectionStatus::TimedOut;
+                    break;
                 }
 
                 if (state_ != BlockingCollectionState::Activated) {
@@ -1371,6 +1515,10 @@
             return lock_;
         }
 
+        QueueMetrics* metrics() {
+            return metrics_;
+        }
+
     private:
         BlockingCollectionState state_;
 
@@ -1384,6 +1532,8 @@
         LockType lock_;
         // The underlying Container (e.g. Queue, Stack).
         ContainerType container_;
+        // Optional instrumentation, not owned.
+        QueueMetrics* metrics_;
     };
 
     /// @class PriorityContainer
@@ -1648,10 +1798,12 @@
         try_take_prio(T& item,
                       const std::chrono::duration<Rep, Period>& rel_time) {
             {
+                QueueTimer timer(base::metrics());
                 std::unique_lock<typename ConditionVariableGenerator::lock_type>
                         guard(base::lock());
+                timer.locked();
 
-                auto status = base::wait_not_empty_condition(guard, rel_time);
+                auto status = base::wait_not_empty_condition(guard, rel_time, &timer);
 
                 if (BlockingCollectionStatus::Ok != status)
                     return status;
@@ -1660,6 +1812,7 @@
                     return BlockingCollectionStatus::InternalError;
 
                 base::signal(base::container().size(), true);
+                timer.done(base::container().size(), 1, false);
             }
             return BlockingCollectionStatus::Ok;
         }
@@ -1721,10 +1874,12 @@
                 if (count == 0)
                     return BlockingCollectionStatus::Ok;
 
+                QueueTimer timer(base::metrics());
                 std::unique_lock<typename ConditionVariableGenerator::lock_type>
                         guard(base::lock());
+                timer.locked();
 
-                auto status = base::wait_not_empty_condition(guard, rel_time);
+                auto status = base::wait_not_empty_condition(guard, rel_time, &timer);
 
                 if (BlockingCollectionStatus::Ok != status)
                     return status;
@@ -1738,6 +1893,7 @@
                     if (++taken == count)
                         break;
                 }
+                timer.done(base::container().size(), taken, false);
             }
             return BlockingCollectionStatus::Ok;
         }
@@ -4,6 +4,7 @@
 
 #ifndef BGPGEOPOLITICS_LRUCACHE_H
 #define BGPGEOPOLITICS_LRUCACHE_H
+#include <functional>
 #include <limits>
 #include <memory>
 #include <atomic>
@@ -352,9 +353,213 @@ private:
     std::shared_ptr<Storage> m_storage;
 };
 
+/**
+ * Eviction policy of a ThreadSafeLRUCache.
+ *
+ *   - LRU: evicts the least recently used item.
+ *   - TinyLFU: W-TinyLFU. New items enter a small LRU window (1% of the
+ *     capacity); when the cache is full, the oldest window item only enters
+ *     the main LRU list if a frequency sketch has seen it more often than
+ *     the main list's victim, otherwise it is evicted itself. A scan of keys
+ *     seen once, like a RIB dump, then cycles through the window without
+ *     flushing the frequently used items.
+ *   - Clock: CLOCK (second chance). A hit only sets the node's reference
+ *     bit, without taking the list mutex, so lookups never serialize on a
+ *     shard. Eviction sweeps from the oldest node, moving referenced nodes
+ *     back to the front with their bit cleared, and evicts the first
+ *     unreferenced one.
+ */
+enum class EvictionPolicy {
+    LRU,
+    TinyLFU,
+    Clock
+};
+
+/**
+ * Approximate access counts for TinyLFU: 4-bit counters, four per key,
+ * packed sixteen to a word. Counters are halved once the number of
+ * increments reaches ten times the capacity, so the counts follow the recent
+ * popularity. Increments and reads are lock-free.
+ */
+class FrequencySketch {
+public:
+    FrequencySketch()
+            : m_table(nullptr), m_additions(0), m_epoch(0) {
+        for (size_t i = 0; i < kReaderSlots; i++) {
+            m_readers[i].count[0].store(0, std::memory_order_relaxed);
+            m_readers[i].count[1].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    ~FrequencySketch() {
+        delete m_table.load();
+    }
+
+    FrequencySketch(const FrequencySketch&) = delete;
+    FrequencySketch& operator=(const FrequencySketch&) = delete;
+
+    /**
+     * Size the sketch for a cache capacity. Safe against concurrent
+     * increment(), estimate() and resize(). The replaced table is freed once
+     * the readers of the previous epoch, the only ones that can still hold
+     * it, are done. The counts start over when the number of words changes.
+     */
+    void resize(size_t maxSize) {
+        size_t words = 8;
+        while (words < maxSize / 2) {
+            words <<= 1;
+        }
+        size_t sampleSize = 10 * std::max(maxSize, (size_t)16);
+        std::lock_guard<std::mutex> lock(m_resizeMutex);
+        Table* current = m_table.load(std::memory_order_acquire);
+        if (current && current->mask == words - 1) {
+            current->sampleSize.store(sampleSize, std::memory_order_relaxed);
+            return;
+        }
+        Table* table = new Table(words, sampleSize);
+        m_additions.store(0, std::memory_order_relaxed);
+        m_table.store(table);
+        // readers entering the new epoch load the new table
+        unsigned int epoch = m_epoch.fetch_add(1);
+        for (size_t i = 0; i < kReaderSlots; i++) {
+            while (m_readers[i].count[epoch & 1].load() > 0) {
+                std::this_thread::yield();
+            }
+        }
+        delete current;
+    }
+
+    void increment(size_t hash) {
+        ReadGuard guard(*this);
+        Table* table = m_table.load();
+        if (!table) {
+            return;
+        }
+        bool added = false;
+        for (int i = 0; i < 4; i++) {
+            uint64_t h = rehash(hash, i);
+            std::atomic<uint64_t>& word = table->counters[h & table->mask];
+            int shift = (int)(h >> 60) << 2;
+            uint64_t current = word.load(std::memory_order_relaxed);
+            while (((current >> shift) & 0xf) != 0xf) {
+                if (word.compare_exchange_weak(current, current + ((uint64_t)1 << shift),
+                                               std::memory_order_relaxed)) {
+                    added = true;
+                    break;
+                }
+            }
+        }
+        if (added && m_additions.fetch_add(1, std::memory_order_relaxed) + 1 ==
+                table->sampleSize.load(std::memory_order_relaxed)) {
+            reset(table);
+        }
+    }
+
+    unsigned int estimate(size_t hash) const {
+        ReadGuard guard(*this);
+        Table* table = m_table.load();
+        if (!table) {
+            return 0;
+        }
+        unsigned int count = 0xf;
+        for (int i = 0; i < 4; i++) {
+            uint64_t h = rehash(hash, i);
+            int shift = (int)(h >> 60) << 2;
+            unsigned int c = (table->counters[h & table->mask].load(std::memory_order_relaxed) >> shift) & 0xf;
+            count = std::min(count, c);
+        }
+        return count;
+    }
+
+    size_t memoryUsage() const {
+        ReadGuard guard(*this);
+        Table* table = m_table.load();
+        return table ? (table->mask + 1) * sizeof(uint64_t) : 0;
+    }
+
+private:
+    struct Table {
+        Table(size_t words, size_t sampleSize)
+                : counters(new std::atomic<uint64_t>[words]), mask(words - 1), sampleSize(sampleSize) {
+            for (size_t i = 0; i < words; i++) {
+                counters[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        std::unique_ptr<std::atomic<uint64_t>[]> counters;
+        size_t mask;
+        std::atomic<size_t> sampleSize;
+    };
+
+    // per-epoch reader counts, spread over slots so that lookups on
+    // different threads don't share a cache line
+    static const size_t kReaderSlots = 16;
+
+    struct ReaderSlot {
+        std::atomic<long> count[2];
+        char pad[64 - 2 * sizeof(std::atomic<long>)];
+    };
+
+    /**
+     * Counts a lookup in the current epoch while it reads the table. A
+     * reader whose increment resize() missed loads the table after it was
+     * replaced, so it never touches the one being freed.
+     */
+    class ReadGuard {
+    public:
+        explicit ReadGuard(const FrequencySketch& sketch) {
+            unsigned int epoch = sketch.m_epoch.load();
+            m_count = &sketch.m_readers[readerSlot()].count[epoch & 1];
+            m_count->fetch_add(1);
+        }
+
+        ~ReadGuard() {
+            m_count->fetch_sub(1, std::memory_order_release);
+        }
+
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+    private:
+        std::atomic<long>* m_count;
+    };
+
+    static size_t readerSlot() {
+        static std::atomic<size_t> next(0);
+        static thread_local size_t slot = next.fetch_add(1, std::memory_order_relaxed) % kReaderSlots;
+        return slot;
+    }
+
+    static uint64_t rehash(size_t hash, int i) {
+        uint64_t h = (uint64_t)hash + (uint64_t)(i + 1) * 0x9e3779b97f4a7c15ULL;
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        return h ^ (h >> 31);
+    }
+
+    /**
+     * Halve every counter. Concurrent increments may be lost, which only
+     * makes the counts slightly lower.
+     */
+    void reset(Table* table) {
+        for (size_t i = 0; i <= table->mask; i++) {
+            uint64_t w = table->counters[i].load(std::memory_order_relaxed);
+            table->counters[i].store((w >> 1) & 0x7777777777777777ULL, std::memory_order_relaxed);
+        }
+        m_additions.store(table->sampleSize.load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+    }
+
+    std::atomic<Table*> m_table;
+    std::atomic<size_t> m_additions;
+    std::mutex m_resizeMutex;
+    mutable std::atomic<unsigned int> m_epoch;
+    mutable ReaderSlot m_readers[kReaderSlots];
+};
+
 /**
  * ThreadSafeLRUCache is a thread-safe hashtable with a limited size. When
- * it is full, insert() evicts the least recently used item from the cache.
+ * it is full, insert() evicts the least recently used item from the cache,
+ * or applies the TinyLFU admission when setPolicy() selected it.
  *
  * The find() operation fills a ConstAccessor object, which is a smart pointer
  * similar to TBB's const_accessor. After eviction, destruction of the value is
@@ -368,7 +573,8 @@ private:
  *
  * The acquisition of the list mutex during find() is non-blocking (try_lock),
  * so under heavy lookup load, the container will not stall, instead some LRU
- * update operations will be omitted.
+ * update operations will be omitted. Under the Clock policy find() does not
+ * touch the list at all and eviction is its only mutator.
  *
  * Insert performance was observed to degrade rapidly when there is a heavy
  * concurrent insert/evict load, mostly due to locks in the underlying
@@ -397,6 +603,10 @@ class ThreadSafeLRUCache {
         TKey m_key;
         ListNode* m_prev;
         ListNode* m_next;
+        // in the TinyLFU admission window rather than the main list
+        bool m_window = false;
+        // Clock: set by find(), cleared by the eviction sweep
+        std::atomic<bool> m_referenced{false};
 
         bool isInList() const {
             return m_prev != OutOfListMarker;
@@ -429,6 +639,11 @@ class ThreadSafeLRUCache {
     typedef std::pair<const TKey, TValue> SnapshotValue;
 
 public:
+    /**
+     * Called with each evicted element, outside of any lock.
+     */
+    typedef std::function<void(const TKey&, const TValue&)> EvictionHandler;
+
     /**
      * The proxy object for TBB::CHM::const_accessor. Provides direct access to
      * the user's value by dereferencing, thus hiding our implementation
@@ -531,7 +746,7 @@ public:
      * Get a snapshot of the keys in the container by copying them into the
      * supplied vector. This will block inserts and prevent LRU updates while it
      * completes. The keys will be inserted in order from most-recently used to
-     * least-recently used.
+     * least-recently used (most recently inserted or swept under Clock).
      */
     void snapshotKeys(std::vector<TKey>& keys);
 
@@ -543,6 +758,58 @@ public:
         return m_size.load();
     }
 
+    /**
+     * Change the maximum size, evicting least-recently used items until the
+     * container fits.
+     */
+    void setMaxSize(size_t maxSize);
+
+    size_t maxSize() const {
+        return m_maxSize.load();
+    }
+
+    /**
+     * Select the eviction policy. Must be called before the container is
+     * used; the TinyLFU sketch is sized for the current maximum size.
+     */
+    void setPolicy(EvictionPolicy policy);
+
+    EvictionPolicy policy() const {
+        return m_policy;
+    }
+
+    /**
+     * Set the function called with every evicted element, e.g. to write it
+     * back. NOT THREAD SAFE -- set it before the container is used.
+     */
+    void setEvictionHandler(EvictionHandler handler) {
+        m_onEvict = handler;
+    }
+
+    /**
+     * Bytes of the TinyLFU frequency sketch.
+     */
+    size_t sketchBytes() const {
+        return m_sketch.memoryUsage();
+    }
+
+    /**
+     * Number of elements evicted to make room or to fit a smaller maximum
+     * size.
+     */
+    size_t evictions() const {
+        return m_evictions.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Approximate bytes held per element: list node, hashtable value and the
+     * TBB::CHM node header. Heap storage owned by the key or value is not
+     * included.
+     */
+    static constexpr size_t entryBytes() {
+        return sizeof(ListNode) + sizeof(HashMapValuePair) + 4 * sizeof(void*);
+    }
+
 private:
     /**
      * Unlink a node from the list. The caller must lock the list mutex while
@@ -552,20 +819,44 @@ private:
 
     /**
      * Add a new node to the list in the most-recently used position. The caller
-     * must lock the list mutex while this is called.
+     * must lock the list mutex while this is called. Window nodes go to the
+     * front of the window list.
      */
     void pushFront(ListNode* node);
 
+    /**
+     * The node to evict under the current policy, nullptr when the container
+     * is empty. May move a window node to the main list. The caller must lock
+     * the list mutex while this is called.
+     */
+    ListNode* selectVictim();
+
+    /**
+     * TinyLFU: while the cache is filling, move the oldest window node to
+     * the main list once the window is over its share. The caller must lock
+     * the list mutex while this is called.
+     */
+    void balanceWindow();
+
+    size_t windowLimit() const {
+        return std::max((size_t)1, m_maxSize.load() / 100);
+    }
+
+    size_t keyHash(const TKey& key) const {
+        THash hashObj;
+        return hashObj.hash(key);
+    }
+
     /**
      * Evict the least-recently used item from the container. This function does
      * its own locking.
      */
     std::pair<TKey, TValue> evict();
 
-    /**m_shards[i]
+    /**
      * The maximum number of elements in the container.
      */
-    size_t m_maxSize;
+    std::atomic<size_t> m_maxSize;
 
     /**
      * This atomic variable is used to signal to all threads whether or not
@@ -574,6 +865,11 @@ private:
      */
     std::atomic<size_t> m_size;
 
+    /**
+     * Count of the elements evicted.
+     */
+    std::atomic<size_t> m_evictions;
+
     /**
      * The underlying TBB hash map.
      */
@@ -588,6 +884,19 @@ private:
     ListNode m_tail;
     typedef std::mutex ListMutex;
     ListMutex m_listMutex;
+
+    /**
+     * TinyLFU state: the admission window list, the node counts of both
+     * lists (under the list mutex) and the frequency sketch.
+     */
+    EvictionPolicy m_policy;
+    ListNode m_windowHead;
+    ListNode m_windowTail;
+    size_t m_windowSize;
+    size_t m_mainSize;
+    FrequencySketch m_sketch;
+
+    EvictionHandler m_onEvict;
 };
 
 template <class TKey, class TValue, class THash>
@@ -596,22 +905,48 @@ typename ThreadSafeLRUCache<TKey, TValue, THash>::ListNode* const
 
 template <class TKey, class TValue, class THash>
 ThreadSafeLRUCache<TKey, TValue, THash>::ThreadSafeLRUCache(size_t maxSize)
-        : m_maxSize(maxSize), m_size(0),
-          m_map(std::thread::hardware_concurrency() * 4) // it will automatically grow
+        : m_maxSize(maxSize), m_size(0), m_evictions(0),
+          m_map(std::thread::hardware_concurrency() * 4), // it will automatically grow
+          m_policy(EvictionPolicy::LRU), m_windowSize(0), m_mainSize(0)
 {
     m_head.m_prev = nullptr;
     m_head.m_next = &m_tail;
     m_tail.m_prev = &m_head;
+    m_windowHead.m_prev = nullptr;
+    m_windowHead.m_next = &m_windowTail;
+    m_windowTail.m_prev = &m_windowHead;
+}
+
+template <class TKey, class TValue, class THash>
+void ThreadSafeLRUCache<TKey, TValue, THash>::
+setPolicy(EvictionPolicy policy) {
+    m_policy = policy;
+    if (policy == EvictionPolicy::TinyLFU) {
+        m_sketch.resize(m_maxSize);
+    }
 }
 
 template <class TKey, class TValue, class THash>
 bool ThreadSafeLRUCache<TKey, TValue, THash>::
 find(ConstAccessor& ac, const TKey& key) {
     HashMapConstAccessor& hashAccessor = ac.m_hashAccessor;
+    if (m_policy == EvictionPolicy::TinyLFU) {
+        m_sketch.increment(keyHash(key));
+    }
     if (!m_map.find(hashAccessor, key)) {
         return false;
     }
 
+    if (m_policy == EvictionPolicy::Clock) {
+        // The node is not deleted while the hashtable element is held, and
+        // the bit is only written when clear so hot nodes stay in shared caches
+        ListNode* node = hashAccessor->second.m_listNode;
+        if (!node->m_referenced.load(std::memory_order_relaxed)) {
+            node->m_referenced.store(true, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
     // Acquire the lock, but don't block if it is already held
     std::unique_lock<ListMutex> lock(m_listMutex, std::try_to_lock);
     if (lock) {
@@ -632,10 +967,23 @@ template <class TKey, class TValue, class THash>
 bool ThreadSafeLRUCache<TKey, TValue, THash>::
 find(Accessor& ac, const TKey& key) {
     HashMapConstAccessor& hashAccessor = ac.m_hashAccessor;
+    if (m_policy == EvictionPolicy::TinyLFU) {
+        m_sketch.increment(keyHash(key));
+    }
     if (!m_map.find(hashAccessor, key)) {
         return false;
     }
 
+    if (m_policy == EvictionPolicy::Clock) {
+        // The node is not deleted while the hashtable element is held, and
+        // the bit is only written when clear so hot nodes stay in shared caches
+        ListNode* node = hashAccessor->second.m_listNode;
+        if (!node->m_referenced.load(std::memory_order_relaxed)) {
+            node->m_referenced.store(true, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
     // Acquire the lock, but don't block if it is already held
     std::unique_lock<ListMutex> lock(m_listMutex, std::try_to_lock);
     if (lock) {
@@ -658,6 +1006,7 @@ std::pair<bool, TValue> ThreadSafeLRUCache<TKey, TValue, THash>::
 insert(const TKey& key, const TValue& value, unsigned int hash){
      // Insert into the CHM
      ListNode* node = new ListNode(key);
+     node->m_window = (m_policy == EvictionPolicy::TinyLFU);
      HashMapAccessor hashAccessor;
      HashMapValuePair hashMapValue(key, HashMapValue(value, node));
      if (!m_map.insert(hashAccessor, hashMapValue)) {
@@ -681,6 +1030,7 @@ insert(const TKey& key, const TValue& value, unsigned int hash){
      // exist.
      std::unique_lock<ListMutex> lock(m_listMutex);
      pushFront(node);
+     balanceWindow();
      lock.unlock();
      if (!evictionDone) {
          size = m_size++;
@@ -710,6 +1060,7 @@ std::pair<bool, TValue> ThreadSafeLRUCache<TKey, TValue, THash>::
 insert(const TKey& key, const TValue& value) {
     // Insert into the CHM
     ListNode* node = new ListNode(key);
+    node->m_window = (m_policy == EvictionPolicy::TinyLFU);
     HashMapAccessor hashAccessor;
     HashMapValuePair hashMapValue(key, HashMapValue(value, node));
     if (!m_map.insert(hashAccessor, hashMapValue)) {
@@ -733,6 +1084,7 @@ insert(const TKey& key, const TValue& value) {
     // exist.
     std::unique_lock<ListMutex> lock(m_listMutex);
     pushFront(node);
+    balanceWindow();
     lock.unlock();
     if (!evictionDone) {
         size = m_size++;
@@ -768,14 +1120,45 @@ clear() {
     }
     m_head.m_next = &m_tail;
     m_tail.m_prev = &m_head;
+    node = m_windowHead.m_next;
+    while (node != &m_windowTail) {
+        next = node->m_next;
+        delete node;
+        node = next;
+    }
+    m_windowHead.m_next = &m_windowTail;
+    m_windowTail.m_prev = &m_windowHead;
+    m_windowSize = 0;
+    m_mainSize = 0;
     m_size = 0;
 }
 
+template <class TKey, class TValue, class THash>
+void ThreadSafeLRUCache<TKey, TValue, THash>::
+setMaxSize(size_t maxSize) {
+    m_maxSize = maxSize;
+    if (m_policy == EvictionPolicy::TinyLFU) {
+        // the sketch tracks as many keys as the cache holds
+        m_sketch.resize(maxSize);
+    }
+    size_t size = m_size.load();
+    while (size > maxSize) {
+        // Same exclusive right as the overfill case in insert()
+        if (m_size.compare_exchange_weak(size, size - 1)) {
+            evict();
+            size--;
+        }
+    }
+}
+
 template <class TKey, class TValue, class THash>
 void ThreadSafeLRUCache<TKey, TValue, THash>::
 snapshotKeys(std::vector<TKey>& keys) {
     keys.reserve(keys.size() + m_size.load());
     std::lock_guard<ListMutex> lock(m_listMutex);
+    for (ListNode* node = m_windowHead.m_next; node != &m_windowTail; node = node->m_next) {
+        keys.push_back(node->m_key);
+    }
     for (ListNode* node = m_head.m_next; node != &m_tail; node = node->m_next) {
         keys.push_back(node->m_key);
     }
@@ -789,24 +1172,91 @@ delink(ListNode* node) {
     prev->m_next = next;
     next->m_prev = prev;
     node->m_prev = OutOfListMarker;
+    if (node->m_window) {
+        m_windowSize--;
+    } else {
+        m_mainSize--;
+    }
 }
 
 template <class TKey, class TValue, class THash>
 inline void ThreadSafeLRUCache<TKey, TValue, THash>::
 pushFront(ListNode* node) {
-    ListNode* oldRealHead = m_head.m_next;
-    node->m_prev = &m_head;
+    ListNode* head = node->m_window ? &m_windowHead : &m_head;
+    ListNode* oldRealHead = head->m_next;
+    node->m_prev = head;
     node->m_next = oldRealHead;
     oldRealHead->m_prev = node;
-    m_head.m_next = node;
+    head->m_next = node;
+    if (node->m_window) {
+        m_windowSize++;
+    } else {
+        m_mainSize++;
+    }
+}
+
+template <class TKey, class TValue, class THash>
+void ThreadSafeLRUCache<TKey, TValue, THash>::
+balanceWindow() {
+    if (m_policy != EvictionPolicy::TinyLFU) {
+        return;
+    }
+    size_t window = windowLimit();
+    if (m_windowSize > window && m_mainSize + window < m_maxSize) {
+        ListNode* oldest = m_windowTail.m_prev;
+        delink(oldest);
+        oldest->m_window = false;
+        pushFront(oldest);
+    }
+}
+
+template <class TKey, class TValue, class THash>
+typename ThreadSafeLRUCache<TKey, TValue, THash>::ListNode*
+ThreadSafeLRUCache<TKey, TValue, THash>::
+selectVictim() {
+    ListNode* victim = (m_tail.m_prev != &m_head) ? m_tail.m_prev : nullptr;
+    if (m_policy == EvictionPolicy::Clock) {
+        // Second chance; bounded, since find() may set bits again behind the sweep
+        for (size_t scanned = 0; victim != nullptr && scanned < m_mainSize; scanned++) {
+            if (!victim->m_referenced.exchange(false, std::memory_order_relaxed)) {
+                return victim;
+            }
+            delink(victim);
+            pushFront(victim);
+            victim = m_tail.m_prev;
+        }
+        return victim;
+    }
+    if (m_policy != EvictionPolicy::TinyLFU) {
+        return victim;
+    }
+    ListNode* candidate = (m_windowTail.m_prev != &m_windowHead) ? m_windowTail.m_prev : nullptr;
+    if (candidate == nullptr) {
+        return victim;
+    }
+    if (victim == nullptr) {
+        return candidate;
+    }
+    if (m_windowSize < windowLimit()) {
+        // the window is under its share, counting the item being inserted
+        return victim;
+    }
+    // the oldest window item is admitted only if it is more popular
+    if (m_sketch.estimate(keyHash(candidate->m_key)) > m_sketch.estimate(keyHash(victim->m_key))) {
+        delink(candidate);
+        candidate->m_window = false;
+        pushFront(candidate);
+        return victim;
+    }
+    return candidate;
 }
 
 template <class TKey, class TValue, class THash>
 std::pair<TKey, TValue> ThreadSafeLRUCache<TKey, TValue, THash>::
 evict() {
     std::unique_lock<ListMutex> lock(m_listMutex);
-    ListNode* moribund = m_tail.m_prev;
-    if (moribund == &m_head) {
+    ListNode* moribund = selectVictim();
+    if (moribund == nullptr) {
         // List is empty, can't evict
         TKey key;
         TValue val;
@@ -825,6 +1275,10 @@ evict() {
     std::pair<TKey, TValue> returnValue= std::make_pair(moribund->m_key,hashAccessor->second.m_value);
     m_map.erase(hashAccessor);
     delete moribund;
+    m_evictions.fetch_add(1, std::memory_order_relaxed);
+    if (m_onEvict) {
+        m_onEvict(returnValue.first, returnValue.second);
+    }
     return returnValue;
 }
 
@@ -892,6 +1346,57 @@ public:
      */
     size_t size() const;
 
+    /**
+     * Change the maximum size, shrinking the child containers in proportion.
+     */
+    void setMaxSize(size_t maxSize);
+
+    size_t maxSize() const {
+        return m_maxSize.load();
+    }
+
+    /**
+     * Select the eviction policy of every child container, see
+     * EvictionPolicy. Must be called before the container is used.
+     */
+    void setPolicy(EvictionPolicy policy) {
+        for (auto &shard:m_shards)
+            shard->setPolicy(policy);
+    }
+
+    EvictionPolicy policy() const {
+        return m_shards.at(0)->policy();
+    }
+
+    /**
+     * Set the eviction handler of every child container. Must be called
+     * before the container is used.
+     */
+    void setEvictionHandler(typename Shard::EvictionHandler handler) {
+        for (auto &shard:m_shards)
+            shard->setEvictionHandler(handler);
+    }
+
+    /**
+     * Sum of the evictions of the child containers.
+     */
+    size_t evictions() const {
+        size_t sum = 0;
+        for (auto &shard:m_shards)
+            sum += shard->evictions();
+        return sum;
+    }
+
+    /**
+     * Approximate bytes held by the elements, see ThreadSafeLRUCache::entryBytes.
+     */
+    size_t memoryUsage() const {
+        size_t sketches = 0;
+        for (auto &shard:m_shards)
+            sketches += shard->sketchBytes();
+        return size() * Shard::entryBytes() + m_numShards * sizeof(Shard) + sketches;
+    }
+
 private:
     /**
      * Get the child container for a given key
@@ -901,7 +1406,7 @@ private:
     /**
      * The maximum number of elements in the container.
      */
-    size_t m_maxSize;
+    std::atomic<size_t> m_maxSize;
 
     /**
      * The child containers
@@ -942,7 +1447,12 @@ ThreadSafeScalableCache<TKey, TValue, THash>::
 getShard(const TKey& key) {
     THash hashObj;
     constexpr int shift = std::numeric_limits<size_t>::digits - 16;
-    size_t h = (hashObj.hash(key) >> shift) % m_numShards;
+    // The TBB hash of an integer leaves the high bits empty for small values,
+    // which would send every such key to the first shard; mix them in first
+    uint64_t mixed = (uint64_t)hashObj.hash(key);
+    mixed = (mixed ^ (mixed >> 33)) * 0xff51afd7ed558ccdULL;
+    mixed ^= mixed >> 33;
+    size_t h = ((size_t)mixed >> shift) % m_numShards;
     return *m_shards.at(h);
 }
 
@@ -988,6 +1498,19 @@ snapshotKeys(std::vector<TKey>& keys) {
     }
 }
 
+template <class TKey, class TValue, class THash>
+void ThreadSafeScalableCache<TKey, TValue, THash>::
+setMaxSize(size_t maxSize) {
+    m_maxSize = maxSize;
+    for (size_t i = 0; i < m_numShards; i++) {
+        size_t s = maxSize / m_numShards;
+        if (i == 0) {
+            s += maxSize % m_numShards;
+        }
+        m_shards[i]->setMaxSize(s);
+    }
+}
+
 template <class TKey, class TValue, class THash>
 size_t ThreadSafeScalableCache<TKey, TValue, THash>::
 size() const {
@@ -0,0 +1,56 @@
+//
+//  cacheContention.cpp
+//  BGPGeopol
+//
+//  Lookup throughput of the eviction policies from 1 to 64 threads on a
+//  full cache, as the TableFlagger workers use the path and routing caches:
+//  mostly hits, a miss being inserted. LRU and TinyLFU move a hit under the
+//  shard's list mutex, CLOCK only sets its reference bit.
+//
+//      cacheContention [capacity] [lookups per thread]
+//
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "LruCache.h"
+
+using namespace std;
+
+static const char *policyNames[]={"lru", "tinylfu", "clock"};
+
+int main(int argc, char **argv){
+    size_t capacity=(argc>1) ? stoul(argv[1]) : 1000000;
+    size_t lookups=(argc>2) ? stoul(argv[2]) : 1000000;
+    for (int p=0; p<3; p++){
+        for (int threads=1; threads<=64; threads*=2){
+            ThreadSafeScalableCache<unsigned int, unsigned int> cache(capacity, 8);
+            cache.setPolicy((EvictionPolicy)p);
+            for (unsigned int i=0; i<capacity; i++)
+                cache.insert(i, i);
+            vector<std::thread> workers;
+            std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+            for (int t=0; t<threads; t++){
+                workers.push_back(std::thread([&cache, capacity, lookups, t](){
+                    std::mt19937 rng(t);
+                    // one lookup in ten misses the working set
+                    std::uniform_int_distribution<unsigned int> keys(0, capacity+capacity/9);
+                    for (size_t i=0; i<lookups; i++){
+                        unsigned int key=keys(rng);
+                        ThreadSafeScalableCache<unsigned int, unsigned int>::ConstAccessor accessor;
+                        if (!cache.find(accessor, key))
+                            cache.insert(key, key);
+                    }
+                }));
+            }
+            for (auto &w:workers)
+                w.join();
+            std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+            cout<<policyNames[p]<<" "<<threads<<" threads: "<<threads*lookups/elapsed.count()/1e6<<" Mlookups/s"<<endl;
+        }
+    }
+    return 0;
+}
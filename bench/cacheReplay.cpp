@@ -0,0 +1,87 @@
+//
+//  cacheReplay.cpp
+//  BGPGeopol
+//
+//  Hit ratios of the eviction policies on a RIB dump followed by updates.
+//  Each trace holds one cache key per line, as the routing entries are keyed
+//  (<pfxID>:<peer>); every miss is inserted, as RIBElement does after the
+//  Redis read. Only the update lookups are counted, a dump is all cold keys.
+//  Without traces a synthetic one is used: a dump of 10x capacity distinct
+//  keys, then Zipf updates over 2x capacity keys with a dump every third.
+//
+//      cacheReplay <capacity> [<rib trace> <update trace>]
+//
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "LruCache.h"
+
+using namespace std;
+
+static const char *policyNames[]={"lru", "tinylfu", "clock"};
+
+// key and whether its lookup is counted
+typedef vector<pair<string, bool>> Trace;
+
+static void readTrace(string file, bool counted, Trace &trace){
+    std::ifstream in(file);
+    string line;
+    while (std::getline(in, line)){
+        if (!line.empty())
+            trace.push_back(make_pair(line, counted));
+    }
+}
+
+static void syntheticTrace(size_t capacity, Trace &trace){
+    std::mt19937_64 rng(42);
+    size_t working=2*capacity;
+    vector<double> weights(working);
+    for (size_t i=0; i<working; i++)
+        weights[i] = 1.0/pow(i+1, 0.9);
+    std::discrete_distribution<size_t> zipf(weights.begin(), weights.end());
+    size_t n=20*capacity;
+    for (size_t i=0; i<n; i++){
+        // a dump every third of the updates
+        if (i%(n/3) == 0){
+            for (size_t j=0; j<10*capacity; j++)
+                trace.push_back(make_pair("rib"+to_string(i)+":"+to_string(j), false));
+        }
+        trace.push_back(make_pair("upd:"+to_string(zipf(rng)), true));
+    }
+}
+
+int main(int argc, char **argv){
+    if (argc<2){
+        cout<<"cacheReplay <capacity> [<rib trace> <update trace>]"<<endl;
+        return 1;
+    }
+    size_t capacity=stoul(argv[1]);
+    Trace trace;
+    if (argc>3){
+        readTrace(argv[2], false, trace);
+        readTrace(argv[3], true, trace);
+    } else
+        syntheticTrace(capacity, trace);
+    size_t counted=0;
+    for (auto &lookup:trace)
+        counted += lookup.second;
+    cout<<trace.size()-counted<<" dump and "<<counted<<" update lookups, capacity "<<capacity<<endl;
+    for (int p=0; p<3; p++){
+        ThreadSafeScalableCache<string, unsigned int> cache(capacity, 8);
+        cache.setPolicy((EvictionPolicy)p);
+        size_t hits=0;
+        for (auto &lookup:trace){
+            ThreadSafeScalableCache<string, unsigned int>::ConstAccessor accessor;
+            if (cache.find(accessor, lookup.first))
+                hits += lookup.second;
+            else
+                cache.insert(lookup.first, 1);
+        }
+        cout<<policyNames[p]<<" hit ratio "<<(counted ? hits*1.0/counted : 0.0)<<", "<<cache.evictions()<<" evictions"<<endl;
+    }
+    return 0;
+}
@@ -12,6 +12,9 @@
 #include "cache.h"
 #include "BGPGeopolitics.h"
 #include "bgpstream_utils_patricia.h"
+#include "BGPAnalytics.h"
+#include "BGPCountry.h"
+#include "BGPCacheSizer.h"
 #include "json.hpp"
 #include <boost/algorithm/string.hpp>
 
@@ -129,66 +132,286 @@ SAS BGPCache::chkAS(unsigned int asn, unsigned int time){
 }
 
 
+// per element estimates, concurrent_unordered_map nodes carry two pointers
+long BGPCache::asCacheBytes(){
+    return asCache.size()*(sizeof(AS)+sizeof(pair<unsigned int, SAS>)+4*sizeof(void*));
+}
+
+// each link is also in the links set of its two ASes
+long BGPCache::linksBytes(){
+    return linksMap.size()*(sizeof(Link)+sizeof(pair<unsigned long, Link *>)+2*sizeof(void*)+2*(sizeof(unsigned long)+2*sizeof(void*)));
+}
+
 long BGPCache::size_of(){
-    long size1=0,size2=0,size3=0, size4=0, size5=0;
-//    size1=prefixPeersMap.size()*(4+8);//
-//    size2=pathsMap.size()*(4+8);
-//    size3=asCache.size()*(4+8);
-//    size4=pathsMap.size_of();
-//    size5=prefixPeersMap.size_of();
-    return size1+size2+size3+size4+size5;
+    return routingentries.memoryUsage()+pathsMap.idMemoryUsage()+pathsMap.strMemoryUsage()+pathsBF.memoryUsage()+
+        routingBF.memoryUsage()+asCacheBytes()+linksBytes()+memCounters[MEMPATHS]+memCounters[MEMASTRIES];
 }
 
-void BGPCache::makeGraph(BGPGraph* g, unsigned int time, unsigned int dumpDuration){
+void BGPCache::registerMemory(MemoryAccountant *memory){
+    memory->addProbe(MEMROUTING, [this](){return (long)routingentries.memoryUsage();});
+    memory->addProbe(MEMPATHID, [this](){return pathsMap.idMemoryUsage();});
+    memory->addProbe(MEMPATHSTR, [this](){return pathsMap.strMemoryUsage();});
+    memory->addProbe(MEMBLOOM, [this](){return pathsBF.memoryUsage()+routingBF.memoryUsage();});
+    memory->addProbe(MEMASCACHE, [this](){return asCacheBytes();});
+    memory->addProbe(MEMLINKS, [this](){return linksBytes();});
+    // evicted entries are reloaded from Redis, paths are freed once no route holds them
+    memory->setShrink(MEMROUTING, [this](double keep){routingentries.setMaxSize(routingentries.maxSize()*keep);});
+    // the id and string maps and the paths they hold go with one capacity, shrunk once
+    memory->setShrink({MEMPATHID, MEMPATHSTR, MEMPATHS}, [this](double keep){pathsMap.setCapacity(pathsMap.getCapacity()*keep);});
+}
+
+CacheCounters BGPCache::pathsCounters(){
+    CacheCounters c=pathsMap.idCounters();
+    c += pathsMap.strCounters();
+    c.size = pathsMap.size();
+    c.capacity = pathsMap.getCapacity();
+    return c;
+}
+
+static const char *policyNames[]={"lru", "tinylfu", "clock"};
+
+static EvictionPolicy policyOf(json &name){
+    for (int i=0; i<3; i++){
+        if (name == policyNames[i])
+            return (EvictionPolicy)i;
+    }
+    return EvictionPolicy::TinyLFU;
+}
+
+void BGPCache::setCachePolicies(string file){
+    std::ifstream in(file);
+    json j;
+    EvictionPolicy paths=EvictionPolicy::TinyLFU, routing=EvictionPolicy::TinyLFU;
+    if (in.is_open()){
+        try {
+            in>>j;
+            if (j.find("policies") != j.end()){
+                json &p=j["policies"];
+                if (p.find("paths") != p.end())
+                    paths = policyOf(p["paths"]);
+                if (p.find("routing") != p.end())
+                    routing = policyOf(p["routing"]);
+            }
+        } catch (json::exception &e){
+            cout<<"Bad cache policies in "<<file<<":"<<e.what()<<endl;
+        }
+    }
+    pathsMap.setPolicy(paths);
+    routingentries.setPolicy(routing);
+    cout<<"Cache policies: paths "<<policyNames[(int)paths]<<", routing "<<policyNames[(int)routing]<<endl;
+}
+
+void BGPCache::registerCaches(CacheSizer *sizer, MemoryAccountant *memory){
+    vector<MemSubsystem> paths={MEMPATHID, MEMPATHSTR, MEMPATHS};
+    long pathsBudget=0;
+    for (auto subsystem:paths)
+        pathsBudget += memory->budget(subsystem);
+    sizer->add("paths", [this](){return pathsCounters();}, [this](size_t capacity){pathsMap.setCapacity(capacity);},
+               50000, 20000000, pathsBudget);
+    sizer->add("routing", [this](){return routingentries.counters();}, [this](size_t capacity){routingentries.setMaxSize(capacity);},
+               1000000, 200000000, memory->budget(MEMROUTING));
+    memory->setShrink(paths, nullptr);
+    memory->setShrink(MEMROUTING, nullptr);
+}
+
+// The first update after the open interval takes its cut: the other workers are
+// held while the state of the interval is copied, the updates after it are then
+// applied. A late update of a closed interval counts in the open one.
+unsigned int BGPCache::enterEpoch(unsigned int time){
+    unsigned int e, end;
+    while (((end=intervalEnd) != 0) && (time>end)){
+        std::lock_guard<std::mutex> lock(cutMutex);
+        if (time<=intervalEnd)
+            break;
+        pauseWorkers();
+        cuts.push_back(takeCut(intervalEnd));
+        if (onCut)
+            onCut(cuts.back()->end);
+        intervalEnd = (time/intervalDuration)*intervalDuration+intervalDuration-1;
+        resumeWorkers();
+    }
+    while (true){
+        if (paused>0){
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        e = epoch;
+        epochWorkers[e&1]++;
+        if ((epoch == e) && (paused == 0))
+            return e;
+        epochWorkers[e&1]--;
+    }
+}
+
+void BGPCache::exitEpoch(unsigned int e){
+    epochWorkers[e&1]--;
+}
+
+// blocks new RIB updates and waits for the running ones, used for cuts and checkpoints
+void BGPCache::pauseWorkers(){
+    paused++;
+    while ((epochWorkers[0]>0) || (epochWorkers[1]>0))
+        std::this_thread::yield();
+}
+
+void BGPCache::resumeWorkers(){
+    paused--;
+}
+
+void BGPCache::startIntervals(unsigned int end, unsigned int duration){
+    intervalDuration = duration;
+    intervalEnd = end;
+}
+
+// Only the objects touched in the interval are copied: the Redis records, and
+// the vertex and edge properties the graph is then given by applyCut. Paths
+// written already on eviction are skipped.
+IntervalCut *BGPCache::takeCut(unsigned int end){
+    unsigned int e=epoch++;
+    int numShards=bgpRedis->getNumShards();
+    IntervalCut *cut=new IntervalCut();
     Link *link;
-    unsigned long linkID;
     SPrefixPath path;
-    string dumpath=ppath;
-    BGPEvent *event;
     AS *as;
-    std::chrono::high_resolution_clock::time_point start=std::chrono::high_resolution_clock::now(),end;
-    bgpg=g;
-//    g->clear();
-    while (touchedASes.try_pop(as)){
-        if (as->hasLinks()){
-            if (as->isObserved()){
-                as->checkVertex(bgpg);
-            }
-        } else {
-            as->removeVertex(bgpg);
+
+    cut->end = end;
+    cut->batches.resize(numShards);
+    for (int i=0; i<numShards; i++)
+        cut->batches[i] = new BGPBatchEvent(end, i);
+    while (touchedASes[e&1].try_pop(as)){
+        // an AS without links leaves the graph, one never observed is not added
+        bool keep=as->hasLinks();
+        if (!keep || as->isObserved())
+            cut->vertices.push_back(IntervalCut::Vertex{as, keep, keep ? as->vertexProps() : VertexP()});
+        cut->batches[as->getNum() % numShards]->ases.push_back(make_pair(to_myencoding(as->getNum()), as->toRedisStr()));
+    }
+    while (touchedLinks[e&1].try_pop(link)){
+        IntervalCut::Edge edge{link, link->isActive()};
+        if (edge.active){
+            edge.src = link->getSrcAS()->vertexProps();
+            edge.dst = link->getDstAS()->vertexProps();
+            edge.props = link->edgeProps();
         }
-        as->untouch();
-        event = new BGPEvent(time, ASUPD);
-        as->toMap(event->map);
-        event->hash= as->getNum();
-        cache->bgpRedis->add(event);
+        cut->edges.push_back(edge);
+        cut->batches[std::hash<std::string>{}(link->str()) % numShards]->links.push_back(make_pair(link->linkStr(), link->toRedisStr()));
     }
-    while (touchedLinks.try_pop(link)){
-        linkID=link->linkID();
-        if (link->isActive()) {
-            link->checkEdge(bgpg);
-        } else {
-            link->removeEdge(bgpg);
+    while (touchedPaths[e&1].try_pop(path)){
+        // written already, on eviction or from a duplicate touch
+        if (path->touchEpoch.exchange(0) == 0)
+            continue;
+        std::unordered_map<std::string, std::string> pathMap;
+        path->toRedis(pathMap);
+        BGPBatchEvent *batch=cut->batches[path->getPeer() % numShards];
+        batch->paths.push_back(make_pair(pathMap["HSH"], pathMap["STR"]));
+        if (path->active)
+            batch->activePaths.push_back(pathMap["HSH"]);
+        else
+            batch->inactivePaths.push_back(pathMap["HSH"]);
+        pathWrites++;
+    }
+    return cut;
+}
+
+void BGPCache::applyCut(BGPGraph *g, IntervalCut *cut){
+    for (auto &v:cut->vertices){
+        if (countryGraph)
+            v.as->refreshCountry();
+        if (v.keep)
+            v.as->setVertex(g, v.props);
+        else
+            v.as->removeVertex(g);
+    }
+    for (auto &edge:cut->edges){
+        if (edge.active)
+            edge.link->setEdge(g, edge.src, edge.dst, edge.props);
+        else
+            edge.link->removeEdge(g);
+        if (analytics)
+            analytics->linkChanged(edge.link->linkID(), edge.active);
+    }
+    for (auto batch:cut->batches){
+        if (batch->ases.empty() && batch->links.empty() && batch->paths.empty())
+            delete batch;
+        else
+            bgpRedis->add(batch);
+    }
+    delete cut;
+}
+
+// The graph and the Redis records are the state at the end of each interval (an
+// exact cut), whatever the workers applied since. An interval ended without an
+// update after it, at the end of the data, is cut here.
+void BGPCache::makeGraph(BGPGraph* g, unsigned int time, unsigned int dumpDuration){
+    unsigned int end=time+dumpDuration-1;
+    vector<IntervalCut *> ready;
+    bgpg=g;
+    {
+        std::lock_guard<std::mutex> lock(cutMutex);
+        while (!cuts.empty() && (cuts.front()->end<=end)){
+            ready.push_back(cuts.front());
+            cuts.pop_front();
+        }
+        if (ready.empty()){
+            pauseWorkers();
+            ready.push_back(takeCut(end));
+            resumeWorkers();
         }
-        link->unTouch();
-        event = new BGPEvent(time, LNKUPD);
-        link->toRedis(event->map);
-        event->hash= std::hash<std::string>{}(link->str());
-        cache->bgpRedis->add(event);
     }
+    for (auto cut:ready)
+        applyCut(g, cut);
+}
+
+void BGPCache::touchPath(const SPrefixPath &path){
+    unsigned int e=epoch;
+    pathChanges++;
+    if (path->touchEpoch.exchange(e+1) != e+1)
+        touchedPaths[e&1].push(path);
+}
+
+void BGPCache::pathEvicted(const SPrefixPath &path){
+    if (path->touchEpoch.exchange(0) == 0)
+        return;
+    BGPEvent *event = new BGPEvent(path->lastChange, PTHUPD);
+    path->toRedis(event->map);
+    event->map["pathHash"]=event->map["HSH"];
+    event->map["ACT"]=path->active ? "T" : "F";
+    event->hash=path->getPeer();
+    {
+        tbb::concurrent_hash_map<unsigned int, pair<SPrefixPath, int>>::accessor accessor;
+        evictedPaths.insert(accessor, path->hash);
+        accessor->second.first = path;
+        accessor->second.second++;
+    }
+    bgpRedis->add(event);
+    pathWrites++;
 }
 
-PrefixPath::PrefixPath(){
+SPrefixPath BGPCache::evictedPath(unsigned int hash){
+    tbb::concurrent_hash_map<unsigned int, pair<SPrefixPath, int>>::const_accessor accessor;
+    if (evictedPaths.find(accessor, hash))
+        return accessor->second.first;
+    return NULL;
+}
 
+// the last pending write of the path drops it, Redis now holds its state
+void BGPCache::pathWritten(unsigned int hash){
+    tbb::concurrent_hash_map<unsigned int, pair<SPrefixPath, int>>::accessor accessor;
+    if (evictedPaths.find(accessor, hash) && (--accessor->second.second <= 0))
+        evictedPaths.erase(accessor);
+}
+
+PrefixPath::PrefixPath(){
+    memAdd(MEMPATHS, sizeof(PrefixPath));
 }
 
 PrefixPath::PrefixPath(BGPMessage *bgpMessage, unsigned int time){
     int i =0;
     
+    memAdd(MEMPATHS, sizeof(PrefixPath));
     collector =cache->collectors.find(bgpMessage->collector)->second;
     shortPathLength = bgpMessage->shortPath.size();
     if (bgpMessage->type != BGPSTREAM_ELEM_TYPE_WITHDRAWAL){
-        shortPath = new unsigned int[shortPathLength];
+        allocPath(shortPathLength);
     }
     i=0;
     for (auto as1:bgpMessage->shortPath){
@@ -202,14 +425,15 @@ PrefixPath::PrefixPath(BGPMessage *bgpMessage, unsigned int time){
 }
 
 PrefixPath::PrefixPath(vector<unsigned int> &pathVect){
-    shortPathLength = pathVect.size();
-    shortPath = new unsigned int(shortPathLength);
+    memAdd(MEMPATHS, sizeof(PrefixPath));
+    allocPath(pathVect.size());
     memcpy(shortPath,&pathVect[0],sizeof(int)*shortPathLength);
 }
 
 
 
 PrefixPath::PrefixPath(string str){
+    memAdd(MEMPATHS, sizeof(PrefixPath));
     fromRedis(str);
     for(int i=0;i<shortPathLength;i++){
         cache->chkAS(shortPath[i],lastActive);
@@ -222,15 +446,29 @@ void PrefixPath::update(string str){
 }
 
 PrefixPath::~PrefixPath(){
-    if (shortPath)
-        delete shortPath;
+    memAdd(MEMPATHS, -(long)sizeof(PrefixPath));
+    if (shortPath){
+        memAdd(MEMPATHS, -(long)(shortPathLength*sizeof(unsigned int)));
+        delete[] shortPath;
+    }
+}
+
+void PrefixPath::allocPath(int length){
+    if (shortPath){
+        memAdd(MEMPATHS, -(long)(shortPathLength*sizeof(unsigned int)));
+        delete[] shortPath;
+    }
+    shortPathLength = length;
+    shortPath = new unsigned int[length];
+    memAdd(MEMPATHS, length*sizeof(unsigned int));
 }
 
 
 int PrefixPath::size_of(){
 //    boost::shared_lock<boost::shared_mutex> lock(mutex_);
-    int size=9*4+4+2;;
-    size +=shortPathLength*4;
+    int size=sizeof(PrefixPath);
+    if (shortPath)
+        size +=shortPathLength*sizeof(unsigned int);
     return size;
 }
 
@@ -267,23 +505,28 @@ unsigned int PrefixPath::getDest() const{
 bool PrefixPath::addPrefix(unsigned int time){
     sem.acquire();
     bool success=false;
-    lastChange = time;
     if (prefNum==0){
         prefNum++;
         active = true;
         setPathActive(time);
+        // lastChange still holds the time the path went inactive
         meanDown = coeff*meanDown+(1-coeff)*(time-lastChange);
         lastActive = time;
         success = true;
     } else {
         prefNum++;
     }
+    lastChange = time;
     sem.release();
     return success;
 }
 
 bool PrefixPath::erasePrefix(unsigned int time){
     sem.acquire();
+    if (prefNum==0){
+        sem.release();
+        return false;
+    }
     prefNum--;
     lastChange = time;
     if (prefNum==0){
@@ -291,10 +534,6 @@ bool PrefixPath::erasePrefix(unsigned int time){
         setPathNonActive(time);
         meanUp = coeff*meanUp+(1-coeff)*(time-lastActive);
         sem.release();
-        BGPEvent *event = new BGPEvent(time, PATHNACT);
-        toRedis(event->map);
-        event->hash=getPeer();
-        cache->bgpRedis->add(event);
         return true;
     }
     sem.release();
@@ -309,11 +548,11 @@ bool PrefixPath::checkPrefix(bgpstream_pfx_t *pfx){
 
 bool PrefixPath::equal(SPrefixPath path) const{
 //    boost::shared_lock<boost::shared_mutex> lock(mutex_);
-    if (path->shortPathLength == shortPathLength){
-        for (int i=0; i<shortPathLength;i++){
-            if (path->shortPath[i]!=shortPath[i]){
-                return false;
-            }
+    if (path->shortPathLength != shortPathLength)
+        return false;
+    for (int i=0; i<shortPathLength;i++){
+        if (path->shortPath[i]!=shortPath[i]){
+            return false;
         }
     }
     return true;
@@ -403,6 +642,16 @@ void PrefixPath::setPathNonActive( unsigned int time){
     }
 }
 
+// means are kept in 1/10000 s, clamped to the encoding range
+static unsigned int encodeMean(double mean){
+    double scaled=mean*10000.0;
+    if (scaled<=0)
+        return 0;
+    if (scaled>=(double)std::numeric_limits<unsigned int>::max())
+        return std::numeric_limits<unsigned int>::max();
+    return (unsigned int)scaled;
+}
+
 void PrefixPath::toRedis(std::unordered_map<std::string, std::string> &map){
     string str="";
     str +=to_myencoding(hash)+":";
@@ -430,10 +679,10 @@ void PrefixPath::toRedis(std::unordered_map<std::string, std::string> &map){
     //map["FLP"]=to_myencoding(Flap);
     str +=to_myencoding(Withdraw)+":";
     //map["WTH"]=to_myencoding(Withdraw);
-    str +=to_myencoding((int)meanUp*10000)+":";
-    //map["MUP"]=to_myencoding((int)meanUp*10000);
-    str +=to_myencoding((int)meanDown*10000)+":";
-    //map["MDW"]=to_myencoding((int)meanDown*10000);
+    str +=to_myencoding(encodeMean(meanUp))+":";
+    //map["MUP"]=to_myencoding(encodeMean(meanUp));
+    str +=to_myencoding(encodeMean(meanDown))+":";
+    //map["MDW"]=to_myencoding(encodeMean(meanDown));
     str +=to_myencoding(collector)+":";
     //map["CLT"]=string(1,collector);
     if (active){
@@ -456,8 +705,7 @@ void PrefixPath::fromRedis(string str){
     int i=0;
     hash = from_myencoding(results[i++]);
     from_myencodingPath(results[i++], pathVect);
-    shortPathLength = pathVect.size();
-    shortPath = new unsigned int[shortPathLength];
+    allocPath(pathVect.size());
     memcpy(shortPath,&pathVect[0],sizeof(unsigned int)*shortPathLength);
     pathLength = from_myencoding(results[i++]);
     prefNum = from_myencoding(results[i++]);
@@ -470,8 +718,8 @@ void PrefixPath::fromRedis(string str){
     WWDup = from_myencoding(results[i++]);
     Flap = from_myencoding(results[i++]);
     Withdraw= from_myencoding(results[i++]);
-    meanUp= from_myencoding(results[i++])/10000;
-    meanDown = from_myencoding(results[i++])/10000;
+    meanUp= from_myencoding(results[i++])/10000.0;
+    meanDown = from_myencoding(results[i++])/10000.0;
     collector= from_myencoding(results[i++]);
     if (results[i++] == "T")
         active = true;
@@ -526,6 +774,14 @@ int AS::getStatus(){
     return status;
 }
 
+void AS::setStatus(int flags, bool on){
+    boost::unique_lock<boost::shared_mutex> lock(mutex_);
+    if (on)
+        status |= flags;
+    else
+        status &= ~flags;
+}
+
 void AS::updateJSON(json &j){
     try{
         if ((j["status"] !="error") && j["data"]["description_short"]!="Unallocated"){
@@ -642,18 +898,17 @@ bool AS::isObserved(){
 }
 
 void AS::touch(){
-    if (!touched){
-        cache->touchedASes.push(this);
-    }
-    touched = true;
+    unsigned int e=cache->epoch;
+    if (touchEpoch.exchange(e+1) != e+1)
+        cache->touchedASes[e&1].push(this);
 }
 
 void AS::untouch(){
-    touched = false;
+    touchEpoch = 0;
 }
 
 bool AS::isTouched(){
-    return touched;
+    return touchEpoch == cache->epoch+1;
 }
 
 bool AS::checkOutage(){
@@ -676,26 +931,71 @@ string AS::getName(){
     return name;
 }
 
+string AS::getCountry(){
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+    return country;
+}
+
+short AS::getCountryIdx(){
+    if (countryIdx == -1){
+        boost::unique_lock<boost::shared_mutex> lock(mutex_);
+        checkCountry();
+    }
+    return countryIdx;
+}
+
+void AS::refreshCountry(){
+    boost::unique_lock<boost::shared_mutex> lock(mutex_);
+    checkCountry();
+}
+
+// must be called with mutex_ held, moves the AS contribution if its country changed
+void AS::checkCountry(){
+    if (cache->countryGraph == NULL)
+        return;
+    short idx=cache->countryGraph->index(country);
+    if (idx != countryIdx){
+        long active=activePrefixTrie->prefixNum(), inactive=inactivePrefixTrie->prefixNum();
+        long activeAddr=activePrefixTrie->address24Num(), inactiveAddr=inactivePrefixTrie->address24Num();
+        long activeAddr6=activePrefixTrie->address48Num(), inactiveAddr6=inactivePrefixTrie->address48Num();
+        if (countryIdx != -1){
+            cache->countryGraph->addPrefix(countryIdx, 0, -active, -inactive, -activeAddr, -inactiveAddr);
+            cache->countryGraph->addPrefix(countryIdx, 1, 0, 0, -activeAddr6, -inactiveAddr6);
+        }
+        cache->countryGraph->addPrefix(idx, 0, active, inactive, activeAddr, inactiveAddr);
+        cache->countryGraph->addPrefix(idx, 1, 0, 0, activeAddr6, inactiveAddr6);
+        countryIdx = idx;
+    }
+}
+
 unsigned int AS::getNum(){
     return asNum;
 }
 
 int AS::size_of(){
-    int size =4+4*8+4*4+1;
-    size += name.length();
-    size += country.length();
-    size += RIR.length();
+    int size =sizeof(AS);
+    size += name.capacity();
+    size += country.capacity();
+    size += RIR.capacity();
+    size += links.size()*(sizeof(unsigned long)+2*sizeof(void*));
     //        for(auto it=activePrefixMap.begin();it!=activePrefixMap.end();it++)
     //size += activePrefixMap.size()*(4+8);vert
     return size;
 }
 
-boost::graph_traits<Graph>::vertex_descriptor AS::checkVertex(BGPGraph *bgpg){
+VertexP AS::vertexProps(){
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+    return VertexP{to_string(asNum), country, name, cTime, (int)activePrefixTrie->prefixNum(), (int)(activePrefixTrie->prefixNum()+inactivePrefixTrie->prefixNum()),
+        activePrefixTrie->address24Num(), activePrefixTrie->address24Num()+inactivePrefixTrie->address24Num(),
+        activePrefixTrie->address48Num(), activePrefixTrie->address48Num()+inactivePrefixTrie->address48Num(), (int)activePathsNum };
+}
+
+boost::graph_traits<Graph>::vertex_descriptor AS::setVertex(BGPGraph *bgpg, const VertexP &props){
     boost::unique_lock<boost::shared_mutex> lock(mutex_);
     if (vertex==-1){
-        vertex = bgpg->add_vertex(VertexP{to_string(asNum), country, name, cTime, (int)activePrefixTrie->prefixNum(), (int)activePrefixTrie->prefixNum(),(int)activePrefixTrie->prefix24Num(), (int)activePrefixTrie->prefix24Num(), (int)activePathsNum });
+        vertex = bgpg->add_vertex(props);
     } else {
-        bgpg->set_vertex(vertex, VertexP{to_string(asNum), country, name, cTime, (int)activePrefixTrie->prefixNum(), (int)activePrefixTrie->prefixNum(),(int)activePrefixTrie->prefix24Num(), (int)activePrefixTrie->prefix24Num(), (int)activePathsNum });
+        bgpg->set_vertex(vertex, props);
     }
     return vertex;
 }
@@ -714,9 +1014,18 @@ bool AS::update(bgpstream_pfx_t *pfx, unsigned int time){
     if (outage)
         outage = false;
     setObserved();
-    if (activePrefixTrie->insert(pfx,NULL)){
+    long space, addrInactive;
+    if (activePrefixTrie->insert(pfx,NULL,&space)){
+        long prefixInactive=0;
         touch();
-        inactivePrefixTrie->remove(pfx);
+        if (inactivePrefixTrie->remove(pfx,&addrInactive))
+            prefixInactive = -1;
+        if (cache->countryGraph){
+            if (countryIdx == -1)
+                checkCountry();
+            else
+                cache->countryGraph->addPrefix(countryIdx, afiIndex(*pfx), 1, prefixInactive, space, addrInactive);
+        }
         BGPEvent *event = new BGPEvent(time, ASPREFA);
         event->map["asNum"] = to_myencoding(asNum);
         event->map["pfxID"] = to_myencodingPref(pfx);
@@ -730,11 +1039,21 @@ bool AS::update(bgpstream_pfx_t *pfx, unsigned int time){
 }
 
 
+// true if pfx was active for the AS
 bool AS::withdraw(bgpstream_pfx_t *pfx, unsigned int time){
    BGPEvent *event;
     boost::unique_lock<boost::shared_mutex> lock(mutex_);
-    if( activePrefixTrie->remove(pfx)) {
-        inactivePrefixTrie->insert(pfx,NULL);
+    long space, addrInactive;
+    if( activePrefixTrie->remove(pfx,&space)) {
+        long prefixInactive=0;
+        if (inactivePrefixTrie->insert(pfx,NULL,&addrInactive))
+            prefixInactive = 1;
+        if (cache->countryGraph){
+            if (countryIdx == -1)
+                checkCountry();
+            else
+                cache->countryGraph->addPrefix(countryIdx, afiIndex(*pfx), -1, prefixInactive, space, addrInactive);
+        }
         event = new BGPEvent(time, ASPREFW);
         event->map["asNum"] = to_myencoding(asNum);
         event->map["pfxID"] = to_myencodingPref(pfx);
@@ -747,14 +1066,42 @@ bool AS::withdraw(bgpstream_pfx_t *pfx, unsigned int time){
             event->map["asNum"]=to_myencoding(asNum);
             event->hash= asNum;
             cache->bgpRedis->add(event);
-            return true;
         }
+        return true;
     }
     return false;
 }
 
+void AS::activeCounts(long &prefixes, long space[2]){
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+    prefixes = activePrefixTrie->prefixNum();
+    space[0] = activePrefixTrie->address24Num();
+    space[1] = activePrefixTrie->address48Num();
+}
 
 
+
+void AS::getActivePrefixes(vector<bgpstream_pfx_t> &pfxs){
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+    activePrefixTrie->prefixes(pfxs);
+}
+
+// checkpoint restore: same accounting as update() without the Redis events
+void AS::restorePrefix(bgpstream_pfx_t *pfx){
+    boost::unique_lock<boost::shared_mutex> lock(mutex_);
+    long space;
+    setObserved();
+    if (activePrefixTrie->insert(pfx,NULL,&space)){
+        touch();
+        if (cache->countryGraph){
+            if (countryIdx == -1)
+                checkCountry();
+            else
+                cache->countryGraph->addPrefix(countryIdx, afiIndex(*pfx), 1, 0, space, 0);
+        }
+    }
+}
+
 void AS::addLink(unsigned long linkHash, unsigned int time){
     if (links.insert(linkHash)){
         touch();
@@ -763,7 +1110,6 @@ void AS::addLink(unsigned long linkHash, unsigned int time){
     }
     if (time !=0)
         cTime = time;
-    touched = true;
 }
 
 void AS::removeLink(unsigned long linkHash, unsigned int time){
@@ -812,8 +1158,12 @@ bool AS::hasLinks(){
 }
 
 void AS::toMap(std::unordered_map<std::string, std::string> &map){
-    string str;
     map["ASN"] =to_myencoding(asNum);
+    map["STR"]=toRedisStr();
+}
+
+string AS::toRedisStr(){
+    string str;
 //    map["NAM"]= name;
 
     vector<string> results;
@@ -863,7 +1213,7 @@ void AS::toMap(std::unordered_map<std::string, std::string> &map){
     }
     //map["STA"]=to_myencoding(status);
     str +=to_myencoding(status);
-    map["STR"]=str;
+    return str;
 }
 
 void AS::fromRedis(string str){
@@ -926,6 +1276,15 @@ Link::Link(std::unordered_map<std::string, std::string> lMap){
 }
 
 void Link::toRedis(std::unordered_map<std::string, std::string> &lMap){
+    lMap["LID"]=linkStr();
+    lMap["STR"]=toRedisStr();
+}
+
+string Link::linkStr(){
+    return to_myencoding(src)+':'+to_myencoding(dst);
+}
+
+string Link::toRedisStr(){
     string str="";
     str +=to_myencoding(src)+":";
     //lMap["src"]=to_myencoding(src);
@@ -944,8 +1303,7 @@ void Link::toRedis(std::unordered_map<std::string, std::string> &lMap){
     }
     str +=to_myencoding(pathNum);
 //    lMap["PNU"]=to_myencoding(pathNum);
-    lMap["LID"]=to_myencoding(src)+':'+to_myencoding(dst);
-    lMap["STR"]=str;
+    return str;
 }
 
 void Link::fromRedis(string str){
@@ -985,42 +1343,64 @@ string Link::str(){
     return to_string(src)+"|"+to_string(dst);
 }
 int Link::size_of(){
-    int size =14;
+    int size =sizeof(Link);
 //    size += activePathsMap.size()*(4+8);
     return size;
 }
 
 void Link::addPath(unsigned int time){
+    int linkDelta=0;
     sem.acquire();
     touch();
+    checkCountry();
     pathNum++;
     cTime = time;
     if (!active){
         active = true;
+        linkDelta = 1;
         addLinks(time);
-        sem.release();
     }
+    if ((srcCountry != -1) && (dstCountry != -1))
+        cache->countryGraph->addPaths(srcCountry, dstCountry, 1, linkDelta);
     sem.release();
 }
 
 void Link::withdraw(unsigned int time){
+    int linkDelta=0;
     sem.acquire();
     touch();
+    checkCountry();
     pathNum--;
     if (pathNum==0){
         if (active){
             active = false;
+            linkDelta = -1;
             removeLinks(time);
             BGPEvent *event = new BGPEvent(time, LINKDROP);
             event->map["LID"]= to_myencoding(src)+":"+to_myencoding(dst);
             event->hash= std::hash<std::string>{}(event->map["LID"]);
             cache->bgpRedis->add(event);
-            sem.release();
         }
     }
+    if ((srcCountry != -1) && (dstCountry != -1))
+        cache->countryGraph->addPaths(srcCountry, dstCountry, -1, linkDelta);
     sem.release();
 }
 
+// must be called with sem held, moves the link contribution if an end AS changed country
+void Link::checkCountry(){
+    if (cache->countryGraph == NULL)
+        return;
+    short srcIdx=srcAS->getCountryIdx(), dstIdx=dstAS->getCountryIdx();
+    if ((srcIdx != srcCountry) || (dstIdx != dstCountry)){
+        if ((srcCountry != -1) && (dstCountry != -1))
+            cache->countryGraph->addPaths(srcCountry, dstCountry, -pathNum, active ? -1 : 0);
+        cache->countryGraph->addPaths(srcIdx, dstIdx, pathNum, active ? 1 : 0);
+        srcCountry = srcIdx;
+        dstCountry = dstIdx;
+    }
+}
+
 
 unsigned long Link::linkID(){
     unsigned long id=src;
@@ -1041,18 +1421,17 @@ void Link::unActive(unsigned int time){
 }
 
 bool Link::isTouched(){
-    return touched;
+    return touchEpoch == cache->epoch+1;
 }
 
 void Link::touch(){
-    if (!touched){
-        cache->touchedLinks.push(this);
-    }
-    touched = true;
+    unsigned int e=cache->epoch;
+    if (touchEpoch.exchange(e+1) != e+1)
+        cache->touchedLinks[e&1].push(this);
 }
 
 void Link::unTouch(){
-    touched = false;
+    touchEpoch = 0;
 }
 
 void Link::addLinks(unsigned int time){
@@ -1068,10 +1447,22 @@ void Link::removeLinks(unsigned int time){
 }
 
 
-void Link::checkEdge(BGPGraph *bgpg){
-    srcAS->checkVertex(bgpg);
-    dstAS->checkVertex(bgpg);
-    bgpg->add_edge(srcAS->getVertex(), dstAS->getVertex(), EdgeP{(int)pathNum,0,0, 1, cTime});
+EdgeP Link::edgeProps(){
+    return EdgeP{(int)pathNum,0,0, 1, cTime};
+}
+
+SAS Link::getSrcAS(){
+    return srcAS;
+}
+
+SAS Link::getDstAS(){
+    return dstAS;
+}
+
+void Link::setEdge(BGPGraph *bgpg, const VertexP &srcProps, const VertexP &dstProps, const EdgeP &props){
+    srcAS->setVertex(bgpg, srcProps);
+    dstAS->setVertex(bgpg, dstProps);
+    bgpg->add_edge(srcAS->getVertex(), dstAS->getVertex(), props);
 }
 
 void Link::removeEdge(BGPGraph *bgpg){
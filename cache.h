@@ -8,6 +8,8 @@
 #include <set>
 #include <map>
 #include <thread>
+#include <mutex>
+#include <deque>
 #include <limits>
 #include "BGPGraph.h"
 #include "BGPGeopolitics.h"
@@ -17,10 +19,14 @@
 #include "tbb/concurrent_unordered_map.h"
 #include "tbb/concurrent_unordered_set.h"
 #include "tbb/concurrent_queue.h"
+#include "tbb/concurrent_hash_map.h"
 #include "BlockingQueue.h"
 #include "apibgpview.h"
 #include "BGPRedis.hpp"
 #include "json.hpp"
+#include "BGPSketch.h"
+#include "BGPMemory.h"
+#include "BGPPeers.h"
 
 //using namespace boost;
 
@@ -42,6 +48,14 @@ extern sqlite3 *db;
 
 class Trie;
 class BGPGraph;
+class BGPAnalytics;
+class CountryGraph;
+class HijackDetector;
+class OutageDetector;
+class RouteStability;
+class PeerStats;
+class StatSketches;
+class CacheSizer;
 
 class Prefix{
 public:
@@ -53,32 +67,6 @@ public:
 };
 
 
-class Peer{
-protected:
-    unsigned int asNum;
-    unsigned int prefNum = 0;
-    unsigned int FullFeedThresh=400000;
-    bool isFullFeed = false;
-public:
-//    unsigned short int collectorNum;
-
-    Peer(unsigned int asNum): asNum(asNum){}
-    string str(){
-        return to_string(asNum);
-    }
-    
-    bool addPref(){
-        prefNum ++;
-        if (prefNum>FullFeedThresh)
-            isFullFeed = true;
-        return isFullFeed;
-    }
-    unsigned int getAsn(){
-        return asNum;
-    }
-};
-
-
 class semaphore
 {
     //The current semaphore count.
@@ -157,6 +145,8 @@ protected:
     unsigned int activePrefix24Num=0;
     unsigned int allPrefix24Num=0;
     unsigned int activePathsNum=0;
+    // written under mutex_, read without it by getCountryIdx
+    std::atomic<short> countryIdx={-1};
     unsigned int degree=0;
     MyThreadSafeSet<unsigned long> links;
     Trie *activePrefixTrie;
@@ -166,7 +156,8 @@ protected:
     int status=0;
     bool outage=false;
     boost::graph_traits<Graph>::vertex_descriptor vertex=-1;
-    bool touched = false;
+    // epoch+1 of the last touch, 0 if untouched
+    std::atomic<unsigned int> touchEpoch={0};
 private:
     mutable boost::shared_mutex mutex_;
 public:
@@ -180,10 +171,18 @@ public:
     void insertDB();
     void updateDB();
     int getStatus();
+    void setStatus(int flags, bool on);
     unsigned int getNum();
     string getName();
+    string getCountry();
+    short getCountryIdx();
+    // checkCountry() expects mutex_ held, refreshCountry() takes it
+    void checkCountry();
+    void refreshCountry();
     int size_of();
-    boost::graph_traits<Graph>::vertex_descriptor checkVertex(BGPGraph *bgpg);
+    // vertex properties now, copied at the interval cut
+    VertexP vertexProps();
+    boost::graph_traits<Graph>::vertex_descriptor setVertex(BGPGraph *bgpg, const VertexP &props);
     void removeVertex(BGPGraph *bgpg);
     void clearLinks();
     bool checkLink(unsigned long linkHash);
@@ -194,8 +193,13 @@ public:
     void addLink(unsigned long linkHash, unsigned int time);
     void removeLink(unsigned long linkHash, unsigned int time);
     bool withdraw(bgpstream_pfx_t *pfx,unsigned int time);
+    // space per address family, /24 for IPv4 and /48 for IPv6
+    void activeCounts(long &prefixes, long space[2]);
+    void getActivePrefixes(vector<bgpstream_pfx_t> &pfxs);
+    void restorePrefix(bgpstream_pfx_t *pfx);
     double fusionRisks();
     void toMap(std::unordered_map<std::string, std::string> &map);
+    string toRedisStr();
     void fromRedis(string str);
     void setObserved();
     bool isObserved();
@@ -217,11 +221,15 @@ protected:
     unsigned int cTime; //last Change Time
     bool active = false;
     int pathNum=0;
+    short srcCountry=-1;
+    short dstCountry=-1;
 //    boost::graph_traits<Graph>::edge _descriptor edge;
-    bool touched = false;
+    // epoch+1 of the last touch, 0 if untouched
+    std::atomic<unsigned int> touchEpoch={0};
 private:
     semaphore sem;
 //    mutable boost::shared_mutex mutex_;
+    void checkCountry();
 public:
     Link(unsigned int src, unsigned int dst, unsigned int time);
     Link(std::unordered_map<std::string, std::string> map);
@@ -231,9 +239,15 @@ public:
     void addPath(unsigned int time);
     void withdraw(unsigned int time);
     void toRedis(std::unordered_map<std::string, std::string> &map);
+    string toRedisStr();
+    string linkStr();
     void fromRedis(string str);
     unsigned long linkID();
-    void checkEdge(BGPGraph *bgpg);
+    EdgeP edgeProps();
+    SAS getSrcAS();
+    SAS getDstAS();
+    // adds the edge and its end vertices with the properties copied at the cut
+    void setEdge(BGPGraph *bgpg, const VertexP &srcProps, const VertexP &dstProps, const EdgeP &props);
     void removeEdge(BGPGraph *bgpg);
     bool isActive();
     void setActive(unsigned int time);
@@ -255,7 +269,7 @@ public:
     unsigned int hash=0;
     char pathLength;
     char shortPathLength;
-    unsigned int *shortPath;
+    unsigned int *shortPath=NULL;
     unsigned int prefNum = 0;
     short int collector;
     bool active = true;
@@ -265,6 +279,10 @@ public:
     short int AADiff=0, AADup=0, WADup=0, WWDup=0, Flap=0, Withdraw=0;
     double globalRisk=0.0;
     double meanUp=0.0, meanDown=0.0;
+    // decayed flap penalty, see RouteStability
+    DecayedScore instability;
+    // epoch+1 of the last change not yet written to Redis, 0 if clean
+    std::atomic<unsigned int> touchEpoch={0};
     semaphore sem;
 
     PrefixPath(BGPMessage *bgpMessage, unsigned int time);
@@ -274,6 +292,8 @@ public:
     PrefixPath();
     ~PrefixPath();
     void setHash(unsigned int h);
+    // (re)allocates shortPath, charged to MEMPATHS
+    void allocPath(int length);
     double getScore() const;
     string str() const ;
     string sstr() const;
@@ -298,17 +318,60 @@ typedef std::shared_ptr<PrefixPath> SPrefixPath;
 
 
 class BGPEvent;
+
+// Records and graph properties of the ASes, links and paths changed in an
+// interval, copied while the workers are held at its end
+struct IntervalCut{
+    struct Vertex{
+        AS *as;
+        bool keep;
+        VertexP props;
+    };
+    struct Edge{
+        Link *link;
+        bool active;
+        VertexP src, dst;
+        EdgeP props;
+    };
+    unsigned int end;
+    vector<BGPBatchEvent *> batches;
+    vector<Vertex> vertices;
+    vector<Edge> edges;
+};
+
 class BGPCache {
 public:
-    int numActivePath=0;
+    std::atomic<int> numActivePath={0};
+    // routing entries with a route, summed over the prefixes
+    std::atomic<long> numActiveRoutes={0};
     unsigned int beginTime;
     map<string, unsigned short int> &collectors;
     ShardedBGPRedis *bgpRedis;
     BlockingCollection<BGPAPI *> toAPIbgpbiew;
-    concurrent_queue<AS *> touchedASes;
-    concurrent_queue<Link *> touchedLinks;
-
-    MyThreadSafeMap<unsigned short int, Peer*> peersMap;
+    // workers tag their changes with the current epoch, each interval cut
+    // flips it once no worker is left inside
+    std::atomic<unsigned int> epoch={0};
+    std::atomic<int> epochWorkers[2];
+    // pauses in progress, the cuts and the checkpoints
+    std::atomic<int> paused={0};
+    // last second of the open interval, 0 while no interval is started
+    std::atomic<unsigned int> intervalEnd={0};
+    unsigned int intervalDuration=0;
+    // taken and not yet dumped by makeGraph, in interval order
+    std::mutex cutMutex;
+    std::deque<IntervalCut *> cuts;
+    // run at each cut taken by an update, with the workers still held
+    std::function<void(unsigned int end)> onCut;
+    concurrent_queue<AS *> touchedASes[2];
+    concurrent_queue<Link *> touchedLinks[2];
+    // paths changed in the epoch, written back once per interval or on eviction
+    concurrent_queue<SPrefixPath> touchedPaths[2];
+    std::atomic<long> pathChanges={0}, pathWrites={0};
+    // dirty paths evicted whose PTHUPD is not on Redis yet: hash -> (path, writes pending);
+    // a reload goes here before Redis, which still holds the older record
+    tbb::concurrent_hash_map<unsigned int, pair<SPrefixPath, int>> evictedPaths;
+
+    PeerRegistry peers;
     MyThreadSafeMap<unsigned int, SAS> asCache;
     MyThreadSafeMap<unsigned long, Link *> linksMap;
     MyScalableLRUHashCache<SPrefixPath> pathsMap={500000,12};
@@ -318,6 +381,15 @@ public:
     
     
     MyThreadSafeSet<Bug *> bogons;
+    BGPAnalytics *analytics=NULL;
+    CountryGraph *countryGraph=NULL;
+    HijackDetector *hijacks=NULL;
+    OutageDetector *outages=NULL;
+    RouteStability *stability=NULL;
+    PeerStats *peerStats=NULL;
+    StatSketches *sketches=NULL;
+    MemoryAccountant *memory=NULL;
+    CacheSizer *sizer=NULL;
     string ppath;
     BGPGraph *bgpg;
     semaphore sem;
@@ -327,8 +399,11 @@ public:
         if (sqlite3_open(dbname.c_str(), &db) != SQLITE_OK) {
             cout << "Can't open database: " << sqlite3_errmsg(db) << endl;
         }
+        epochWorkers[0] = 0;
+        epochWorkers[1] = 0;
         apibgpview = new APIbgpview(toAPIbgpbiew);
         apiThread = std::thread(&APIbgpview::run, apibgpview);
+        pathsMap.setEvictionHandler([this](const SPrefixPath &path){pathEvicted(path);});
     }
 
     int fillASCache();
@@ -336,9 +411,39 @@ public:
     SAS chkAS(unsigned int asn, unsigned int time);
     Link *chkLink(unsigned int src, unsigned int dst, unsigned int time);
     long size_of();
+    long asCacheBytes();
+    long linksBytes();
+    // probes and shrink actions of the caches owned here
+    void registerMemory(MemoryAccountant *memory);
+    // path and routing caches handed to the adaptive sizing, capped by their memory budgets;
+    // the sizer becomes their only owner, their shrink actions are removed
+    void registerCaches(CacheSizer *sizer, MemoryAccountant *memory);
+    // id and string path caches together, they share one capacity
+    CacheCounters pathsCounters();
+    // eviction policy of the path and routing caches ("lru", "tinylfu" or "clock"), "policies" of file, TinyLFU by default; before use
+    void setCachePolicies(string file);
+    // intervals end every duration seconds from end on, see enterEpoch
+    void startIntervals(unsigned int end, unsigned int duration);
+    // dumps the cuts of the intervals up to time+dumpDuration-1 to the graph and Redis
     void makeGraph(BGPGraph* g, unsigned int time, unsigned int dumpDuration);
+    // marks a changed path dirty, it is written once per interval whatever the number of changes
+    void touchPath(const SPrefixPath &path);
+    // writes a dirty path now, its cache entry is gone; kept in evictedPaths until written
+    void pathEvicted(const SPrefixPath &path);
+    // the evicted path of hash still waiting for its write, NULL if none
+    SPrefixPath evictedPath(unsigned int hash);
+    // called by the Redis shard once a PTHUPD of hash is executed
+    void pathWritten(unsigned int hash);
+    // an update after the open interval first takes the cut of the interval
+    unsigned int enterEpoch(unsigned int time);
+    void exitEpoch(unsigned int e);
+    void pauseWorkers();
+    void resumeWorkers();
 private:
     APIbgpview *apibgpview;
+    // workers paused, cutMutex held
+    IntervalCut *takeCut(unsigned int end);
+    void applyCut(BGPGraph *g, IntervalCut *cut);
 };
 
 
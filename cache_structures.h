@@ -12,6 +12,7 @@
 #include <boost/thread/shared_mutex.hpp>
 #include <iostream>
 #include <map>
+#include <chrono>
 #include "tbb/concurrent_unordered_set.h"
 #include "tbb/concurrent_unordered_map.h"
 #include "tbb/parallel_for.h"
@@ -215,6 +216,23 @@ public:
         boost::shared_lock<boost::shared_mutex> lock(mutex_);
         return filter->contains(t);
     }
+
+    long memoryUsage(){
+        return filter->size()/bits_per_char+sizeof(bloom_filter);
+    }
+
+    string dump(){
+        boost::shared_lock<boost::shared_mutex> lock(mutex_);
+        return string((const char *)filter->table(), filter->size()/bits_per_char);
+    }
+
+    bool restore(const string &table){
+        boost::unique_lock<boost::shared_mutex> lock(mutex_);
+        if (table.size() != filter->size()/bits_per_char)
+            return false;
+        memcpy((void *)filter->table(), table.data(), table.size());
+        return true;
+    }
 };
 
 class ThreadSafeScalableBF{
@@ -253,14 +271,55 @@ public:
     template <typename T> inline void insert(const T& t){
         return getShard(t).insert(t);
     }
+
+    size_t shardNum(){
+        return m_numShards;
+    }
+
+    long memoryUsage(){
+        long sum=0;
+        for (auto &shard:m_shards)
+            sum += shard->memoryUsage();
+        return sum;
+    }
+
+    Shard& shard(size_t i){
+        return *m_shards.at(i);
+    }
 };
 
 
+// cumulative counters of a cache, fetches are misses served from Redis
+struct CacheCounters{
+    size_t lookups=0, hits=0, misses=0, inserts=0, evictions=0, fetches=0;
+    // microseconds spent in the fetches
+    size_t fetchTime=0;
+    size_t size=0, capacity=0;
+    long bytes=0;
+
+    CacheCounters &operator+=(const CacheCounters &other){
+        lookups += other.lookups;
+        hits += other.hits;
+        misses += other.misses;
+        inserts += other.inserts;
+        evictions += other.evictions;
+        fetches += other.fetches;
+        fetchTime += other.fetchTime;
+        size += other.size;
+        capacity += other.capacity;
+        bytes += other.bytes;
+        return *this;
+    }
+};
+
 template<typename TKey, typename TValue> class MyThreadSafeScalableCache: ThreadSafeScalableCache<TKey, TValue>{
 
 private:
-    std::atomic<unsigned int> cacheMiss={0};
-    std::atomic<unsigned int> cacheUse={0};
+    std::atomic<size_t> cacheHit={0};
+    std::atomic<size_t> cacheMiss={0};
+    std::atomic<size_t> cacheInsert={0};
+    std::atomic<size_t> cacheFetch={0};
+    std::atomic<size_t> fetchTime={0};
     
 public:
     typedef typename ThreadSafeScalableCache<TKey, TValue>::ConstAccessor ConstAccessor;
@@ -268,38 +327,74 @@ public:
     MyThreadSafeScalableCache(size_t maxSize, size_t numShards = 0):ThreadSafeScalableCache<TKey, TValue>(maxSize,numShards){
     }
     
-    void cacheMissed(){
-        cacheMiss++;
+    // a miss served from Redis, elapsed is the round trip
+    void fetched(std::chrono::steady_clock::duration elapsed){
+        cacheFetch.fetch_add(1, std::memory_order_relaxed);
+        fetchTime.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count(), std::memory_order_relaxed);
     }
     
     size_t getMissed(){
-        return cacheMiss;
+        return cacheMiss.load(std::memory_order_relaxed);
+    }
+
+    size_t getUsed(){
+        return cacheHit.load(std::memory_order_relaxed)+cacheMiss.load(std::memory_order_relaxed);
+    }
+
+    CacheCounters counters(){
+        CacheCounters c;
+        c.hits = cacheHit.load(std::memory_order_relaxed);
+        c.misses = cacheMiss.load(std::memory_order_relaxed);
+        c.lookups = c.hits+c.misses;
+        c.inserts = cacheInsert.load(std::memory_order_relaxed);
+        c.evictions = ThreadSafeScalableCache<TKey, TValue>::evictions();
+        c.fetches = cacheFetch.load(std::memory_order_relaxed);
+        c.fetchTime = fetchTime.load(std::memory_order_relaxed);
+        c.size = ThreadSafeScalableCache<TKey, TValue>::size();
+        c.capacity = ThreadSafeScalableCache<TKey, TValue>::maxSize();
+        c.bytes = ThreadSafeScalableCache<TKey, TValue>::memoryUsage();
+        return c;
     }
+
     std::pair<bool, TValue> insert(const TKey& key, const TValue& value){
-        cacheUse++;
+        cacheInsert.fetch_add(1, std::memory_order_relaxed);
         auto ret =ThreadSafeScalableCache<TKey, TValue>::insert(key,value);
         return ret;
     }
     
     
     std::pair<bool, TValue> insert(const TKey& key, const TValue& value, unsigned int hash){
-        cacheUse++;
+        cacheInsert.fetch_add(1, std::memory_order_relaxed);
         auto ret =ThreadSafeScalableCache<TKey, TValue>::insert(key,value,hash);
         return ret;
     }
     
     bool find(ConstAccessor& ac, const TKey& key){
-        cacheUse++;
-        return ThreadSafeScalableCache<TKey, TValue>::find(ac, key);
+        return counted(ThreadSafeScalableCache<TKey, TValue>::find(ac, key));
     }
     
     bool find(Accessor& ac, const TKey& key){
-        cacheUse++;
-        return ThreadSafeScalableCache<TKey, TValue>::find(ac, key);
+        return counted(ThreadSafeScalableCache<TKey, TValue>::find(ac, key));
+    }
+    
+    bool counted(bool found){
+        if (found)
+            cacheHit.fetch_add(1, std::memory_order_relaxed);
+        else
+            cacheMiss.fetch_add(1, std::memory_order_relaxed);
+        return found;
     }
     
     
     using ThreadSafeScalableCache<TKey, TValue>::size;
+    using ThreadSafeScalableCache<TKey, TValue>::snapshotKeys;
+    using ThreadSafeScalableCache<TKey, TValue>::setMaxSize;
+    using ThreadSafeScalableCache<TKey, TValue>::maxSize;
+    using ThreadSafeScalableCache<TKey, TValue>::memoryUsage;
+    using ThreadSafeScalableCache<TKey, TValue>::evictions;
+    using ThreadSafeScalableCache<TKey, TValue>::setPolicy;
+    using ThreadSafeScalableCache<TKey, TValue>::policy;
+    using ThreadSafeScalableCache<TKey, TValue>::setEvictionHandler;
 };
 
 
@@ -319,8 +414,7 @@ private:
     MyThreadSafeScalableCache<HashType,ValueType> idCache;
     MyThreadSafeScalableCache<string, ValueType> strCache;
 //    ThreadSafeScalableBF dataBFCache;
-    std::atomic<unsigned int> cacheMiss={0};
-    std::atomic<unsigned int> cacheUse={0};
+    std::atomic<size_t> cacheUse={0};
     std::atomic<unsigned int> globalCount={1};
     size_t capacity;
     using iterator= typename concurrent_unordered_map<HashType, ValueType>::iterator ;
@@ -348,6 +442,17 @@ public:
         return (make_pair(false, val));
     }
 
+    // copies the cached values, used by checkpoints
+    void snapshot(vector<ValueType> &values){
+        vector<HashType> keys;
+        IdAccessor ac;
+        idCache.snapshotKeys(keys);
+        for (auto key:keys){
+            if (idCache.find(ac,key))
+                values.push_back(*ac);
+        }
+    }
+
     pair<bool, ValueType> find(HashType h) {
         cacheUse++;
         IdAccessor ac;
@@ -388,33 +493,77 @@ public:
         return capacity;
     }
 
+    // both caches follow the capacity, evicting when it shrinks
+    void setCapacity(size_t newCapacity){
+        capacity = newCapacity;
+        idCache.setMaxSize(newCapacity);
+        strCache.setMaxSize(newCapacity);
+    }
+
+    long idMemoryUsage(){
+        return idCache.memoryUsage();
+    }
+
+    long strMemoryUsage(){
+        return strCache.memoryUsage();
+    }
+
     int size(){
         return idCache.size();
 
     }
 
-    size_t  cacheMissed(){
-        cacheMiss++;
-        return cacheMiss;
+    // both caches, before use
+    void setPolicy(EvictionPolicy policy){
+        idCache.setPolicy(policy);
+        strCache.setPolicy(policy);
     }
-    
-    size_t strCacheMissed(){
-        strCache.cacheMissed();
-        cacheMissed();
-        return strCache.getMissed();
+
+    // called with each value evicted from either cache, before use
+    void setEvictionHandler(std::function<void(const ValueType &)> handler){
+        idCache.setEvictionHandler([handler](const HashType &, const ValueType &value){handler(value);});
+        strCache.setEvictionHandler([handler](const string &, const ValueType &value){handler(value);});
     }
-    
-    size_t idCacheMissed(){
-        idCache.cacheMissed();
-        cacheMissed();
+
+    // a path missed by hash, then read from Redis
+    void idFetched(std::chrono::steady_clock::duration elapsed){
+        idCache.fetched(elapsed);
+    }
+
+    // a path missed by string, then read from Redis
+    void strFetched(std::chrono::steady_clock::duration elapsed){
+        strCache.fetched(elapsed);
+    }
+
+    size_t getUsed(){
+        return cacheUse;
+    }
+
+    size_t idMissed(){
         return idCache.getMissed();
     }
 
+    size_t strMissed(){
+        return strCache.getMissed();
+    }
+
+    CacheCounters idCounters(){
+        return idCache.counters();
+    }
+
+    CacheCounters strCounters(){
+        return strCache.counters();
+    }
+
     
     void setID(HashType val){
         globalCount=val;
     }
 
+    HashType getCurrentID(){
+        return globalCount;
+    }
+
 private:
     HashType getHash(string str){
         uint64_t h128[2];
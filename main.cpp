@@ -1,14 +1,30 @@
 #include <iostream>
+#include <csignal>
 #include <thread>
 #include <list>
+#include <cstdlib>
 #include "BlockingQueue.h"
 #include "BGPGeopolitics.h"
 #include "BGPSource.h"
 #include "cache.h"
 #include "BGPGraph.h"
 #include "BGPTables.h"
+#include "BGPAnalytics.h"
+#include "BGPCountry.h"
+#include "BGPCheckpoint.h"
 #include "BGPSaver.h"
 #include "BGPRedis.hpp"
+#include "BGPHistory.h"
+#include "BGPLookup.h"
+#include "BGPHijack.h"
+#include "BGPOutage.h"
+#include "BGPStability.h"
+#include "BGPPeerStats.h"
+#include "BGPStats.h"
+#include "BGPTrace.h"
+#include "BGPQueues.h"
+#include "BGPMetrics.h"
+#include "BGPCacheSizer.h"
 
 BGPCache *cache;
 sqlite3 *db;
@@ -19,7 +35,7 @@ RIBTable *bgpTable;
 class Wrapper {
     std::thread source, save, redis;
 public:
-    Wrapper(unsigned int t_start, unsigned int t_end, unsigned int dumpDuration, std::map<std::string, unsigned short int>& collectors ,  std::string& captype, int version, string path, string ppath,int port, int dbase) {
+    Wrapper(unsigned int t_start, unsigned int t_end, unsigned int dumpDuration, std::map<std::string, unsigned short int>& collectors ,  std::string& captype, int version, string path, string ppath,int port, int dbase, int analyticsBenchmark=0, unsigned int eventLogFlush=0, string lookupSocket="") {
         Redis *_redis;
         unsigned int t_begin=t_start;
         PriorityBlockingCollection<BGPMessage *,  PriorityContainer<BGPMessage *, BGPMessageComparer>> toTableFlag(10000);
@@ -29,22 +45,72 @@ public:
         bgpTable = new RIBTable(t_start, dumpDuration);
         int numShards=8;
         ShardedBGPRedis *bgpRedis= new ShardedBGPRedis("127.0.0.1", port, dbase,numShards);
+        // routing history goes to columnar segments instead of Redis lists, when asked
+        if (eventLogFlush>0)
+            bgpRedis->useEventLog(ppath+"/eventlog", 3600, eventLogFlush);
         BGPCache bgpCache(path+"resources/as.sqlite",&g, bgpRedis, collectors, t_start,ppath);
         cache= &bgpCache;
+        bgpCache.analytics = new BGPAnalytics(ppath);
+        // every analyticsBenchmark intervals the incremental state is checked against a full recompute
+        bgpCache.analytics->benchmarkEvery = analyticsBenchmark;
+        bgpCache.countryGraph = new CountryGraph();
+        bgpCache.hijacks = new HijackDetector();
+        bgpCache.outages = new OutageDetector(ppath);
+        bgpCache.stability = new RouteStability(ppath);
+        // feed quality per peer, partial and noisy peers are flagged each interval
+        bgpCache.peerStats = new PeerStats(bgpCache.peers, ppath);
+        bgpCache.sketches = new StatSketches();
+        // byte accounting per subsystem, budgets.json caps the caches
+        bgpCache.memory = new MemoryAccountant();
+        bgpCache.registerMemory(bgpCache.memory);
+        bgpCache.memory->loadBudgets(ppath+"/budgets.json");
+        // path and routing caches share the "caches" budget, sized on their miss cost within their own budgets
+        // scan resistant caches, a RIB dump does not flush the update working set
+        bgpCache.setCachePolicies(ppath+"/budgets.json");
+        bgpCache.sizer = new CacheSizer();
+        bgpCache.sizer->loadBudget(ppath+"/budgets.json");
+        bgpCache.registerCaches(bgpCache.sizer, bgpCache.memory);
+        bgpCache.memory->addProbe(MEMQUEUES, [&](){return (long)((toTableFlag.size()+toSaver.size())*sizeof(BGPMessage *));});
+        bgpCache.memory->addProbe(MEMPOOLS, [&](){return (long)bgpMessagePool.capacity*(long)sizeof(BGPMessage);});
+        // one message in 1024 is timed through the pipeline
+        tracer = new PipelineTracer(1024);
+        // depth and contention of the queues, reported each interval
+        queueRegistry = new QueueRegistry();
+        queueRegistry->instrument("toTableFlag", toTableFlag);
+        queueRegistry->instrument("toSaver", toSaver);
+        queueRegistry->instrument("messagePool", bgpMessagePool.bgpMessages);
+        for (int i=0;i<numShards;i++)
+            queueRegistry->instrument("redis"+to_string(i), *bgpRedis->getQueue(i));
+        // prefix lookups for the annotation jobs, served on a local socket when asked
+        if (!lookupSocket.empty()){
+            RIBLookupServer *lookupServer = new RIBLookupServer(new RIBLookup(bgpTable), lookupSocket);
+            std::thread(&RIBLookupServer::run, lookupServer).detach();
+        }
         int numofWorkers=8;
         vector<std::thread> workers(numofWorkers);
         vector<std::thread> bgpSavers(4);
         bool dataInRedis=false;
         bgpRedis->setSavingMode();
         vector<string> strs;
-        _redis=bgpRedis->getRedis(0);
-        _redis->lrange("CAPT", 0,0,std::inserter(strs, strs.begin()));
-        if (strs.size()>0){
+        BGPCheckpoint *checkpoint = new BGPCheckpoint(ppath+"/checkpoints");
+        unsigned int checkpointTime = checkpoint->latest();
+        if ((checkpointTime != 0) && checkpoint->load(checkpointTime)){
+            // resume from the local checkpoint, Redis is not read
             dataInRedis=true;
-            t_begin=from_myencoding(strs[0])+1;
-            bgpRedis->populate();
+            t_begin=checkpointTime+1;
         } else {
-            bgpCache.fillASCache();
+            _redis=bgpRedis->getRedis(0);
+            _redis->lrange("CAPT", 0,0,std::inserter(strs, strs.begin()));
+            if (strs.size()>0){
+                dataInRedis=true;
+                t_begin=from_myencoding(strs[0])+1;
+                if (!bgpRedis->populate()){
+                    cout<<"Cannot load the state from Redis, stopping"<<endl;
+                    exit(EXIT_FAILURE);
+                }
+            } else {
+                bgpCache.fillASCache();
+            }
         }
 
         if (dataInRedis &&(t_begin>=t_start-8*60*60)){ //it t_begin within 8 hours of t_start
@@ -52,7 +118,38 @@ public:
         } else
             captype="R";
         BlockingCollection<GraphToSave *> graphsToSave(4);
+        queueRegistry->instrument("graphsToSave", graphsToSave);
+        // Prometheus scrapes on the loopback, see BGPMetrics.h
+        metricsServer = new MetricsServer(9464);
+        metricsServer->addGauge("bgpgeopol_pool_free", "Messages available in the pool", [&](){return bgpMessagePool.bgpMessages.size();});
+        metricsServer->addGauge("bgpgeopol_pool_capacity", "Messages allocated by the pool", [&](){return bgpMessagePool.capacity;});
+        vector<pair<string, std::function<CacheCounters()>>> cacheCounters={
+            {"pathsId", [&](){return bgpCache.pathsMap.idCounters();}},
+            {"pathsStr", [&](){return bgpCache.pathsMap.strCounters();}},
+            {"routing", [&](){return bgpCache.routingentries.counters();}}};
+        for (auto &c:cacheCounters){
+            string label="{cache=\""+c.first+"\"}";
+            auto counters=c.second;
+            metricsServer->addCounter("bgpgeopol_cache_hits_total"+label, "Cache lookups found", [counters](){return counters().hits;});
+            metricsServer->addCounter("bgpgeopol_cache_misses_total"+label, "Cache lookups not found", [counters](){return counters().misses;});
+            metricsServer->addCounter("bgpgeopol_cache_evictions_total"+label, "Cache entries evicted", [counters](){return counters().evictions;});
+            metricsServer->addCounter("bgpgeopol_cache_fetches_total"+label, "Misses read back from Redis", [counters](){return counters().fetches;});
+            metricsServer->addCounter("bgpgeopol_cache_fetch_seconds_total"+label, "Time of the Redis reads after a miss", [counters](){return counters().fetchTime/1e6;});
+            metricsServer->addGauge("bgpgeopol_cache_size"+label, "Cached entries", [counters](){return counters().size;});
+            metricsServer->addGauge("bgpgeopol_cache_capacity"+label, "Cache capacity", [counters](){return counters().capacity;});
+        }
+        metricsServer->addGauge("bgpgeopol_active_paths", "Paths used by at least one route", [&](){return bgpCache.numActivePath.load();});
+        metricsServer->addGauge("bgpgeopol_active_routes", "Announced (prefix, peer) routes", [&](){return bgpCache.numActiveRoutes.load();});
+        for (int i=0;i<MEMSUBSYSTEMS;i++){
+            MemSubsystem subsystem=(MemSubsystem)i;
+            metricsServer->addGauge("bgpgeopol_memory_bytes{subsystem=\""+string(MemoryAccountant::name(subsystem))+"\"}", "Accounted bytes per subsystem",
+                                    [&bgpCache, subsystem](){return bgpCache.memory->usage(subsystem);});
+        }
+        std::thread(&MetricsServer::run, metricsServer).detach();
         ScheduleSaver *saver = new ScheduleSaver(t_begin, dumpDuration, toSaver, bgpTable, graphsToSave, ppath);
+        saver->pool = &bgpMessagePool;
+        // taken at the interval cut, before any update of the next interval
+        bgpCache.onCut = [checkpoint](unsigned int end){checkpoint->intervalEnded(end);};
         BGPSaver *bgpSaver= new BGPSaver(graphsToSave);
         for(int i=0;i<3;i++){
             bgpSavers[i]=std::thread(&BGPSaver::run, bgpSaver);
@@ -76,6 +173,8 @@ public:
 };
 
 int main(int argc, char **argv) {
+    // a client closing its socket early (scrape timeout, lookup query) must not end the process
+    signal(SIGPIPE, SIG_IGN);
     unsigned int start =1573689600;
     unsigned int end = start+16*24*60*60;
 
@@ -105,6 +204,31 @@ int main(int argc, char **argv) {
         if (command6=="-DB")
            dbase=stoi(argv[13]);
     }
+    int analyticsBenchmark=0;
+    unsigned int eventLogFlush=0;
+    string lookupSocket;
+    for (int i=14; i+1<argc; i+=2) {
+        string option(argv[i]);
+        if (option=="-AB")
+            analyticsBenchmark=stoi(argv[i+1]);
+        if (option=="-EL")
+            // routing history in local segments written every given seconds, PRE: lists otherwise
+            eventLogFlush=stoul(argv[i+1]);
+        if (option=="-LS")
+            // unix socket of the RIB lookup service, not served otherwise
+            lookupSocket=argv[i+1];
+        if (option=="-BENCH") {
+            // full table reconstruction at the given time from both histories
+            unsigned int time=stoul(argv[i+1]);
+            int numShards=8;
+            RIBHistory logHistory(ppath+"/eventlog", numShards);
+            logHistory.benchmark(time);
+            ShardedBGPRedis *bgpRedis= new ShardedBGPRedis("127.0.0.1", port, dbase,numShards);
+            RIBHistory redisHistory(bgpRedis);
+            redisHistory.benchmark(time);
+            return 0;
+        }
+    }
     std::map<std::string, unsigned short int > collectors;
     collectors.insert(pair<string, unsigned short int >("rrc00",0));
     collectors.insert(pair<string, unsigned short int >("rrc01",1));
@@ -126,7 +250,7 @@ int main(int argc, char **argv) {
     collectors.insert(pair<string, unsigned short int >("rrc19",17));
     collectors.insert(pair<string, unsigned short int >("rrc20",18));
     collectors.insert(pair<string, unsigned short int >("rrc21",19));
-    Wrapper *w = new Wrapper(start, end, dumpDuration, collectors, mode,4, path, ppath, port, dbase);
+    Wrapper *w = new Wrapper(start, end, dumpDuration, collectors, mode,4, path, ppath, port, dbase, analyticsBenchmark, eventLogFlush, lookupSocket);
     return 0;
 }
 